@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "huffman.h"
+#include "synth.h"
+#include "lzss.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::vector;
+
+typedef int (*bench_fn)(huffman_context& hctx, data_buf& in_buf,
+                        data_buf& out_buf);
+
+// Format and level of an LZSS codec, from the options of its name
+struct lzss_options {
+  lzss_format_t format;
+  int level;
+};
+
+typedef int (*lzss_bench_fn)(const lzss_options& opt, data_buf& in_buf,
+                             data_buf& out_buf);
+
+struct bench_codec {
+  const char* name;
+  // Whether the codec uses more than one thread; others run once per
+  // dataset, at one thread.
+  bool parallel;
+  bench_fn encode;
+  bench_fn decode;
+  // LZSS encoders take their options instead of a context
+  lzss_bench_fn encode_lzss;
+};
+
+// A codec as named with -C, with the options given after its name
+struct bench_selection {
+  const bench_codec* codec;
+  string name;
+  lzss_options lzss;
+};
+
+static int encode_naive(huffman_context& hctx, data_buf& in, data_buf& out) {
+  return huffman_encode_parallel(hctx, in, out, OPENMP_NAIVE);
+}
+
+static int encode_histogram(huffman_context& hctx, data_buf& in,
+                            data_buf& out) {
+  return huffman_encode_parallel(hctx, in, out, OPENMP_ParallelHistogram);
+}
+
+// The codec is read from the stream, so one decoder serves every variant.
+static int decode_parallel(huffman_context& hctx, data_buf& in,
+                           data_buf& out) {
+  return huffman_decode_parallel(hctx, in, out, OPENMP_NAIVE);
+}
+
+// Copy the output of an in-memory LZSS call into a data_buf.
+static void lzss_output(std::vector<uint8_t>& result, data_buf& out) {
+  out.data = new unsigned char[result.size()];
+  out.size = result.size();
+  out.curr_offset = 0;
+  if (!result.empty())
+    memcpy(out.data, result.data(), result.size());
+}
+
+template <lzss_finder_t finder>
+static int encode_lzss(const lzss_options& opt, data_buf& in, data_buf& out) {
+  std::vector<uint8_t> result;
+  int ret = EncodeLZSS(in.data, in.size, result, finder, opt.format,
+                       opt.level);
+  lzss_output(result, out);
+  return ret;
+}
+
+// The finder the library picks for the format
+static int encode_lzss_default(const lzss_options& opt, data_buf& in,
+                               data_buf& out) {
+  std::vector<uint8_t> result;
+  int ret = EncodeLZSS(in.data, in.size, result,
+                       LZSSDefaultFinder(opt.format), opt.format, opt.level);
+  lzss_output(result, out);
+  return ret;
+}
+
+static int decode_lzss(huffman_context&, data_buf& in, data_buf& out) {
+  std::vector<uint8_t> result;
+  int ret = DecodeLZSS(in.data, in.size, result);
+  lzss_output(result, out);
+  return ret;
+}
+
+static int encode_lzss_parallel(const lzss_options& opt, data_buf& in,
+                                data_buf& out) {
+  std::vector<uint8_t> result;
+  int ret = EncodeLZSSParallel(in.data, in.size, result,
+                               LZSSDefaultFinder(opt.format), opt.format,
+                               opt.level);
+  lzss_output(result, out);
+  return ret;
+}
+
+static int decode_lzss_parallel(huffman_context&, data_buf& in,
+                                data_buf& out) {
+  std::vector<uint8_t> result;
+  int ret = DecodeLZSSParallel(in.data, in.size, result);
+  lzss_output(result, out);
+  return ret;
+}
+
+static const bench_codec codecs[] = {
+  {"seq", false, huffman_encode_seq, huffman_decode_seq},
+  {"naive", true, encode_naive, decode_parallel},
+  {"histogram", true, encode_histogram, decode_parallel},
+  {"order1", true, huffman_encode_order1, huffman_decode_order1},
+  {"tans", true, tans_encode_parallel, tans_decode_parallel},
+  {"block", true, huffman_encode_block, huffman_decode_block},
+  {"small", false, huffman_encode_small, huffman_decode_small},
+  {"lzss", false, NULL, decode_lzss, encode_lzss_default},
+  // Every LZSS match finder, to compare them on the same data
+  {"lzss_brute", false, NULL, decode_lzss, encode_lzss<LZSS_FIND_BRUTE>},
+  {"lzss_list", false, NULL, decode_lzss, encode_lzss<LZSS_FIND_LIST>},
+  {"lzss_hash", false, NULL, decode_lzss, encode_lzss<LZSS_FIND_HASH>},
+  {"lzss_kmp", false, NULL, decode_lzss, encode_lzss<LZSS_FIND_KMP>},
+  {"lzss_tree", false, NULL, decode_lzss, encode_lzss<LZSS_FIND_TREE>},
+  {"lzss_chain", false, NULL, decode_lzss, encode_lzss<LZSS_FIND_CHAIN>},
+  {"lzss_suffix", true, NULL, decode_lzss, encode_lzss<LZSS_FIND_SUFFIX>},
+  {"lzss_parallel", true, NULL, decode_lzss_parallel, encode_lzss_parallel},
+};
+static const int num_codecs = sizeof(codecs) / sizeof(codecs[0]);
+// Codecs run when none are named. The other LZSS finders are slow enough
+// to ask for; the suffix finder builds its matches on every thread.
+static const char* default_codecs[] = {
+  "seq", "naive", "histogram", "order1", "tans", "block", "lzss_suffix"
+};
+
+const char* bench_codec_names() {
+  return "seq,naive,histogram,order1,tans,block,small,lzss,lzss_brute,"
+         "lzss_list,lzss_hash,lzss_kmp,lzss_tree,lzss_chain,lzss_suffix,"
+         "lzss_parallel";
+}
+
+static const bench_codec* find_codec(const string& name) {
+  for (int i = 0; i < num_codecs; i++)
+    if (name == codecs[i].name)
+      return &codecs[i];
+  return NULL;
+}
+
+/*
+ * Look up a codec named as name[:L<level>][:w<bits>l<bits>], e.g.
+ * lzss_chain:L6:w16l8. The options set the level and format of the LZSS
+ * codecs; they default to the library's defaults.
+ */
+static bool parse_codec(const string& spec, bench_selection& sel) {
+  size_t colon = spec.find(':');
+  sel.codec = find_codec(spec.substr(0, colon));
+  sel.name = spec;
+  lzss_format_t format = LZSS_DEFAULT_FORMAT;
+  sel.lzss.format = format;
+  sel.lzss.level = LZSS_DEFAULT_LEVEL;
+  if (!sel.codec)
+    return false;
+  while (colon != string::npos) {
+    size_t next = spec.find(':', colon + 1);
+    string opt = spec.substr(colon + 1, next == string::npos ?
+                             string::npos : next - colon - 1);
+    colon = next;
+    unsigned int offset_bits, length_bits;
+    char end;
+    if (!sel.codec->encode_lzss) {
+      fprintf(stderr, "%s takes no options\n", sel.codec->name);
+      return false;
+    }
+    if (sscanf(opt.c_str(), "L%d%c", &sel.lzss.level, &end) == 1 &&
+        sel.lzss.level >= LZSS_MIN_LEVEL && sel.lzss.level <= LZSS_MAX_LEVEL)
+      continue;
+    if (sscanf(opt.c_str(), "w%ul%u%c", &offset_bits, &length_bits,
+               &end) == 2) {
+      sel.lzss.format.offsetBits = offset_bits;
+      sel.lzss.format.lengthBits = length_bits;
+      if (LZSSCheckFormat(sel.lzss.format) == 0)
+        continue;
+    }
+    fprintf(stderr, "Bad option %s of %s\n", opt.c_str(), spec.c_str());
+    return false;
+  }
+  return true;
+}
+
+/*
+ * FNV-1a over 8-byte words, then the tail bytes. It only has to tell
+ * datasets apart, and it keeps up with reading a large dump.
+ */
+uint64_t dataset_hash(const unsigned char* data, size_t size) {
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t h = 0xcbf29ce484222325ULL ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    h = (h ^ word) * prime;
+  }
+  for (; i < size; i++)
+    h = (h ^ data[i]) * prime;
+  return h;
+}
+
+string machine_id() {
+  char host[256] = "unknown";
+  string model = "unknown";
+#ifdef __linux__
+  gethostname(host, sizeof(host) - 1);
+  FILE* fp = fopen("/proc/cpuinfo", "r");
+  if (fp) {
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+      char* colon = strchr(line, ':');
+      if (strncmp(line, "model name", 10) == 0 && colon) {
+        model = colon + 2;
+        model.erase(model.find_last_not_of(" \n") + 1);
+        break;
+      }
+    }
+    fclose(fp);
+  }
+#endif
+  char cores[32];
+  snprintf(cores, sizeof(cores), "%d", omp_get_num_procs());
+  string id = string(host) + "/" + model + "/" + cores;
+  // The id is a CSV field
+  std::replace(id.begin(), id.end(), ',', ' ');
+  return id;
+}
+
+bool load_dataset(const string& name, vector<unsigned char>& data) {
+  if (is_synth_spec(name))
+    return synth_generate(name, data);
+  FILE* fp = fopen(name.c_str(), "rb");
+  if (!fp)
+    return false;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  data.resize(size > 0 ? size : 0);
+  size_t n = data.empty() ? 0 : fread(data.data(), 1, data.size(), fp);
+  fclose(fp);
+  return n == data.size();
+}
+
+/*
+ * Baselines are lines of machine,hash,codec,threads,compress,decompress.
+ * The last line for a key wins, so storing appends.
+ */
+bool baseline_lookup(const string& file, const string& machine,
+                     uint64_t hash, const string& codec, int threads,
+                     double* compress_time, double* decompress_time) {
+  FILE* fp = fopen(file.c_str(), "r");
+  if (!fp)
+    return false;
+  char line[1024];
+  bool found = false;
+  while (fgets(line, sizeof(line), fp)) {
+    char* fields[6];
+    int n = 0;
+    for (char* p = strtok(line, ",\n"); p && n < 6; p = strtok(NULL, ",\n"))
+      fields[n++] = p;
+    if (n != 6 || machine != fields[0] || codec != fields[2] ||
+        strtoull(fields[1], NULL, 16) != hash || atoi(fields[3]) != threads)
+      continue;
+    *compress_time = atof(fields[4]);
+    *decompress_time = atof(fields[5]);
+    found = true;
+  }
+  fclose(fp);
+  return found;
+}
+
+void baseline_store(const string& file, const string& machine,
+                    uint64_t hash, const string& codec, int threads,
+                    double compress_time, double decompress_time) {
+  FILE* fp = fopen(file.c_str(), "a");
+  if (!fp)
+    return;
+  fprintf(fp, "%s,%016llx,%s,%d,%.9f,%.9f\n", machine.c_str(),
+          (unsigned long long)hash, codec.c_str(), threads, compress_time,
+          decompress_time);
+  fclose(fp);
+}
+
+// Bind OpenMP thread i of a team of num_threads to core i.
+static void pin_threads(int num_threads) {
+#ifdef __linux__
+  int num_cpus = omp_get_num_procs();
+  #pragma omp parallel num_threads(num_threads)
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(omp_get_thread_num() % num_cpus, &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+  }
+#endif
+}
+
+static void unpin_threads(int num_threads) {
+#ifdef __linux__
+  int num_cpus = omp_get_num_procs();
+  #pragma omp parallel num_threads(num_threads)
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int i = 0; i < num_cpus; i++)
+      CPU_SET(i, &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+  }
+#endif
+}
+
+static double percentile(const vector<double>& sorted, double p) {
+  return sorted[(size_t)(p * (sorted.size() - 1) + 0.5)];
+}
+
+struct bench_result {
+  string dataset;
+  uint64_t hash;
+  size_t size;
+  string codec;
+  int threads;
+  double ratio;
+  double compress_median, compress_p95;
+  double decompress_median, decompress_p95;
+  // Against the stored seq baseline; 0 if there is none
+  double compress_speedup, decompress_speedup;
+};
+
+/*
+ * Time one codec on one dataset: warmup calls, checked against the input,
+ * then reps timed calls.
+ */
+static bool bench_one(const bench_config& config, const bench_selection& sel,
+                      int threads, vector<unsigned char>& data,
+                      bench_result& r) {
+  const bench_codec& codec = *sel.codec;
+  huffman_context hctx = config.settings;
+  hctx.num_threads = threads;
+  vector<double> enc, dec;
+  size_t size = data.size();
+  // LZSS takes its thread count from OpenMP rather than a context
+  int max_threads = omp_get_max_threads();
+  omp_set_num_threads(threads);
+  for (int rep = 0; rep < config.warmup + config.reps; rep++) {
+    data_buf in_buf(data.data(), size);
+    data_buf tmp_buf, out_buf;
+    double t0 = CycleTimer::currentSeconds();
+    if (codec.encode_lzss)
+      codec.encode_lzss(sel.lzss, in_buf, tmp_buf);
+    else
+      codec.encode(hctx, in_buf, tmp_buf);
+    double t1 = CycleTimer::currentSeconds();
+    tmp_buf.rewind();
+    codec.decode(hctx, tmp_buf, out_buf);
+    double t2 = CycleTimer::currentSeconds();
+
+    bool ok = out_buf.size == data.size() &&
+              (data.empty() || memcmp(out_buf.data, data.data(), data.size()) == 0);
+    r.ratio = data.empty() ? 0 : tmp_buf.size * 1.0 / data.size();
+    delete[] tmp_buf.data;
+    delete[] out_buf.data;
+    if (!ok) {
+      fprintf(stderr, "%s with %d threads did not round trip %s\n",
+              sel.name.c_str(), threads, r.dataset.c_str());
+      omp_set_num_threads(max_threads);
+      return false;
+    }
+    if (rep >= config.warmup) {
+      enc.push_back(t1 - t0);
+      dec.push_back(t2 - t1);
+    }
+  }
+  omp_set_num_threads(max_threads);
+  std::sort(enc.begin(), enc.end());
+  std::sort(dec.begin(), dec.end());
+  r.compress_median = percentile(enc, 0.5);
+  r.compress_p95 = percentile(enc, 0.95);
+  r.decompress_median = percentile(dec, 0.5);
+  r.decompress_p95 = percentile(dec, 0.95);
+  return true;
+}
+
+static void write_csv(FILE* out, const vector<bench_result>& results) {
+  fprintf(out, "Dataset,Hash,Bytes,Codec,Threads,Ratio,CompressMedian,"
+          "CompressP95,DecompressMedian,DecompressP95,CompressGB/s,"
+          "DecompressGB/s,CompressSpeedup,DecompressSpeedup\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const bench_result& r = results[i];
+    fprintf(out, "%s,%016llx,%zu,%s,%d,%.6f,%.9f,%.9f,%.9f,%.9f,%.6f,%.6f,"
+            "%.4f,%.4f\n", r.dataset.c_str(), (unsigned long long)r.hash,
+            r.size, r.codec.c_str(), r.threads, r.ratio, r.compress_median,
+            r.compress_p95, r.decompress_median, r.decompress_p95,
+            r.size / r.compress_median / 1e9, r.size / r.decompress_median / 1e9,
+            r.compress_speedup, r.decompress_speedup);
+  }
+}
+
+static void write_json(FILE* out, const string& machine,
+                       const vector<bench_result>& results) {
+  fprintf(out, "{\"machine\": \"%s\", \"results\": [", machine.c_str());
+  for (size_t i = 0; i < results.size(); i++) {
+    const bench_result& r = results[i];
+    fprintf(out, "%s\n  {\"dataset\": \"%s\", \"hash\": \"%016llx\", "
+            "\"bytes\": %zu, \"codec\": \"%s\", \"threads\": %d, "
+            "\"ratio\": %.6f, \"compress_median\": %.9f, "
+            "\"compress_p95\": %.9f, \"decompress_median\": %.9f, "
+            "\"decompress_p95\": %.9f, \"compress_speedup\": %.4f, "
+            "\"decompress_speedup\": %.4f}", i ? "," : "", r.dataset.c_str(),
+            (unsigned long long)r.hash, r.size, r.codec.c_str(), r.threads,
+            r.ratio, r.compress_median, r.compress_p95, r.decompress_median,
+            r.decompress_p95, r.compress_speedup, r.decompress_speedup);
+  }
+  fprintf(out, "\n]}\n");
+}
+
+static bool write_file(const string& name, const string& machine,
+                       const vector<bench_result>& results, bool json) {
+  FILE* out = name == "-" ? stdout : fopen(name.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "Can't open %s\n", name.c_str());
+    return false;
+  }
+  if (json)
+    write_json(out, machine, results);
+  else
+    write_csv(out, results);
+  if (out != stdout)
+    fclose(out);
+  return true;
+}
+
+int run_benchmarks(const bench_config& config) {
+  vector<bench_selection> selected;
+  vector<string> names = config.codecs;
+  if (names.empty())
+    names.assign(default_codecs, default_codecs + sizeof(default_codecs) /
+                 sizeof(default_codecs[0]));
+  for (size_t i = 0; i < names.size(); i++) {
+    bench_selection sel;
+    if (!parse_codec(names[i], sel)) {
+      if (!sel.codec)
+        fprintf(stderr, "Unknown codec %s; choose from %s\n",
+                names[i].c_str(), bench_codec_names());
+      return 1;
+    }
+    selected.push_back(sel);
+  }
+  vector<int> threads = config.threads;
+  if (threads.empty())
+    threads.push_back(omp_get_num_procs());
+
+  string machine = machine_id();
+  vector<bench_result> results;
+  int failures = 0;
+  for (size_t d = 0; d < config.datasets.size(); d++) {
+    vector<unsigned char> data;
+    if (!load_dataset(config.datasets[d], data)) {
+      fprintf(stderr, "Can't read %s\n", config.datasets[d].c_str());
+      return 1;
+    }
+    uint64_t hash = dataset_hash(data.data(), data.size());
+
+    for (size_t c = 0; c < selected.size(); c++) {
+      const bench_codec& codec = *selected[c].codec;
+      for (size_t t = 0; t < threads.size(); t++) {
+        int num_threads = codec.parallel ? threads[t] : 1;
+        // Sequential codecs only need one run per dataset
+        if (!codec.parallel && t > 0)
+          break;
+        if (config.pin)
+          pin_threads(num_threads);
+
+        bench_result r;
+        r.dataset = config.datasets[d];
+        r.hash = hash;
+        r.size = data.size();
+        r.codec = selected[c].name;
+        r.threads = num_threads;
+        if (!bench_one(config, selected[c], num_threads, data, r)) {
+          failures++;
+          continue;
+        }
+        if (r.codec == "seq")
+          baseline_store(config.baseline_file, machine, hash, "seq", 1,
+                         r.compress_median, r.decompress_median);
+        double base_c, base_d;
+        r.compress_speedup = r.decompress_speedup = 0;
+        if (baseline_lookup(config.baseline_file, machine, hash, "seq", 1,
+                            &base_c, &base_d)) {
+          r.compress_speedup = base_c / r.compress_median;
+          r.decompress_speedup = base_d / r.decompress_median;
+        }
+        results.push_back(r);
+        printf("%s %s %dT: ratio %.4f, compress %.6fs (p95 %.6fs), "
+               "decompress %.6fs (p95 %.6fs)\n", r.dataset.c_str(),
+               r.codec.c_str(), r.threads, r.ratio, r.compress_median,
+               r.compress_p95, r.decompress_median, r.decompress_p95);
+      }
+    }
+  }
+  if (config.pin)
+    unpin_threads(omp_get_num_procs());
+
+  if (!config.csv_file.empty() &&
+      !write_file(config.csv_file, machine, results, false))
+    return 1;
+  if (!config.json_file.empty() &&
+      !write_file(config.json_file, machine, results, true))
+    return 1;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "huffman.h"
+
+/*
+ * Benchmark harness: every selected codec runs on every dataset and
+ * thread count, a few warmup calls then reps measured calls, and reports
+ * the median and 95th percentile of each direction. Results are written as
+ * CSV and JSON, and the sequential run becomes the baseline for later
+ * speedups, stored per dataset content and machine.
+ */
+struct bench_config {
+  bench_config() : warmup(1), reps(5), pin(true),
+    baseline_file("bench_baselines.csv") {}
+
+  // Files or synth: specs (synth.h)
+  std::vector<std::string> datasets;
+  // Names from bench_codec_names(), LZSS ones with :L<level> and
+  // :w<bits>l<bits> options; empty selects every Huffman codec
+  std::vector<std::string> codecs;
+  std::vector<int> threads;
+  int warmup;
+  int reps;
+  // Pin OpenMP threads to cores for each thread count
+  bool pin;
+  std::string csv_file;
+  std::string json_file;
+  std::string baseline_file;
+  // Block size, thresholds and pool of the contexts; the thread count is
+  // set per run
+  huffman_context settings;
+};
+
+// Comma separated names of the codecs the harness knows
+const char* bench_codec_names();
+
+// Run every configuration. Returns 0, or 1 if a dataset can't be read, a
+// codec is unknown or a round trip doesn't match its input.
+int run_benchmarks(const bench_config& config);
+
+// Hash of the contents of a dataset, to key its baselines
+uint64_t dataset_hash(const unsigned char* data, size_t size);
+
+// Host name, CPU model and core count
+std::string machine_id();
+
+// Read a whole file, or generate a synth: spec; returns false if it can't
+// be read.
+bool load_dataset(const std::string& name, std::vector<unsigned char>& data);
+
+// Median compress and decompress seconds of a codec at a thread count on
+// a dataset and machine, as stored by the last benchmark or huffcode run.
+bool baseline_lookup(const std::string& file, const std::string& machine,
+                     uint64_t hash, const std::string& codec, int threads,
+                     double* compress_time, double* decompress_time);
+void baseline_store(const std::string& file, const std::string& machine,
+                    uint64_t hash, const std::string& codec, int threads,
+                    double compress_time, double decompress_time);
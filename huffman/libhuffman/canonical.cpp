@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include "canonical.h"
+#include "util.h"
+
+
+/*
+ * limit_code_lengths finds the optimal code lengths of at most max_bits
+ * bits for n leaves of ascending weight with package-merge. Each of the
+ * max_bits lists merges the leaves with the pairs of the list before it;
+ * the first 2n - 2 items of the last list are the code, and a leaf's code
+ * length is the number of lists whose used part includes it. The used
+ * part of a list is a prefix, and so are the leaves in it, so only the
+ * merge order of each list is kept.
+ */
+static void
+limit_code_lengths(const uint64_t* weight, unsigned int n,
+                   unsigned int max_bits, unsigned char* length) {
+  static const unsigned int MAX_LISTS = 16;
+  uint64_t list[2][2 * MAX_SYMBOLS];
+  unsigned char is_leaf[MAX_LISTS][2 * MAX_SYMBOLS];
+  unsigned int size[MAX_LISTS];
+  assert(max_bits <= MAX_LISTS && n <= (1u << max_bits));
+
+  for (unsigned int i = 0; i < n; ++i) {
+    list[0][i] = weight[i];
+    is_leaf[0][i] = 1;
+  }
+  size[0] = n;
+  for (unsigned int l = 1; l < max_bits; ++l) {
+    const uint64_t* prev = list[(l - 1) & 1];
+    uint64_t* cur = list[l & 1];
+    unsigned int packages = size[l - 1] / 2;
+    unsigned int leaf = 0, pkg = 0, k = 0;
+    // Ties take the leaf first, so equal weights give the same code.
+    while (leaf < n || pkg < packages) {
+      uint64_t pair = pkg < packages ? prev[2 * pkg] + prev[2 * pkg + 1] : 0;
+      if (leaf < n && (pkg >= packages || weight[leaf] <= pair)) {
+        cur[k] = weight[leaf++];
+        is_leaf[l][k++] = 1;
+      } else {
+        cur[k] = pair;
+        is_leaf[l][k++] = 0;
+        pkg++;
+      }
+    }
+    size[l] = k;
+  }
+
+  memset(length, 0, n);
+  unsigned int used = 2 * n - 2;
+  for (int l = max_bits - 1; l >= 0; --l) {
+    unsigned int leaves = 0;
+    for (unsigned int k = 0; k < used; ++k)
+      leaves += is_leaf[l][k];
+    for (unsigned int i = 0; i < leaves; ++i)
+      length[i]++;
+    used = 2 * (used - leaves);
+  }
+}
+
+/*
+ * build_code_lengths computes Huffman code lengths for the symbols with a
+ * non-zero frequency. The tree is built with the two queue method over the
+ * sorted leaves, which only needs O(n) work after sorting. If the longest
+ * code exceeds max_bits, the lengths are found again with package-merge,
+ * which lengthens as few of the frequent codes as the limit allows.
+ */
+void
+build_code_lengths(const uint64_t* freqs, unsigned char* numbits,
+                   unsigned int max_bits) {
+  unsigned int sym[MAX_SYMBOLS];
+  uint64_t weight[2 * MAX_SYMBOLS];
+  unsigned int parent[2 * MAX_SYMBOLS];
+  unsigned char depth[2 * MAX_SYMBOLS];
+  unsigned int n = 0;
+
+  memset(numbits, 0, MAX_SYMBOLS);
+  for (unsigned int i = 0; i < MAX_SYMBOLS; ++i)
+    if (freqs[i])
+      sym[n++] = i;
+
+  if (n == 0)
+    return;
+  if (n == 1) {
+    // A single symbol still needs one bit so the decoder can make progress.
+    numbits[sym[0]] = 1;
+    return;
+  }
+
+  // Sort leaves by ascending frequency, ties broken by symbol value so
+  // that the same histogram always gives the same table.
+  std::sort(sym, sym + n, [&](unsigned int a, unsigned int b) {
+    return freqs[a] != freqs[b] ? freqs[a] < freqs[b] : a < b;
+  });
+  for (unsigned int i = 0; i < n; ++i)
+    weight[i] = freqs[sym[i]];
+
+  // Leaves are [0, n), internal nodes are appended in increasing weight
+  // order so they form the second queue.
+  unsigned int leaf = 0, node = n;
+  for (unsigned int next = n; next < 2 * n - 1; ++next) {
+    unsigned int pick[2];
+    for (int k = 0; k < 2; ++k) {
+      if (leaf < n && (node >= next || weight[leaf] <= weight[node]))
+        pick[k] = leaf++;
+      else
+        pick[k] = node++;
+    }
+    weight[next] = weight[pick[0]] + weight[pick[1]];
+    parent[pick[0]] = parent[pick[1]] = next;
+  }
+
+  // Children always have a smaller index than their parent.
+  unsigned int max_depth = 0;
+  depth[2 * n - 2] = 0;
+  for (int i = 2 * n - 3; i >= 0; --i) {
+    depth[i] = depth[parent[i]] + 1;
+    max_depth = std::max(max_depth, (unsigned int)depth[i]);
+  }
+
+  if (max_depth > max_bits)
+    limit_code_lengths(weight, n, max_bits, depth);
+  for (unsigned int i = 0; i < n; ++i)
+    numbits[sym[i]] = depth[i];
+}
+
+/*
+ * assign_canonical_codes gives consecutive code values to symbols ordered
+ * by (code length, symbol), as in DEFLATE, then bit-reverses them so the
+ * first bit of a code is its least significant bit.
+ */
+void
+assign_canonical_codes(canonical_table* table) {
+  unsigned int bl_count[16] = {0};
+  unsigned int next_code[16];
+
+  for (int i = 0; i < MAX_SYMBOLS; ++i)
+    bl_count[table->numbits[i]]++;
+  bl_count[0] = 0;
+
+  unsigned int code = 0;
+  for (int bits = 1; bits <= MAX_CODE_BITS; ++bits) {
+    code = (code + bl_count[bits - 1]) << 1;
+    next_code[bits] = code;
+  }
+
+  for (int i = 0; i < MAX_SYMBOLS; ++i) {
+    unsigned int len = table->numbits[i];
+    table->code[i] = 0;
+    if (len == 0)
+      continue;
+    unsigned int c = next_code[len]++;
+    unsigned int reversed = 0;
+    for (unsigned int b = 0; b < len; ++b)
+      reversed |= ((c >> b) & 1) << (len - 1 - b);
+    table->code[i] = (uint16_t)reversed;
+  }
+}
+
+void
+build_canonical_table(const uint64_t* freqs, canonical_table* table) {
+  build_code_lengths(freqs, table->numbits, MAX_CODE_BITS);
+  assign_canonical_codes(table);
+}
+
+/*
+ * build_canonical_decoder replicates every code into all the table slots
+ * whose low bits match it.
+ */
+void
+build_canonical_decoder(const canonical_table* table, canonical_decoder* dec) {
+  memset(dec->entry, 0, sizeof(dec->entry));
+  for (int i = 0; i < MAX_SYMBOLS; ++i) {
+    unsigned int len = table->numbits[i];
+    if (len == 0)
+      continue;
+    uint16_t e = (uint16_t)((i << 4) | len);
+    for (unsigned int j = table->code[i]; j < DECODE_TABLE_SIZE; j += 1u << len)
+      dec->entry[j] = e;
+  }
+}
+
+// Return the number of bits needed to encode freqs with table, or
+// UINT64_MAX if a symbol that occurs has no code in the table.
+uint64_t
+canonical_cost_bits(const canonical_table* table, const uint64_t* freqs) {
+  uint64_t bits = 0;
+  for (int i = 0; i < MAX_SYMBOLS; ++i) {
+    if (!freqs[i])
+      continue;
+    if (!table->numbits[i])
+      return UINT64_MAX;
+    bits += freqs[i] * table->numbits[i];
+  }
+  return bits;
+}
+
+/*
+ * canonical_encode codes size symbols into out, which must hold at least
+ * UPDIV(size * MAX_CODE_BITS, 8) bytes. Return the first byte past the
+ * encoded data.
+ */
+unsigned char*
+canonical_encode(const canonical_table* table, const unsigned char* in,
+                 size_t size, unsigned char* out) {
+  bit_writer writer(out);
+  for (size_t i = 0; i < size; ++i) {
+    unsigned char uc = in[i];
+    writer.put(table->code[uc], table->numbits[uc]);
+  }
+  return writer.flush();
+}
+
+void
+canonical_decode(const canonical_decoder* dec, const unsigned char* in,
+                 size_t in_size, unsigned char* out, size_t size) {
+  bit_reader reader(in, in_size);
+  size_t i = 0;
+  // A refill guarantees 56 bits, enough for four codes.
+  for (; i + 4 <= size; i += 4) {
+    reader.refill();
+    out[i] = reader.decode(dec);
+    out[i + 1] = reader.decode(dec);
+    out[i + 2] = reader.decode(dec);
+    out[i + 3] = reader.decode(dec);
+  }
+  for (; i < size; ++i) {
+    reader.refill();
+    out[i] = reader.decode(dec);
+  }
+}
+
+/*
+ * A serialized table is a 256 bit presence bitmap followed by the code
+ * lengths of the present symbols packed two per byte.
+ */
+size_t
+canonical_table_size(const canonical_table* table) {
+  size_t n = 0;
+  for (int i = 0; i < MAX_SYMBOLS; ++i)
+    if (table->numbits[i])
+      n++;
+  return MAX_SYMBOLS / 8 + UPDIV(n, 2);
+}
+
+void
+write_canonical_table(data_buf& buf, const canonical_table* table) {
+  unsigned char bitmap[MAX_SYMBOLS / 8] = {0};
+  unsigned char packed[MAX_SYMBOLS / 2] = {0};
+  size_t n = 0;
+
+  for (int i = 0; i < MAX_SYMBOLS; ++i) {
+    if (!table->numbits[i])
+      continue;
+    bitmap[i / 8] |= 1 << (i % 8);
+    packed[n / 2] |= table->numbits[i] << (4 * (n % 2));
+    n++;
+  }
+
+  buf.write_data(bitmap, sizeof(bitmap));
+  buf.write_data(packed, UPDIV(n, 2));
+}
+
+/*
+ * read_canonical_table only accepts the lengths build_code_lengths can
+ * produce: every present symbol coded in 1 to MAX_CODE_BITS bits and the
+ * codes filling the whole code space, so every MAX_CODE_BITS bit pattern
+ * decodes to a symbol. A lone symbol has a one bit code and fills half.
+ */
+bool
+read_canonical_table(data_buf& buf, canonical_table* table) {
+  unsigned char bitmap[MAX_SYMBOLS / 8];
+  unsigned char packed[MAX_SYMBOLS / 2];
+  size_t n = 0;
+  unsigned int kraft = 0;
+
+  buf.read_data(bitmap, sizeof(bitmap));
+  for (int i = 0; i < MAX_SYMBOLS; ++i)
+    n += get_bit(bitmap, i);
+  buf.read_data(packed, UPDIV(n, 2));
+
+  n = 0;
+  for (int i = 0; i < MAX_SYMBOLS; ++i) {
+    table->numbits[i] = 0;
+    if (get_bit(bitmap, i)) {
+      unsigned int len = (packed[n / 2] >> (4 * (n % 2))) & 0xF;
+      if (len < 1 || len > MAX_CODE_BITS)
+        return false;
+      table->numbits[i] = len;
+      kraft += DECODE_TABLE_SIZE >> len;
+      n++;
+    }
+  }
+  if (n > 1 ? kraft != DECODE_TABLE_SIZE : kraft > DECODE_TABLE_SIZE / 2)
+    return false;
+  assign_canonical_codes(table);
+  return true;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "huffman.h"
+
+// Longest code a canonical table may hold. Bounding the code length lets the
+// decoder resolve a symbol with a single lookup of MAX_CODE_BITS bits.
+#define MAX_CODE_BITS 12
+#define DECODE_TABLE_SIZE (1 << MAX_CODE_BITS)
+
+/*
+ * A canonical Huffman table is fully described by the code length of each
+ * symbol, so only the lengths need to be stored in a compressed stream.
+ * The codes are kept bit-reversed so they can be appended LSB first, which
+ * is the same bit order the tree based encoder uses.
+ */
+typedef struct canonical_table_tag {
+  unsigned char numbits[MAX_SYMBOLS];
+  uint16_t code[MAX_SYMBOLS];
+} canonical_table;
+
+/*
+ * Lookup table indexed by the next MAX_CODE_BITS bits of the stream.
+ * Each entry holds (symbol << 4) | numbits of the code found there.
+ */
+typedef struct canonical_decoder_tag {
+  uint16_t entry[DECODE_TABLE_SIZE];
+} canonical_decoder;
+
+// Appends codes LSB first into a memory buffer through a 64-bit accumulator.
+// The caller must make sure the buffer is large enough for every code.
+struct bit_writer {
+  bit_writer(unsigned char* out) : out(out), acc(0), nbits(0) {}
+
+  inline void put(uint32_t code, unsigned int numbits) {
+    acc |= (uint64_t)code << nbits;
+    nbits += numbits;
+    if (nbits >= 32) {
+      uint32_t word = (uint32_t)acc;
+      memcpy(out, &word, sizeof(word));
+      out += sizeof(word);
+      acc >>= 32;
+      nbits -= 32;
+    }
+  }
+
+  // Write out the partial bytes left in the accumulator.
+  // Return the first byte past the encoded data.
+  inline unsigned char* flush() {
+    while (nbits > 0) {
+      *out++ = (unsigned char)acc;
+      acc >>= 8;
+      nbits = nbits > 8 ? nbits - 8 : 0;
+    }
+    return out;
+  }
+
+  unsigned char* out;
+  uint64_t acc;
+  unsigned int nbits;
+};
+
+// Reads a LSB first bit stream written by bit_writer. Bits past the end
+// of the buffer read as zero.
+struct bit_reader {
+  bit_reader(const unsigned char* in, size_t size) :
+    in(in), size(size), pos(0), acc(0), nbits(0) {}
+
+  // Make sure at least 56 bits are available in the accumulator.
+  inline void refill() {
+    if (pos + 8 <= size) {
+      uint64_t word;
+      memcpy(&word, in + pos, sizeof(word));
+      acc |= word << nbits;
+      pos += (63 - nbits) >> 3;
+      nbits |= 56;
+    } else {
+      while (nbits <= 56) {
+        uint64_t byte = pos < size ? in[pos] : 0;
+        acc |= byte << nbits;
+        pos++;
+        nbits += 8;
+      }
+    }
+  }
+
+  inline unsigned int peek(unsigned int n) const {
+    return (unsigned int)(acc & ((1ULL << n) - 1));
+  }
+
+  inline void consume(unsigned int n) {
+    acc >>= n;
+    nbits -= n;
+  }
+
+  // Decode one symbol. The accumulator must hold at least MAX_CODE_BITS bits.
+  inline unsigned char decode(const canonical_decoder* dec) {
+    uint16_t e = dec->entry[peek(MAX_CODE_BITS)];
+    consume(e & 0xF);
+    return (unsigned char)(e >> 4);
+  }
+
+  const unsigned char* in;
+  size_t size;
+  size_t pos;
+  uint64_t acc;
+  unsigned int nbits;
+};
+
+void
+build_code_lengths(const uint64_t* freqs, unsigned char* numbits,
+                   unsigned int max_bits);
+
+void
+assign_canonical_codes(canonical_table* table);
+
+void
+build_canonical_table(const uint64_t* freqs, canonical_table* table);
+
+void
+build_canonical_decoder(const canonical_table* table, canonical_decoder* dec);
+
+uint64_t
+canonical_cost_bits(const canonical_table* table, const uint64_t* freqs);
+
+size_t
+canonical_table_size(const canonical_table* table);
+
+unsigned char*
+canonical_encode(const canonical_table* table, const unsigned char* in,
+                 size_t size, unsigned char* out);
+
+void
+canonical_decode(const canonical_decoder* dec, const unsigned char* in,
+                 size_t in_size, unsigned char* out, size_t size);
+
+void
+write_canonical_table(data_buf& buf, const canonical_table* table);
+
+// Return false if the stored lengths don't form a complete prefix code.
+bool
+read_canonical_table(data_buf& buf, canonical_table* table);
@@ -17,6 +17,13 @@
 #include <omp.h>
 #include "huffman.h"
 #include "util.h"
+#include "huffman_static.h"
+#include "worker_pool.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "roofline.h"
+#include "bench.h"
+#include "synth.h"
 #include "test_ispc.h"
 
 
@@ -25,6 +32,7 @@ using std::string;
 using std::cout;
 using std::endl;
 using std::min;
+using std::max;
 using namespace ispc;
 
 #ifdef WIN32
@@ -36,8 +44,6 @@ extern char *optarg;
 #include <unistd.h>
 #endif
 
-int num_of_threads = 2;
-
 static void version(FILE *out) {
   fputs(
       "huffcode 0.3\n"
@@ -51,37 +57,112 @@ static void usage(FILE *out) {
   // Sample usage to run benchmarking. ./huffmancode -b -i input_file
   fputs(
       "Usage: huffcode -i <input file>\n"
-      "-i - input file. Will compress and decompress it\n"
+      "       huffcode -b -i <input file> [-i <input file>...] [-C codecs] [-t 1,2,4]\n"
+      "-i - input file. Will compress and decompress it. A generated dataset\n"
+      "     is named synth:<pattern>:<size>[:key=value,...], see synth.h\n"
       "-h - print usage information\n"
       "-t - specify number of threads to use. Default is 2\n"
       "-c - check correctness (will output file to disk)\n"
       "-p - PrintTable\n"
-      "-r - read seq_time cache\n",
+      "-B - block size in KB of the block adaptive coder. Default is 256\n"
+      "-k - print ratio and throughput of every block\n"
+      "-e - entropy in bits/byte above which a block is stored raw. Default is 7.9\n"
+      "-s - benchmark small records coded against a pretrained table\n"
+      "-x - train a static table from the input and write it to a file\n"
+      "-y - with -s, code records against the static table in a file written by -x\n"
+      "-S - inputs below this many KB are coded on one thread. Default is 128\n"
+      "-l - report latency percentiles for 1KB to 1MB inputs\n"
+      "-P - run block tasks on a persistent worker pool instead of OpenMP\n"
+      "-w - compare worker pool and OpenMP startup and per-call overhead\n"
+      "-R - measure the memory bandwidth roofline of every run and compare each phase to it\n"
+      "-H - count cycles, instructions and cache, branch and TLB misses per phase\n"
+      "-T - write a Chrome trace of every thread's phases to a file (needs TRACE=1 build)\n"
+      "-j - write the statistics of every run as JSON to a file, - for stdout\n"
+      "-r - reuse the stored sequential baseline of this input and machine\n"
+      "-b - benchmark the codecs given with -C on every input and thread count of -t\n"
+      "-C - comma separated codecs to benchmark: seq,naive,histogram,order1,tans,block,small,\n"
+      "     lzss, and lzss_brute, lzss_list, lzss_hash, lzss_kmp, lzss_tree, lzss_chain or\n"
+      "     lzss_suffix for one match finder, lzss_parallel for 1 MB LZSS blocks on every thread.\n"
+      "     Default is seq,naive,histogram,order1,tans,block,lzss_suffix. LZSS codecs take\n"
+      "     :L<level> and :w<offset bits>l<length bits> options, e.g. lzss_chain:L6:w16l8\n"
+      "-N - timed repetitions per benchmark. Default is 5\n"
+      "-W - warmup repetitions per benchmark. Default is 1\n"
+      "-o - write the benchmark results as CSV to a file, - for stdout\n"
+      "-G - write the input to a file and exit, to keep a generated dataset\n",
       out);
 }
 
+// Split a comma separated list
+static std::vector<string> parse_list(const char* arg) {
+  std::vector<string> items;
+  string s(arg);
+  size_t start = 0;
+  while (start <= s.size()) {
+    size_t end = s.find(',', start);
+    if (end == string::npos)
+      end = s.size();
+    if (end > start)
+      items.push_back(s.substr(start, end - start));
+    start = end + 1;
+  }
+  return items;
+}
+
+static std::vector<int> parse_int_list(const char* arg) {
+  std::vector<string> items = parse_list(arg);
+  std::vector<int> values;
+  for (size_t i = 0; i < items.size(); i++)
+    values.push_back(max(1, atoi(items[i].c_str())));
+  return values;
+}
+
 static void run_huffman(
+    huffman_context& hctx,
     string& infile_name,
     bool is_seq,
     bool check_correctness,
-    parallel_type type=OPENMP_NAIVE) {
-  // Allocate input buffer
-  struct stat sbuf;
-  stat(infile_name.c_str(), &sbuf);
-  size_t file_size = sbuf.st_size;
-  unsigned char* in_data = new unsigned char[file_size];
-  
-  // Read input file into buffer
-  #pragma omp parallel 
-  {
-    int tid = omp_get_thread_num();
-    FILE* in_file = fopen(infile_name.c_str(), "rb");
-    size_t chunk_size = UPDIV(file_size, num_of_threads);
-    size_t start_offset = tid * chunk_size;
-    size_t end_offset = min(start_offset + chunk_size, file_size);
-    fseek(in_file, start_offset, SEEK_SET);
-    fread(in_data + start_offset, 1,end_offset - start_offset, in_file);
-    fclose(in_file);
+    parallel_type type=OPENMP_NAIVE,
+    roofline* bound=NULL) {
+  size_t file_size;
+  unsigned char* in_data;
+  bool synthetic = is_synth_spec(infile_name);
+  if (synthetic) {
+    std::vector<unsigned char> generated;
+    synth_generate(infile_name, generated);
+    file_size = generated.size();
+    in_data = new unsigned char[file_size];
+    memcpy(in_data, generated.data(), file_size);
+  }
+  else {
+    // Allocate input buffer
+    struct stat sbuf;
+    stat(infile_name.c_str(), &sbuf);
+    file_size = sbuf.st_size;
+    in_data = new unsigned char[file_size];
+
+    // Read input file into buffer. Small inputs are read on this thread;
+    // starting a team would cost more than the read.
+    int read_threads = file_size < hctx.small_input_size ?
+        1 : hctx.threads_for(file_size);
+    #pragma omp parallel num_threads(read_threads) if (read_threads > 1)
+    {
+      int tid = omp_get_thread_num();
+      TRACE_SCOPE("read");
+      FILE* in_file = fopen(infile_name.c_str(), "rb");
+      size_t chunk_size = UPDIV(file_size, read_threads);
+      size_t start_offset = tid * chunk_size;
+      size_t end_offset = min(start_offset + chunk_size, file_size);
+      fseek(in_file, start_offset, SEEK_SET);
+      fread(in_data + start_offset, 1,end_offset - start_offset, in_file);
+      fclose(in_file);
+    }
+  }
+  // Bandwidth ceiling of this run, over the input and a buffer of its size
+  if (bound) {
+    unsigned char* scratch = new unsigned char[file_size];
+    *bound = measure_roofline(in_data, scratch, file_size,
+                              is_seq ? 1 : hctx.num_threads);
+    delete[] scratch;
   }
   // Buffer that stores input file bytes
   data_buf in_buf(in_data, file_size);
@@ -94,10 +175,19 @@ static void run_huffman(
   string tmpfile_name;
   if (is_seq) {
     tmpfile_name = "compressed_seq";
-    huffman_encode_seq(in_buf, tmp_buf);
+    huffman_encode_seq(hctx, in_buf, tmp_buf);
   } else {
     tmpfile_name = "compressed_parallel";
-    huffman_encode_parallel(in_buf, tmp_buf, type);
+    huffman_encode_parallel(hctx, in_buf, tmp_buf, type);
+  }
+
+  // A generated input is written out for the diff below
+  string input_name = infile_name;
+  if (check_correctness && synthetic) {
+    input_name = "synthetic_input";
+    FILE *in_file = fopen(input_name.c_str(), "wb");
+    fwrite(in_data, 1, file_size, in_file);
+    fclose(in_file);
   }
 
   if (check_correctness) {
@@ -117,10 +207,10 @@ static void run_huffman(
   string outfile_name;
   if (is_seq) {
     outfile_name = "decompressed_seq";
-    huffman_decode_seq(tmp_buf, out_buf);
+    huffman_decode_seq(hctx, tmp_buf, out_buf);
   } else {
     outfile_name = "decompressed_parallel";
-    huffman_decode_parallel(tmp_buf, out_buf, type);
+    huffman_decode_parallel(hctx, tmp_buf, out_buf, type);
   }
 
   cout << "Compression Ratio = " << tmp_buf.size * 1.0 / file_size << endl;
@@ -132,7 +222,7 @@ static void run_huffman(
     fclose(out_file);
 
     // Correctness Check.
-    int ret_code = system(("diff " + infile_name + " " + outfile_name).c_str());
+    int ret_code = system(("diff " + input_name + " " + outfile_name).c_str());
     if (ret_code == 0) {
       cout << "Compression result is correct!!" << endl;
     } else {
@@ -145,79 +235,428 @@ static void run_huffman(
   delete[] out_buf.data;
 }
 
-// Time statistics
-double c_time[5];
-double d_time[3];
+// Print throughput, balance and memory of one call
+static void print_call_stats(const codec_stats& stats) {
+  cout << "\tThroughput = " << stats.gb_per_sec() << " GB/s, "
+       << stats.bytes_in << " -> " << stats.bytes_out << " bytes" << endl;
+  cout << "\tLoad imbalance = " << stats.imbalance()
+       << ", peak allocated = " << stats.peak_alloc_bytes << " bytes" << endl;
+}
 
-// Given compress times and decompress times, print statistics
-static void print_stats(double c_time[5], double d_time[3], bool table) {
+// Given compress and decompress statistics, print them
+static void print_stats(const codec_stats& c, const codec_stats& d, bool table) {
+  const double* c_time = c.phase_time;
+  const double* d_time = d.phase_time;
   // Print Compression Stats
   if (!table) {
-    auto total_time = c_time[4] - c_time[0];
+    auto total_time = c.total_time;
     cout << "Compression Statistics:" << endl;
-    cout << "\tTime to generate Histogram = " << c_time[1] - c_time[0] << "s, "
-         << get_percentage(total_time, c_time[1] - c_time[0]) << "%" << endl;
-    cout << "\tTime to generate Huffman Tree = " << c_time[2] - c_time[1] << "s, "
-         << get_percentage(total_time, c_time[2] - c_time[1]) << "%" << endl;
-    cout << "\tTime to write symbol list = " << c_time[3] - c_time[2] << "s, "
-         << get_percentage(total_time, c_time[3] - c_time[2]) << "%" << endl;
-    cout << "\tTime to compress file = " << c_time[4] - c_time[3] << "s, "
-         << get_percentage(total_time, c_time[4] - c_time[3]) << "%" << endl;
-    cout << "\tCompression Elapse time = " << total_time << "s" << endl << endl;
+    cout << "\tTime to generate Histogram = " << c_time[PHASE_HISTOGRAM] << "s, "
+         << get_percentage(total_time, c_time[PHASE_HISTOGRAM]) << "%" << endl;
+    cout << "\tTime to generate Huffman Tree = " << c_time[PHASE_TABLE] << "s, "
+         << get_percentage(total_time, c_time[PHASE_TABLE]) << "%" << endl;
+    cout << "\tTime to write symbol list = " << c_time[PHASE_HEADER] << "s, "
+         << get_percentage(total_time, c_time[PHASE_HEADER]) << "%" << endl;
+    cout << "\tTime to compress file = " << c_time[PHASE_CODE] << "s, "
+         << get_percentage(total_time, c_time[PHASE_CODE]) << "%" << endl;
+    cout << "\tCompression Elapse time = " << total_time << "s" << endl;
+    print_call_stats(c);
+    cout << endl;
 
     // Print Decompression Stats
-    total_time = d_time[2] - d_time[0];
+    total_time = d.total_time;
     cout << "Decompression Statistics:" << endl;
-    cout << "\tTime to generate Huffman Tree = " << d_time[1] - d_time[0] << "s, "
-         << get_percentage(total_time, d_time[1] - d_time[0]) << "%" << endl;
-    cout << "\tTime to decompress file = " << d_time[2] - d_time[1] << "s, "
-         << get_percentage(total_time, d_time[2] - d_time[1]) << "%" << endl;
-    cout << "\tDecompression Elapse time = " << total_time << "s" << endl << endl;
+    cout << "\tTime to generate Huffman Tree = " << d_time[PHASE_TABLE] << "s, "
+         << get_percentage(total_time, d_time[PHASE_TABLE]) << "%" << endl;
+    cout << "\tTime to decompress file = " << d_time[PHASE_CODE] << "s, "
+         << get_percentage(total_time, d_time[PHASE_CODE]) << "%" << endl;
+    cout << "\tDecompression Elapse time = " << total_time << "s" << endl;
+    print_call_stats(d);
+    cout << endl;
   }
   else {
-    auto total_time = c_time[4] - c_time[0];
     cout << "Histogram,Tree,WriteSymbol,CompressFile,CompressTotal,ReadSymbol,DecompressFile,DecompressTotal" << endl;
 
-    for (int i=0;i<4;i++) {
-      cout << c_time[i+1] - c_time[i] << ",";
-    }
-    cout << total_time << ",";
-    for (int i=0;i<2;i++) {
-      cout << d_time[i+1] - d_time[i] << ",";
+    for (int i=0;i<NUM_PHASES;i++) {
+      cout << c_time[i] << ",";
     }
-    cout << d_time[2] - d_time[0] << endl;
+    cout << c.total_time << ",";
+    cout << d_time[PHASE_TABLE] << "," << d_time[PHASE_CODE] << ",";
+    cout << d.total_time << endl;
+  }
+}
+
+// Effective bandwidth of a phase that moved bytes in seconds, against the
+// ceiling gbps.
+static void print_bandwidth(const char* phase, double bytes, double seconds,
+                            double gbps) {
+  double achieved = seconds > 0 ? bytes / seconds / 1e9 : 0;
+  cout << "\t" << phase << " = " << achieved << " GB/s, "
+       << (gbps > 0 ? 100 * achieved / gbps : 0) << "% of roofline" << endl;
+}
+
+/*
+ * Print how close the histogram and code phases came to the memory
+ * bandwidth measured for the run. Histogramming only reads the input;
+ * coding reads the input and writes the output.
+ */
+static void print_roofline(const codec_stats& c, const codec_stats& d,
+                           const roofline& bound) {
+  if (bound.num_threads == 0)
+    return;
+  cout << "Roofline (" << bound.num_threads << " threads): read = "
+       << bound.read_gbps << " GB/s, read+write = " << bound.copy_gbps
+       << " GB/s" << endl;
+  print_bandwidth("Histogram", c.bytes_in, c.phase_time[PHASE_HISTOGRAM],
+                  bound.read_gbps);
+  print_bandwidth("Compress", (double)c.bytes_in + c.bytes_out,
+                  c.phase_time[PHASE_CODE], bound.copy_gbps);
+  print_bandwidth("Decompress", (double)d.bytes_in + d.bytes_out,
+                  d.phase_time[PHASE_CODE], bound.copy_gbps);
+  cout << endl;
+}
+
+/*
+ * Append the statistics of the last run to the JSON array in out. The
+ * caller opens the array and closes it after the last run.
+ */
+static void write_run_json(FILE* out, const char* variant,
+                           const huffman_context& hctx, const roofline& bound,
+                           bool& first) {
+  if (!out)
+    return;
+  fprintf(out, "%s\n  {\"variant\": \"%s\", \"threads\": %d, \"compress\": ",
+          first ? "" : ",", variant, hctx.num_threads);
+  write_stats_json(out, hctx.compress_stats);
+  fprintf(out, ", \"decompress\": ");
+  write_stats_json(out, hctx.decompress_stats);
+  if (bound.num_threads)
+    fprintf(out, ", \"roofline\": {\"threads\": %d, \"read_gbps\": %.6f, "
+            "\"copy_gbps\": %.6f}", bound.num_threads, bound.read_gbps,
+            bound.copy_gbps);
+  fprintf(out, "}");
+  first = false;
+}
+
+static const char* block_table_name[] = {"global", "previous", "own", "stored"};
+
+// Print ratio and throughput of every block of the last block adaptive run
+static void print_block_report(const huffman_context& hctx) {
+  const std::vector<block_stats>& block_report = hctx.block_report;
+  cout << "Block,InBytes,OutBytes,Table,Ratio,CompressMB/s,DecompressMB/s" << endl;
+  for (size_t i = 0; i < block_report.size(); i++) {
+    const block_stats& b = block_report[i];
+    double mb = b.in_bytes / 1e6;
+    cout << i << "," << b.in_bytes << "," << b.out_bytes << ","
+         << block_table_name[b.table_mode] << ","
+         << b.out_bytes * 1.0 / b.in_bytes << ","
+         << mb / b.encode_time << "," << mb / b.decode_time << endl;
   }
+  cout << endl;
 }
 
-static void print_summary(double c_time[5], double d_time[3], double pre_c_time[5], double pre_d_time[3]) {
+static void print_summary(const huffman_context& hctx, const codec_stats& pre_c,
+                          const codec_stats& pre_d) {
   // Print environment setup and speedup
   cout << "************************* Summary *************************" << endl;
-  cout << "Number of threads: " << num_of_threads << endl;
-  double total_c_time = c_time[4] - c_time[0];
-  double pre_total_c_time = pre_c_time[4] - pre_c_time[0];
+  cout << "Number of threads: " << hctx.num_threads << endl;
+  double total_c_time = hctx.compress_stats.total_time;
+  double pre_total_c_time = pre_c.total_time;
   cout << "Compression speedup: " << pre_total_c_time / total_c_time << endl;
-  double total_d_time = d_time[2] - d_time[0];
-  double pre_total_d_time = pre_d_time[2] - pre_d_time[0];
+  double total_d_time = hctx.decompress_stats.total_time;
+  double pre_total_d_time = pre_d.total_time;
   cout << "Decompression speedup: " << pre_total_d_time / total_d_time << endl;
   cout << "Total speedup: " << (pre_total_c_time + pre_total_d_time) /
       (total_c_time + total_d_time) << endl;
   cout << endl;
 }
 
+/*
+ * Cut the input into records of a few sizes and code every record against
+ * a static table. Without a table file the table is trained from one
+ * record in 16 and records are decoded through a copy of it serialized and
+ * read back, as a reader of stored records would. Reports records per
+ * second for encoding and decoding, all threads sharing the one table.
+ */
+static bool run_static_benchmark(int num_threads, string& infile_name,
+                                 const char* table_file) {
+  std::vector<unsigned char> dataset;
+  load_dataset(infile_name, dataset);
+  size_t file_size = dataset.size();
+  unsigned char* in_data = dataset.data();
+
+  huffman_static_table* loaded = NULL;
+  if (table_file) {
+    loaded = new huffman_static_table;
+    if (!huffman_static_load(table_file, loaded)) {
+      fprintf(stderr, "Can't read a static table from %s\n", table_file);
+      delete loaded;
+      return false;
+    }
+  }
+
+  const size_t record_sizes[] = {64, 128, 256, 512, 1024, 4096};
+  cout << "RecordSize,Records,Ratio,EncodeRecords/s,DecodeRecords/s,Correct" << endl;
+  for (size_t record_size : record_sizes) {
+    size_t num_records = file_size / record_size;
+    if (num_records == 0)
+      continue;
+
+    huffman_static_table* st = loaded;
+    huffman_static_table* read_back = loaded;
+    if (!loaded) {
+      std::vector<data_buf> samples;
+      for (size_t i = 0; i < num_records; i += 16)
+        samples.push_back(data_buf(in_data + i * record_size, record_size));
+      st = new huffman_static_table;
+      huffman_static_train(samples.data(), samples.size(), st);
+
+      unsigned char bytes[HUFFMAN_STATIC_TABLE_BOUND];
+      size_t table_size = sizeof(bytes);
+      data_buf table_buf(bytes, table_size);
+      huffman_static_write(table_buf, st);
+      table_buf.size = table_buf.curr_offset;
+      table_buf.rewind();
+      read_back = new huffman_static_table;
+      if (!huffman_static_read(table_buf, read_back)) {
+        fprintf(stderr, "Can't read back the static table\n");
+        delete st;
+        delete read_back;
+        return false;
+      }
+    }
+
+    size_t bound = HUFFMAN_STATIC_BOUND(record_size);
+    unsigned char* comp = new unsigned char[num_records * bound];
+    size_t* comp_size = new size_t[num_records];
+    unsigned char* out_data = new unsigned char[num_records * record_size];
+
+    double t0 = CycleTimer::currentSeconds();
+    #pragma omp parallel for schedule(static) num_threads(num_threads)
+    for (long i = 0; i < (long)num_records; i++)
+      comp_size[i] = huffman_static_encode(st, in_data + i * record_size,
+                                           record_size, comp + i * bound);
+    double t1 = CycleTimer::currentSeconds();
+    #pragma omp parallel for schedule(static) num_threads(num_threads)
+    for (long i = 0; i < (long)num_records; i++)
+      huffman_static_decode(read_back, comp + i * bound, comp_size[i],
+                            out_data + i * record_size, record_size);
+    double t2 = CycleTimer::currentSeconds();
+
+    size_t total = 0;
+    for (size_t i = 0; i < num_records; i++)
+      total += comp_size[i];
+    bool correct = memcmp(in_data, out_data, num_records * record_size) == 0;
+    cout << record_size << "," << num_records << ","
+         << total * 1.0 / (num_records * record_size) << ","
+         << num_records / (t1 - t0) << "," << num_records / (t2 - t1) << ","
+         << (correct ? "yes" : "no") << endl;
+
+    delete[] out_data;
+    delete[] comp_size;
+    delete[] comp;
+    if (!loaded) {
+      delete read_back;
+      delete st;
+    }
+  }
+  delete loaded;
+  return true;
+}
+
+/*
+ * Train a static table from the whole input and write it to a file, for
+ * later runs of -s -y to code against.
+ */
+static bool save_static_table(string& infile_name, const char* table_file) {
+  std::vector<unsigned char> dataset;
+  if (!load_dataset(infile_name, dataset)) {
+    fprintf(stderr, "Can't read %s\n", infile_name.c_str());
+    return false;
+  }
+  size_t size = dataset.size();
+  data_buf sample(dataset.data(), size);
+  huffman_static_table* st = new huffman_static_table;
+  huffman_static_train(&sample, 1, st);
+  bool ok = huffman_static_save(table_file, st);
+  if (!ok)
+    fprintf(stderr, "Can't write %s\n", table_file);
+  delete st;
+  return ok;
+}
+
+// Return the p-th percentile of the sorted samples, in microseconds
+static double percentile_us(const std::vector<double>& sorted, double p) {
+  size_t i = (size_t)(p * (sorted.size() - 1));
+  return sorted[i] * 1e6;
+}
+
+/*
+ * Code inputs of 1KB to 1MB taken from the start of the input file, many
+ * times each, and report latency percentiles of the default path (small
+ * inputs on one thread) against always starting every thread.
+ */
+static void run_latency_benchmark(huffman_context& hctx, string& infile_name) {
+  std::vector<unsigned char> dataset;
+  load_dataset(infile_name, dataset);
+  size_t file_size = dataset.size();
+  if (file_size == 0)
+    return;
+  const size_t max_size = 1024 * 1024;
+  unsigned char* in_data = new unsigned char[max_size];
+  size_t n = min(file_size, max_size);
+  memcpy(in_data, dataset.data(), n);
+  // Repeat short files to fill the largest input
+  for (size_t i = n; i < max_size; i++)
+    in_data[i] = in_data[i % n];
+
+  huffman_context forced = hctx;
+  forced.small_input_size = 0;
+  forced.min_bytes_per_thread = 1;
+  huffman_context* paths[] = {&hctx, &forced};
+  const char* path_names[] = {"default", "all_threads"};
+
+  cout << "Size,Path,EncodeP50us,EncodeP90us,EncodeP99us,"
+          "DecodeP50us,DecodeP90us,DecodeP99us" << endl;
+  for (size_t size = 1024; size <= max_size; size *= 4) {
+    int reps = (int)min((size_t)2000, max((size_t)50, (64 * max_size) / size));
+    for (int p = 0; p < 2; p++) {
+      std::vector<double> enc, dec;
+      for (int r = 0; r < reps; r++) {
+        data_buf in_buf(in_data, size);
+        data_buf tmp_buf, out_buf;
+        double t0 = CycleTimer::currentSeconds();
+        huffman_encode_parallel(*paths[p], in_buf, tmp_buf, OPENMP_ParallelHistogram);
+        double t1 = CycleTimer::currentSeconds();
+        tmp_buf.rewind();
+        huffman_decode_parallel(*paths[p], tmp_buf, out_buf, OPENMP_ParallelHistogram);
+        double t2 = CycleTimer::currentSeconds();
+        enc.push_back(t1 - t0);
+        dec.push_back(t2 - t1);
+        delete[] tmp_buf.data;
+        delete[] out_buf.data;
+      }
+      std::sort(enc.begin(), enc.end());
+      std::sort(dec.begin(), dec.end());
+      cout << size << "," << path_names[p] << ","
+           << percentile_us(enc, 0.5) << "," << percentile_us(enc, 0.9) << ","
+           << percentile_us(enc, 0.99) << "," << percentile_us(dec, 0.5) << ","
+           << percentile_us(dec, 0.9) << "," << percentile_us(dec, 0.99) << endl;
+    }
+  }
+  delete[] in_data;
+}
+
+/*
+ * Measure what it costs to start the worker pool and to run one empty job
+ * on it, against an empty OpenMP parallel loop of the same size, and how
+ * many jobs per second concurrent callers get through one shared pool.
+ */
+static void run_pool_benchmark(int num_threads) {
+  const int calls = 10000;
+
+  double t0 = CycleTimer::currentSeconds();
+  worker_pool* pool = new worker_pool(num_threads - 1);
+  double t1 = CycleTimer::currentSeconds();
+  cout << "Pool startup = " << (t1 - t0) * 1e6 << "us" << endl;
+
+  // Include the first job, which waits for the workers to start.
+  std::atomic<int> sum(0);
+  t0 = CycleTimer::currentSeconds();
+  pool->run(num_threads, [&](int task, int) { sum += task; });
+  t1 = CycleTimer::currentSeconds();
+  cout << "Pool first call = " << (t1 - t0) * 1e6 << "us" << endl;
+
+  t0 = CycleTimer::currentSeconds();
+  for (int c = 0; c < calls; c++)
+    pool->run(num_threads, [&](int task, int) { sum += task; });
+  t1 = CycleTimer::currentSeconds();
+  cout << "Pool per call = " << (t1 - t0) * 1e6 / calls << "us" << endl;
+
+  t0 = CycleTimer::currentSeconds();
+  #pragma omp parallel num_threads(num_threads)
+  sum += omp_get_thread_num();
+  t1 = CycleTimer::currentSeconds();
+  cout << "OpenMP first region = " << (t1 - t0) * 1e6 << "us" << endl;
+
+  t0 = CycleTimer::currentSeconds();
+  for (int c = 0; c < calls; c++) {
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for (int task = 0; task < num_threads; task++)
+      sum += task;
+  }
+  t1 = CycleTimer::currentSeconds();
+  cout << "OpenMP per call = " << (t1 - t0) * 1e6 / calls << "us" << endl;
+
+  // Several callers submitting jobs to the same pool at once
+  const int callers = 4;
+  std::vector<std::thread> threads;
+  t0 = CycleTimer::currentSeconds();
+  for (int k = 0; k < callers; k++)
+    threads.push_back(std::thread([&] {
+      for (int c = 0; c < calls / callers; c++)
+        pool->run(num_threads, [&](int task, int) { sum += task; });
+    }));
+  for (size_t k = 0; k < threads.size(); k++)
+    threads[k].join();
+  t1 = CycleTimer::currentSeconds();
+  cout << "Pool jobs/s with " << callers << " callers = "
+       << calls / (t1 - t0) << endl;
+
+  delete pool;
+}
+
 int main(int argc, char **argv) {
   /* Get the command line arguments. */
   int opt;
   string infile_name;
+  huffman_context hctx;
   bool check_correctness = false;
   bool read_cache = false;
   bool table = false;
-  while ((opt = getopt(argc, argv, "i:t:bhvmncrp")) != -1) {
+  bool block_stats = false;
+  bool static_records = false;
+  const char* static_table_out = NULL;
+  const char* static_table_in = NULL;
+  bool latency = false;
+  bool use_pool = false;
+  bool pool_overhead = false;
+  FILE* json = NULL;
+  const char* json_file = NULL;
+  const char* save_file = NULL;
+  bool json_first = true;
+  bool benchmark = false;
+  bench_config bench;
+  const char* trace_file = NULL;
+  bool counters = false;
+  bool measure_bound = false;
+  while ((opt = getopt(argc, argv, "i:t:B:e:S:j:T:C:N:W:o:G:x:y:bhvcrpkslPwHR")) != -1) {
     switch (opt) {
       case 'i':
         infile_name = string(optarg);
+        bench.datasets.push_back(infile_name);
         break;
       case 't':
-        num_of_threads = atoi(optarg);
+        hctx.num_threads = atoi(optarg);
+        bench.threads = parse_int_list(optarg);
+        break;
+      case 'b':
+        benchmark = true;
+        break;
+      case 'C':
+        bench.codecs = parse_list(optarg);
+        break;
+      case 'N':
+        bench.reps = max(1, atoi(optarg));
+        break;
+      case 'W':
+        bench.warmup = max(0, atoi(optarg));
+        break;
+      case 'o':
+        bench.csv_file = optarg;
+        break;
+      case 'G':
+        save_file = optarg;
         break;
       case 'h':
         usage(stdout);
@@ -234,64 +673,222 @@ int main(int argc, char **argv) {
       case 'p':
         table = true;
         break;
+      case 'B':
+        hctx.block_size = (size_t)atol(optarg) * 1024;
+        break;
+      case 'k':
+        block_stats = true;
+        break;
+      case 'e':
+        hctx.stored_entropy = atof(optarg);
+        break;
+      case 's':
+        static_records = true;
+        break;
+      case 'x':
+        static_table_out = optarg;
+        break;
+      case 'y':
+        static_table_in = optarg;
+        break;
+      case 'S':
+        hctx.small_input_size = (size_t)atol(optarg) * 1024;
+        break;
+      case 'l':
+        latency = true;
+        break;
+      case 'P':
+        use_pool = true;
+        break;
+      case 'w':
+        pool_overhead = true;
+        break;
+      case 'R':
+        measure_bound = true;
+        break;
+      case 'H':
+        counters = true;
+        break;
+      case 'T':
+        trace_file = optarg;
+        break;
+      case 'j':
+        json_file = optarg;
+        bench.json_file = optarg;
+        break;
       default:
         usage(stderr);
         return 1;
     }
   }
 
-  omp_set_num_threads(num_of_threads);
+  if (pool_overhead) {
+    run_pool_benchmark(hctx.num_threads);
+    return 0;
+  }
 
   // Input file name cannot be empty
-  if (infile_name.empty()) {
+  if (infile_name.empty() || hctx.block_size == 0) {
     usage(stderr);
     return 1;
   }
 
+  if (save_file) {
+    std::vector<unsigned char> dataset;
+    if (!load_dataset(infile_name, dataset))
+      return 1;
+    FILE* out = fopen(save_file, "wb");
+    if (!out || fwrite(dataset.data(), 1, dataset.size(), out) != dataset.size()) {
+      fprintf(stderr, "Can't write %s\n", save_file);
+      return 1;
+    }
+    fclose(out);
+    return 0;
+  }
+
+  if (benchmark) {
+    bench.settings = hctx;
+    return run_benchmarks(bench);
+  }
+
+  if (static_table_out)
+    return save_static_table(infile_name, static_table_out) ? 0 : 1;
+
+  if (static_records) {
+    return run_static_benchmark(hctx.num_threads, infile_name,
+                                static_table_in) ? 0 : 1;
+  }
+  if (use_pool)
+    hctx.pool = new worker_pool(hctx.num_threads - 1);
+  if (latency) {
+    run_latency_benchmark(hctx, infile_name);
+    delete hctx.pool;
+    return 0;
+  }
 
-  double seq_c_time[5] = {0, 74.9316,74.9316+29.4099, 74.9316+29.4099+0.00001653, 74.9316+29.4099+0.00001653+365.257};
-  double seq_d_time[3] = {0, 0.00016702, 0.00016702+263.202};
+  if (json_file) {
+    json = strcmp(json_file, "-") ? fopen(json_file, "w") : stdout;
+    if (!json) {
+      fprintf(stderr, "Can't open %s\n", json_file);
+      return 1;
+    }
+    fprintf(json, "[");
+  }
+
+  // The sequential baseline is kept per dataset content and machine
+  std::vector<unsigned char> dataset;
+  if (!load_dataset(infile_name, dataset)) {
+    fprintf(stderr, "Can't read %s\n", infile_name.c_str());
+    return 1;
+  }
+  uint64_t hash = dataset_hash(dataset.data(), dataset.size());
+  std::vector<unsigned char>().swap(dataset);
+  string machine = machine_id();
+
+  codec_stats seq_c, seq_d;
+  // Left empty when not measured or the sequential run is cached
+  roofline bound;
+  bound.num_threads = 0;
+  roofline* bound_arg = measure_bound ? &bound : NULL;
   
   /************ Start Benchmarking **************/
+  if (trace_file)
+    trace_start();
+  if (counters && !perf_start())
+    fprintf(stderr, "Hardware counters are not available on this machine\n");
   // Run Sequential Version
   cout << "******************** Sequential Version *******************" << endl;
-  FILE* f_ptr;
-  string cache_file_name = "cache_seq_time";
-  if (access( cache_file_name.c_str(), F_OK ) == -1 || !read_cache) {
-    run_huffman(infile_name, true, check_correctness);
-    cout << "Write Cache" << endl;
-    f_ptr = fopen(cache_file_name.c_str(), "wb");
-    fwrite(c_time, sizeof(double), 5, f_ptr);
-    fwrite(d_time, sizeof(double), 3, f_ptr);
+  if (read_cache &&
+      baseline_lookup(bench.baseline_file, machine, hash, "seq", 1,
+                      &seq_c.total_time, &seq_d.total_time)) {
+    cout << "Stored baseline: compress " << seq_c.total_time
+         << "s, decompress " << seq_d.total_time << "s" << endl << endl;
   }
   else {
-    cout << "Result Cache" << endl;
-    f_ptr = fopen(cache_file_name.c_str(), "rb");
-    fread(c_time, sizeof(double), 5, f_ptr);
-    fread(d_time, sizeof(double), 3, f_ptr);
-  }
-  fclose(f_ptr);
-
+    run_huffman(hctx, infile_name, true, check_correctness, OPENMP_NAIVE,
+                bound_arg);
+    seq_c = hctx.compress_stats;
+    seq_d = hctx.decompress_stats;
+    baseline_store(bench.baseline_file, machine, hash, "seq", 1,
+                   seq_c.total_time, seq_d.total_time);
 
-  memcpy(seq_c_time, c_time, sizeof(double)*5);
-  memcpy(seq_d_time, d_time, sizeof(double)*3);
-
-  print_stats(seq_c_time, seq_d_time, table);
+    print_stats(seq_c, seq_d, table);
+    print_roofline(seq_c, seq_d, bound);
+    if (counters)
+      perf_report(stdout);
+    write_run_json(json, "seq", hctx, bound, json_first);
+  }
 
   // Run Parallel Version Next
   cout << "******************** Parallel Version (OPENMP_NAIVE)*********************" << endl;
-  run_huffman(infile_name, false, check_correctness, OPENMP_NAIVE);
-  print_stats(c_time, d_time, table);
+  run_huffman(hctx, infile_name, false, check_correctness, OPENMP_NAIVE,
+              bound_arg);
+  print_stats(hctx.compress_stats, hctx.decompress_stats, table);
+  print_roofline(hctx.compress_stats, hctx.decompress_stats, bound);
+  if (counters)
+    perf_report(stdout);
+  write_run_json(json, "OPENMP_NAIVE", hctx, bound, json_first);
 
-  print_summary(c_time, d_time, seq_c_time, seq_d_time);
+  print_summary(hctx, seq_c, seq_d);
 
   // Run Parallel Version Next
   cout << "******************** Parallel Version (OPENMP_ParallelHistogram)*********************" << endl;
-  run_huffman(infile_name, false, check_correctness, OPENMP_ParallelHistogram);
-  print_stats(c_time, d_time, table);
+  run_huffman(hctx, infile_name, false, check_correctness, OPENMP_ParallelHistogram,
+              bound_arg);
+  print_stats(hctx.compress_stats, hctx.decompress_stats, table);
+  print_roofline(hctx.compress_stats, hctx.decompress_stats, bound);
+  if (counters)
+    perf_report(stdout);
+  write_run_json(json, "OPENMP_ParallelHistogram", hctx, bound, json_first);
 
-  print_summary(c_time, d_time, seq_c_time, seq_d_time);
+  print_summary(hctx, seq_c, seq_d);
 
+  // Run Order-1 Context Modelled Version
+  cout << "******************** Parallel Version (OPENMP_Order1)*********************" << endl;
+  run_huffman(hctx, infile_name, false, check_correctness, OPENMP_Order1,
+              bound_arg);
+  print_stats(hctx.compress_stats, hctx.decompress_stats, table);
+  print_roofline(hctx.compress_stats, hctx.decompress_stats, bound);
+  if (counters)
+    perf_report(stdout);
+  write_run_json(json, "OPENMP_Order1", hctx, bound, json_first);
+
+  print_summary(hctx, seq_c, seq_d);
+
+  // Run tANS Version on the same input to compare against Huffman
+  cout << "******************** Parallel Version (OPENMP_TANS)*********************" << endl;
+  run_huffman(hctx, infile_name, false, check_correctness, OPENMP_TANS,
+              bound_arg);
+  print_stats(hctx.compress_stats, hctx.decompress_stats, table);
+  print_roofline(hctx.compress_stats, hctx.decompress_stats, bound);
+  if (counters)
+    perf_report(stdout);
+  write_run_json(json, "OPENMP_TANS", hctx, bound, json_first);
+
+  print_summary(hctx, seq_c, seq_d);
+
+  // Run Block Adaptive Version, one table decision per block
+  cout << "******************** Parallel Version (OPENMP_BlockAdaptive)*********************" << endl;
+  run_huffman(hctx, infile_name, false, check_correctness, OPENMP_BlockAdaptive,
+              bound_arg);
+  print_stats(hctx.compress_stats, hctx.decompress_stats, table);
+  print_roofline(hctx.compress_stats, hctx.decompress_stats, bound);
+  if (counters)
+    perf_report(stdout);
+  write_run_json(json, "OPENMP_BlockAdaptive", hctx, bound, json_first);
+  if (block_stats)
+    print_block_report(hctx);
+
+  print_summary(hctx, seq_c, seq_d);
+
+  if (trace_file && !trace_dump(trace_file))
+    fprintf(stderr, "No trace written to %s (tracing needs a TRACE=1 build)\n", trace_file);
+  if (json) {
+    fprintf(json, "\n]\n");
+    if (json != stdout)
+      fclose(json);
+  }
+  delete hctx.pool;
   return 0;
 }
 
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <vector>
 #include "CycleTimer.h"
 
 
@@ -68,23 +69,266 @@ struct data_buf {
 enum parallel_type {
   OPENMP_NAIVE = 0,
   OPENMP_ParallelHistogram = 1,
+  OPENMP_Order1 = 2,
+  OPENMP_TANS = 3,
+  OPENMP_BlockAdaptive = 4,
+};
+
+// Identifies the coder of a compressed stream. The parallel encoders write
+// it as the first byte of the stream so the decoder can pick the coder.
+enum codec_id {
+  CODEC_HUFFMAN = 0,
+  CODEC_HUFFMAN_ORDER1 = 1,
+  CODEC_TANS = 2,
+  CODEC_HUFFMAN_BLOCK = 3,
+  CODEC_HUFFMAN_SMALL = 4,
+};
+
+// Table used by a block of the block adaptive coder.
+enum block_table_mode {
+  BLOCK_TABLE_GLOBAL = 0,    // table built from the whole input
+  BLOCK_TABLE_PREVIOUS = 1,  // table of the last block that sent one
+  BLOCK_TABLE_OWN = 2,       // table built from the block, stored with it
+  BLOCK_STORED = 3,          // raw bytes, no coding
+};
+
+// Per block statistics of the last block adaptive run.
+struct block_stats {
+  size_t in_bytes;
+  size_t out_bytes;  // including the mode byte and any table sent
+  unsigned char table_mode;
+  double encode_time;
+  double decode_time;
 };
 
 #define MAX_SYMBOLS 256
 typedef huffman_node *SymbolFrequencies[MAX_SYMBOLS];
 typedef huffman_code *SymbolEncoder[MAX_SYMBOLS];
 
+// A tree over MAX_SYMBOLS leaves is at most MAX_SYMBOLS - 1 deep.
+#define MAX_CODE_BYTES (MAX_SYMBOLS / 8)
+
+/*
+ * Bump allocator for one Huffman tree and its codes. A tree over n symbols
+ * has at most 2n - 1 nodes, so fixed arrays hold any tree; nodes are handed
+ * out in order, which keeps the nodes of a tree walk close together.
+ * reset() releases everything at once.
+ */
+struct huffman_arena {
+  huffman_arena() : num_nodes(0), num_codes(0) {}
+
+  void reset() {
+    num_nodes = 0;
+    num_codes = 0;
+  }
+
+  huffman_node nodes[2 * MAX_SYMBOLS];
+  huffman_code codes[MAX_SYMBOLS];
+  unsigned char code_bits[MAX_SYMBOLS][MAX_CODE_BYTES];
+  SymbolEncoder encoder;
+  size_t num_nodes;
+  size_t num_codes;
+};
+
+class worker_pool;
+
+// Phases of a compression or decompression call. Decompression only has
+// the table and code phases.
+enum codec_phase {
+  PHASE_HISTOGRAM = 0,  // count symbols
+  PHASE_TABLE,          // build or read the code tables
+  PHASE_HEADER,         // size and write the stream header
+  PHASE_CODE,           // encode or decode the data
+  NUM_PHASES,
+};
+
+/*
+ * Statistics of one compression or decompression call. Phase times are
+ * wall clock; busy times are the time each thread spent in parallel work,
+ * indexed by OpenMP thread number or worker pool slot.
+ */
+struct codec_stats {
+  codec_stats() : decompress(false), start_time(0), last_time(0),
+    total_time(0), bytes_in(0), bytes_out(0), peak_alloc_bytes(0) {
+    for (int i = 0; i < NUM_PHASES; i++)
+      phase_time[i] = 0;
+  }
+
+  // Close the running phase and add its time to phase p
+  void end_phase(codec_phase p) {
+    double now = CycleTimer::currentSeconds();
+    phase_time[p] += now - last_time;
+    last_time = now;
+  }
+
+  size_t uncompressed_bytes() const {
+    return decompress ? bytes_out : bytes_in;
+  }
+
+  double gb_per_sec() const {
+    return total_time > 0 ? uncompressed_bytes() / total_time / 1e9 : 0;
+  }
+
+  // Busiest thread over the average of the threads that did any work;
+  // 1 means perfectly balanced.
+  double imbalance() const {
+    double max_busy = 0, sum = 0;
+    int n = 0;
+    for (size_t i = 0; i < thread_busy.size(); i++) {
+      if (thread_busy[i] <= 0)
+        continue;
+      max_busy = thread_busy[i] > max_busy ? thread_busy[i] : max_busy;
+      sum += thread_busy[i];
+      n++;
+    }
+    return n ? max_busy / (sum / n) : 0;
+  }
+
+  bool decompress;
+  double start_time;
+  double last_time;
+  double total_time;
+  double phase_time[NUM_PHASES];
+  std::vector<double> thread_busy;
+  size_t bytes_in;
+  size_t bytes_out;
+  // Most memory the call had in use at once: the largest request made of
+  // each scratch slot and the output. The tree arena is part of the
+  // context and is not counted.
+  size_t peak_alloc_bytes;
+};
+
+// Scratch buffers of a context. Each coder uses a slot for the length of
+// one call; the memory is kept and reused by the next call.
+enum scratch_slot {
+  SCRATCH_HISTO = 0,
+  SCRATCH_TABLES,
+  SCRATCH_DECODERS,
+  SCRATCH_OFFSETS,
+  SCRATCH_CODED,
+  SCRATCH_INDEX,
+  SCRATCH_MODES,
+  NUM_SCRATCH_SLOTS,
+};
+
+/*
+ * A codec context holds everything one compression or decompression call
+ * needs besides its input and output: settings, scratch memory and the
+ * statistics of the last call. Calls on different contexts share no state
+ * besides an optional worker pool, so they can run concurrently. A context
+ * serves one call at a time.
+ */
+struct huffman_context {
+  huffman_context(int num_threads = 2) :
+    num_threads(num_threads), block_size(256 * 1024), stored_entropy(7.9),
+    small_input_size(128 * 1024), min_bytes_per_thread(64 * 1024),
+    pool(NULL), active_stats(NULL) {
+    for (int i = 0; i < NUM_SCRATCH_SLOTS; i++)
+      scratch_used[i] = 0;
+  }
+
+  // Number of threads worth starting for an input of size bytes.
+  int threads_for(size_t size) const {
+    size_t useful = size / min_bytes_per_thread;
+    if (useful < 1)
+      useful = 1;
+    return useful < (size_t)num_threads ? (int)useful : num_threads;
+  }
+
+  // Reset the statistics of a call on size input bytes and start timing.
+  codec_stats& begin_compress(size_t size);
+  codec_stats& begin_decompress(size_t size);
+  // Stop timing and record the output size and peak memory.
+  void end_stats(codec_stats& stats, size_t out_size);
+
+  // Return a buffer of count elements of T in the given slot. It stays
+  // valid until the slot is requested again.
+  template <typename T>
+  T* scratch(scratch_slot slot, size_t count) {
+    std::vector<unsigned char>& buf = scratch_bufs[slot];
+    if (buf.size() < count * sizeof(T))
+      buf.resize(count * sizeof(T));
+    if (scratch_used[slot] < count * sizeof(T))
+      scratch_used[slot] = count * sizeof(T);
+    return (T*)buf.data();
+  }
+
+  // Number of threads used by each call
+  int num_threads;
+  // Bytes per block of the block adaptive coder
+  size_t block_size;
+  // Blocks with an entropy of at least this many bits per byte are stored raw
+  double stored_entropy;
+  // Huffman inputs smaller than this are coded on the calling thread
+  size_t small_input_size;
+  // Least input per thread; smaller inputs use fewer threads
+  size_t min_bytes_per_thread;
+  // Persistent workers that run block tasks instead of OpenMP, if set.
+  // The pool is not owned and may be shared by many contexts.
+  worker_pool* pool;
+
+  // Statistics of the last compression and decompression
+  codec_stats compress_stats;
+  codec_stats decompress_stats;
+  // Statistics of the call in progress, for the helpers it runs
+  codec_stats* active_stats;
+  // Per block statistics of the last block adaptive call
+  std::vector<block_stats> block_report;
+
+  // Tree and codes of the tree based coders
+  huffman_arena arena;
+
+  std::vector<unsigned char> scratch_bufs[NUM_SCRATCH_SLOTS];
+  // Largest request made of each slot since the call in progress began
+  size_t scratch_used[NUM_SCRATCH_SLOTS];
+};
+
+/*
+ * busy_timer adds the time between its construction and destruction to the
+ * busy time of one thread in the statistics of the call in progress.
+ */
+struct busy_timer {
+  busy_timer(huffman_context& hctx, int slot) : busy(NULL), t0(0) {
+    codec_stats* stats = hctx.active_stats;
+    if (stats && slot < (int)stats->thread_busy.size()) {
+      busy = &stats->thread_busy[slot];
+      t0 = CycleTimer::currentSeconds();
+    }
+  }
+  ~busy_timer() {
+    if (busy)
+      *busy += CycleTimer::currentSeconds() - t0;
+  }
+
+  double* busy;
+  double t0;
+};
+
+// Print stats as one JSON object
+void write_stats_json(FILE* out, const codec_stats& stats);
+
 // Sequential Version
-int huffman_encode_seq(data_buf& in_buf, data_buf& out_buf);
-int huffman_decode_seq(data_buf& in_buf, data_buf& out_buf);
+int huffman_encode_seq(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
+int huffman_decode_seq(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
 
 // Parallel Version
-int huffman_encode_parallel(data_buf& in_buf, data_buf& out_buf, parallel_type type);
-int huffman_decode_parallel(data_buf& in_buf, data_buf& out_buf, parallel_type type);
+int huffman_encode_parallel(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf, parallel_type type);
+int huffman_decode_parallel(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf, parallel_type type);
+
+// The canonical coders below return 1 if a stream's code table is invalid.
+
+// Order-1 Context Modelled Version
+int huffman_encode_order1(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
+int huffman_decode_order1(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
 
-// Time statistics
-extern double c_time[5];
-extern double d_time[3];
+// Table Based ANS Version
+int tans_encode_parallel(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
+int tans_decode_parallel(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
 
-extern int num_of_threads;
+// Small Input Version
+int huffman_encode_small(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
+int huffman_decode_small(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
 
+// Block Adaptive Version
+int huffman_encode_block(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
+int huffman_decode_block(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf);
@@ -0,0 +1,292 @@
+/*
+ *  huffman - Encode/Decode files using per block adaptive Huffman tables.
+ *
+ *  The input is cut into fixed size blocks. Each block is coded with the
+ *  global table, the table of the last block that sent one, or a table
+ *  built from its own histogram, whichever gives the smallest output once
+ *  the size of a new table is accounted for. Blocks that would not shrink
+ *  are stored raw.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+#include <vector>
+#include "util.h"
+#include "huffman.h"
+#include "canonical.h"
+#include "worker_pool.h"
+#include "perf_counters.h"
+#include <iostream>
+
+using std::min;
+using std::vector;
+
+/*
+ * Compressed layout:
+ *   uint8_t              codec id (CODEC_HUFFMAN_BLOCK)
+ *   uint64_t             number of bytes in the input
+ *   uint64_t             block size
+ *   uint32_t             number of blocks
+ *   table                global table
+ *   per block:
+ *     uint8_t            table mode (block_table_mode)
+ *     table              only for BLOCK_TABLE_OWN
+ *   uint64_t * blocks    start offset of each block in the data area
+ *   data
+ */
+
+int huffman_encode_block(huffman_context& hctx, data_buf& in_data_buf,
+                         data_buf& out_data_buf) {
+  vector<block_stats>& block_report = hctx.block_report;
+  codec_stats& stats = hctx.begin_compress(in_data_buf.size);
+
+  uint64_t symbol_count = in_data_buf.size;
+  uint64_t block = hctx.block_size;
+  uint32_t num_blocks = UPDIV(symbol_count, block);
+  int num_threads = hctx.threads_for(symbol_count);
+
+  // One histogram per block, built in parallel.
+  uint64_t* histo =
+      hctx.scratch<uint64_t>(SCRATCH_HISTO, (size_t)num_blocks * MAX_SYMBOLS);
+  parallel_for(hctx, num_threads, num_blocks, [&](int b, int) {
+    PERF_SCOPE("histogram");
+    uint64_t* h = histo + (size_t)b * MAX_SYMBOLS;
+    memset(h, 0, MAX_SYMBOLS * sizeof(uint64_t));
+    size_t start = b * block;
+    size_t end = min(start + block, in_data_buf.size);
+    for (size_t i = start; i < end; i++)
+      h[in_data_buf.data[i]]++;
+  });
+
+  uint64_t global_histo[MAX_SYMBOLS] = {0};
+  for (uint32_t b = 0; b < num_blocks; b++)
+    for (int i = 0; i < MAX_SYMBOLS; i++)
+      global_histo[i] += histo[(size_t)b * MAX_SYMBOLS + i];
+
+  stats.end_phase(PHASE_HISTOGRAM);
+
+  canonical_table global;
+  build_canonical_table(global_histo, &global);
+
+  // Candidate tables from every block histogram. Blocks that look
+  // incompressible are stored without building a table.
+  canonical_table* own =
+      hctx.scratch<canonical_table>(SCRATCH_TABLES, num_blocks);
+  unsigned char* mode = hctx.scratch<unsigned char>(SCRATCH_MODES, num_blocks);
+  parallel_for(hctx, num_threads, num_blocks, [&](int b, int) {
+    const uint64_t* h = histo + (size_t)b * MAX_SYMBOLS;
+    if (histogram_entropy(h) >= hctx.stored_entropy) {
+      mode[b] = BLOCK_STORED;
+      return;
+    }
+    mode[b] = BLOCK_TABLE_GLOBAL;
+    build_canonical_table(h, &own[b]);
+  });
+
+  // Choose a table for every block. This pass only looks at histograms,
+  // and a block can only reuse the table most recently sent.
+  const canonical_table** block_table =
+      hctx.scratch<const canonical_table*>(SCRATCH_INDEX, num_blocks);
+  uint64_t* block_offset =
+      hctx.scratch<uint64_t>(SCRATCH_OFFSETS, num_blocks + 1);
+  size_t header_size = 1 + sizeof(symbol_count) + sizeof(block) +
+                       sizeof(num_blocks) + canonical_table_size(&global) +
+                       num_blocks * (1 + sizeof(uint64_t));
+  const canonical_table* previous = &global;
+  block_offset[0] = 0;
+  for (uint32_t b = 0; b < num_blocks; b++) {
+    uint64_t raw_bytes = min(block, symbol_count - b * block);
+    if (mode[b] == BLOCK_STORED) {
+      block_table[b] = NULL;
+      block_offset[b + 1] = block_offset[b] + raw_bytes;
+      continue;
+    }
+
+    const uint64_t* h = histo + (size_t)b * MAX_SYMBOLS;
+    uint64_t global_cost = canonical_cost_bits(&global, h);
+    uint64_t previous_cost = canonical_cost_bits(previous, h);
+    uint64_t own_table_bits = 8 * canonical_table_size(&own[b]);
+    uint64_t own_cost = canonical_cost_bits(&own[b], h) + own_table_bits;
+
+    uint64_t bits;
+    if (min(min(global_cost, previous_cost), own_cost) >= 8 * raw_bytes) {
+      // Coding would not save anything.
+      mode[b] = BLOCK_STORED;
+      block_table[b] = NULL;
+      bits = 8 * raw_bytes;
+    } else if (own_cost < global_cost && own_cost < previous_cost) {
+      mode[b] = BLOCK_TABLE_OWN;
+      block_table[b] = previous = &own[b];
+      bits = own_cost - own_table_bits;
+      header_size += own_table_bits / 8;
+    } else if (previous != &global && previous_cost < global_cost) {
+      mode[b] = BLOCK_TABLE_PREVIOUS;
+      block_table[b] = previous;
+      bits = previous_cost;
+    } else {
+      mode[b] = BLOCK_TABLE_GLOBAL;
+      block_table[b] = &global;
+      bits = global_cost;
+    }
+    block_offset[b + 1] = block_offset[b] + UPDIV(bits, 8);
+  }
+
+  // A global table no block codes with is sent empty, so an input that is
+  // stored raw costs little more than its size.
+  bool global_used = false;
+  for (uint32_t b = 0; b < num_blocks; b++)
+    global_used |= block_table[b] == &global;
+  if (!global_used) {
+    header_size -= canonical_table_size(&global);
+    memset(global.numbits, 0, sizeof(global.numbits));
+    header_size += canonical_table_size(&global);
+  }
+
+  size_t out_size = header_size + block_offset[num_blocks];
+  out_data_buf.data = new unsigned char[out_size];
+  out_data_buf.size = out_size;
+  out_data_buf.curr_offset = 0;
+
+  stats.end_phase(PHASE_TABLE);
+
+  unsigned char codec = CODEC_HUFFMAN_BLOCK;
+  out_data_buf.write_data(&codec, sizeof(codec));
+  out_data_buf.write_data(&symbol_count, sizeof(symbol_count));
+  out_data_buf.write_data(&block, sizeof(block));
+  out_data_buf.write_data(&num_blocks, sizeof(num_blocks));
+  write_canonical_table(out_data_buf, &global);
+  for (uint32_t b = 0; b < num_blocks; b++) {
+    out_data_buf.write_data(&mode[b], sizeof(mode[b]));
+    if (mode[b] == BLOCK_TABLE_OWN)
+      write_canonical_table(out_data_buf, &own[b]);
+  }
+  out_data_buf.write_data(block_offset, num_blocks * sizeof(uint64_t));
+
+  stats.end_phase(PHASE_HEADER);
+
+  block_report.resize(num_blocks);
+  unsigned char* data = out_data_buf.data + out_data_buf.curr_offset;
+  parallel_for(hctx, num_threads, num_blocks, [&](int b, int) {
+    PERF_SCOPE("encode");
+    double t0 = CycleTimer::currentSeconds();
+    size_t start = b * block;
+    size_t end = min(start + block, in_data_buf.size);
+    if (mode[b] == BLOCK_STORED)
+      memcpy(data + block_offset[b], in_data_buf.data + start, end - start);
+    else
+      canonical_encode(block_table[b], in_data_buf.data + start, end - start,
+                       data + block_offset[b]);
+
+    block_stats& stats = block_report[b];
+    stats.in_bytes = end - start;
+    stats.out_bytes = block_offset[b + 1] - block_offset[b] + 1;
+    if (mode[b] == BLOCK_TABLE_OWN)
+      stats.out_bytes += canonical_table_size(&own[b]);
+    stats.table_mode = mode[b];
+    stats.encode_time = CycleTimer::currentSeconds() - t0;
+  });
+
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
+
+  return 0;
+}
+
+
+int huffman_decode_block(huffman_context& hctx, data_buf& in_data_buf,
+                         data_buf& out_data_buf) {
+  vector<block_stats>& block_report = hctx.block_report;
+  codec_stats& stats = hctx.begin_decompress(in_data_buf.size);
+
+  unsigned char codec;
+  in_data_buf.read_data(&codec, sizeof(codec));
+  assert(codec == CODEC_HUFFMAN_BLOCK);
+
+  uint64_t data_count, block;
+  uint32_t num_blocks;
+  in_data_buf.read_data(&data_count, sizeof(data_count));
+  in_data_buf.read_data(&block, sizeof(block));
+  in_data_buf.read_data(&num_blocks, sizeof(num_blocks));
+
+  canonical_table global;
+  if (!read_canonical_table(in_data_buf, &global))
+    return 1;
+
+  // Resolve the table of every block. Tables are only stored for blocks
+  // that sent one; later blocks may refer back to it. -1 is the global
+  // table and -2 a stored block.
+  canonical_table* own =
+      hctx.scratch<canonical_table>(SCRATCH_TABLES, num_blocks);
+  int* block_table = hctx.scratch<int>(SCRATCH_INDEX, num_blocks);
+  int num_tables = 0;
+  int previous = -1;
+  for (uint32_t b = 0; b < num_blocks; b++) {
+    unsigned char mode;
+    in_data_buf.read_data(&mode, sizeof(mode));
+    if (mode == BLOCK_TABLE_OWN) {
+      if (!read_canonical_table(in_data_buf, &own[num_tables]))
+        return 1;
+      previous = num_tables++;
+      block_table[b] = previous;
+    } else if (mode == BLOCK_TABLE_PREVIOUS) {
+      block_table[b] = previous;
+    } else if (mode == BLOCK_STORED) {
+      block_table[b] = -2;
+    } else {
+      block_table[b] = -1;
+    }
+  }
+
+  uint64_t* block_offset =
+      hctx.scratch<uint64_t>(SCRATCH_OFFSETS, num_blocks + 1);
+  in_data_buf.read_data(block_offset, num_blocks * sizeof(uint64_t));
+  block_offset[num_blocks] = in_data_buf.size - in_data_buf.curr_offset;
+  const unsigned char* data = in_data_buf.data + in_data_buf.curr_offset;
+
+  // The global decoder is followed by one decoder per thread.
+  int num_threads = hctx.threads_for(data_count);
+  canonical_decoder* decoders = hctx.scratch<canonical_decoder>(
+      SCRATCH_DECODERS, parallel_slots(hctx, num_threads) + 1);
+  const canonical_decoder* global_dec = decoders;
+  build_canonical_decoder(&global, decoders);
+
+  stats.end_phase(PHASE_TABLE);
+
+  out_data_buf.data = new unsigned char[data_count];
+  out_data_buf.size = data_count;
+  out_data_buf.curr_offset = 0;
+
+  block_report.resize(num_blocks);
+  parallel_for(hctx, num_threads, num_blocks, [&](int b, int slot) {
+    PERF_SCOPE("decode");
+    double t0 = CycleTimer::currentSeconds();
+    size_t start = b * block;
+    size_t end = min(start + block, (size_t)data_count);
+    if (block_table[b] == -2) {
+      memcpy(out_data_buf.data + start, data + block_offset[b], end - start);
+      block_report[b].decode_time = CycleTimer::currentSeconds() - t0;
+      return;
+    }
+
+    // Decoders for block tables are built on the fly; rebuilding one costs
+    // far less than decoding the block it serves.
+    const canonical_decoder* dec = global_dec;
+    if (block_table[b] >= 0) {
+      canonical_decoder* local_dec = decoders + 1 + slot;
+      build_canonical_decoder(&own[block_table[b]], local_dec);
+      dec = local_dec;
+    }
+    canonical_decode(dec, data + block_offset[b],
+                     block_offset[b + 1] - block_offset[b],
+                     out_data_buf.data + start, end - start);
+    block_report[b].decode_time = CycleTimer::currentSeconds() - t0;
+  });
+
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
+
+  return 0;
+}
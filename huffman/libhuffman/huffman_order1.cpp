@@ -0,0 +1,308 @@
+/*
+ *  huffman - Encode/Decode files using order-1 context modelled Huffman codes.
+ *
+ *  Every symbol is coded with a table selected by the byte before it.
+ *  Contexts whose own table does not pay for its header are merged into
+ *  one shared table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+#include "util.h"
+#include "huffman.h"
+#include "worker_pool.h"
+#include "perf_counters.h"
+#include "canonical.h"
+#include <iostream>
+
+using std::min;
+
+#define NUM_CONTEXTS MAX_SYMBOLS
+#define CONTEXT_HISTO_SIZE (NUM_CONTEXTS * MAX_SYMBOLS)
+
+/*
+ * Compressed layout:
+ *   uint8_t              codec id (CODEC_HUFFMAN_ORDER1)
+ *   uint64_t             number of bytes in the input
+ *   32 bytes             bitmap of the contexts that own a table
+ *   table                shared table used by every other context
+ *   table * n            one table per owning context, in context order
+ *   uint32_t             number of chunks
+ *   uint64_t * chunks    start offset of each chunk in the data area
+ *   data
+ * Each chunk restarts from context 0 so chunks decode independently.
+ */
+
+/*
+ * Build the per-context histograms. Each task counts its chunk into a
+ * private 256x256 histogram, then a second pass merges a slice of the
+ * contexts into histo per task. The private histograms are kept because they give
+ * the exact compressed size of each chunk once the tables are known.
+ */
+static void
+get_context_frequencies_parallel(huffman_context& hctx, data_buf& buf,
+                                 uint64_t* histo_per_thread,
+                                 uint64_t* histo, int num_chunks) {
+  size_t buf_chunk_size = UPDIV(buf.size, num_chunks);
+  int ctx_chunk_size = UPDIV(NUM_CONTEXTS, num_chunks);
+
+  parallel_for(hctx, num_chunks, num_chunks, [&](int tid, int) {
+    uint64_t* local = histo_per_thread + (size_t)tid * CONTEXT_HISTO_SIZE;
+    memset(local, 0, CONTEXT_HISTO_SIZE * sizeof(uint64_t));
+
+    size_t start_offset = min(buf_chunk_size * tid, buf.size);
+    size_t end_offset = min(start_offset + buf_chunk_size, buf.size);
+
+    PERF_SCOPE("histogram");
+    unsigned int ctx = 0;
+    for (size_t i = start_offset; i < end_offset; i++) {
+      unsigned char uc = buf.data[i];
+      local[ctx * MAX_SYMBOLS + uc]++;
+      ctx = uc;
+    }
+  });
+
+  parallel_for(hctx, num_chunks, num_chunks, [&](int tid, int) {
+    // Which contexts of the global histogram to update
+    int ctx_start = min(ctx_chunk_size * tid, NUM_CONTEXTS);
+    int ctx_end = min(ctx_start + ctx_chunk_size, NUM_CONTEXTS);
+
+    for (size_t i = (size_t)ctx_start * MAX_SYMBOLS;
+         i < (size_t)ctx_end * MAX_SYMBOLS; i++) {
+      uint64_t freq = 0;
+      for (int j = 0; j < num_chunks; j++)
+        freq += histo_per_thread[(size_t)j * CONTEXT_HISTO_SIZE + i];
+      histo[i] = freq;
+    }
+  });
+}
+
+/*
+ * Pick a table for every context. A context keeps its own table only if the
+ * bits it saves over the order-0 table exceed the size of its header. The
+ * remaining contexts are merged into a single shared table built from their
+ * combined histogram. tables[0] is the shared table and tables[ctx + 1] the
+ * table owned by ctx.
+ */
+static void
+choose_context_tables(huffman_context& hctx, const uint64_t* histo,
+                      canonical_table* tables, bool* owns_table) {
+  uint64_t order0[MAX_SYMBOLS] = {0};
+  for (int ctx = 0; ctx < NUM_CONTEXTS; ctx++)
+    for (int i = 0; i < MAX_SYMBOLS; i++)
+      order0[i] += histo[ctx * MAX_SYMBOLS + i];
+
+  canonical_table global;
+  build_canonical_table(order0, &global);
+
+  parallel_for(hctx, hctx.num_threads, NUM_CONTEXTS, [&](int ctx, int) {
+    const uint64_t* row = histo + ctx * MAX_SYMBOLS;
+    canonical_table* own = &tables[ctx + 1];
+    build_canonical_table(row, own);
+
+    uint64_t own_cost = canonical_cost_bits(own, row) +
+                        8 * canonical_table_size(own);
+    uint64_t shared_cost = canonical_cost_bits(&global, row);
+    owns_table[ctx] = own_cost < shared_cost;
+  });
+
+  uint64_t shared[MAX_SYMBOLS] = {0};
+  for (int ctx = 0; ctx < NUM_CONTEXTS; ctx++) {
+    if (owns_table[ctx])
+      continue;
+    for (int i = 0; i < MAX_SYMBOLS; i++)
+      shared[i] += histo[ctx * MAX_SYMBOLS + i];
+  }
+  build_canonical_table(shared, &tables[0]);
+}
+
+int huffman_encode_order1(huffman_context& hctx, data_buf& in_data_buf,
+                          data_buf& out_data_buf) {
+  int num_chunks = hctx.threads_for(in_data_buf.size);
+  codec_stats& stats = hctx.begin_compress(in_data_buf.size);
+
+  // Get the frequency of each symbol under each context.
+  uint64_t symbol_count = in_data_buf.size;
+  // The merged histogram follows the private ones in the same buffer.
+  uint64_t* histo_per_thread = hctx.scratch<uint64_t>(
+      SCRATCH_HISTO, (size_t)(num_chunks + 1) * CONTEXT_HISTO_SIZE);
+  uint64_t* histo = histo_per_thread + (size_t)num_chunks * CONTEXT_HISTO_SIZE;
+  get_context_frequencies_parallel(hctx, in_data_buf, histo_per_thread, histo,
+                                   num_chunks);
+
+  stats.end_phase(PHASE_HISTOGRAM);
+
+  canonical_table* tables =
+      hctx.scratch<canonical_table>(SCRATCH_TABLES, NUM_CONTEXTS + 1);
+  bool owns_table[NUM_CONTEXTS];
+  choose_context_tables(hctx, histo, tables, owns_table);
+
+  // Flatten the code of every (context, symbol) pair into one lookup
+  // as code | numbits << 16.
+  uint32_t* enc = hctx.scratch<uint32_t>(SCRATCH_INDEX, CONTEXT_HISTO_SIZE);
+  parallel_for(hctx, hctx.num_threads, NUM_CONTEXTS, [&](int ctx, int) {
+    const canonical_table* t = &tables[owns_table[ctx] ? ctx + 1 : 0];
+    for (int i = 0; i < MAX_SYMBOLS; i++)
+      enc[ctx * MAX_SYMBOLS + i] = t->code[i] | (uint32_t)t->numbits[i] << 16;
+  });
+
+  // The private histograms give the exact size of every chunk.
+  uint64_t* chunk_offset = hctx.scratch<uint64_t>(SCRATCH_OFFSETS, num_chunks);
+  parallel_for(hctx, num_chunks, num_chunks, [&](int tid, int) {
+    const uint64_t* local = histo_per_thread + (size_t)tid * CONTEXT_HISTO_SIZE;
+    uint64_t bits = 0;
+    for (size_t i = 0; i < CONTEXT_HISTO_SIZE; i++)
+      bits += local[i] * (enc[i] >> 16);
+    chunk_offset[tid] = UPDIV(bits, 8);
+  });
+
+  uint64_t data_size = 0;
+  for (int i = 0; i < num_chunks; i++) {
+    uint64_t chunk_bytes = chunk_offset[i];
+    chunk_offset[i] = data_size;
+    data_size += chunk_bytes;
+  }
+
+  size_t out_size = 1 + sizeof(symbol_count) + NUM_CONTEXTS / 8 +
+                    canonical_table_size(&tables[0]) +
+                    sizeof(uint32_t) + num_chunks * sizeof(uint64_t) +
+                    data_size;
+  for (int ctx = 0; ctx < NUM_CONTEXTS; ctx++)
+    if (owns_table[ctx])
+      out_size += canonical_table_size(&tables[ctx + 1]);
+
+  out_data_buf.data = new unsigned char[out_size];
+  out_data_buf.size = out_size;
+  out_data_buf.curr_offset = 0;
+
+  stats.end_phase(PHASE_TABLE);
+
+  unsigned char codec = CODEC_HUFFMAN_ORDER1;
+  out_data_buf.write_data(&codec, sizeof(codec));
+  out_data_buf.write_data(&symbol_count, sizeof(symbol_count));
+  unsigned char bitmap[NUM_CONTEXTS / 8] = {0};
+  for (int ctx = 0; ctx < NUM_CONTEXTS; ctx++)
+    if (owns_table[ctx])
+      bitmap[ctx / 8] |= 1 << (ctx % 8);
+  out_data_buf.write_data(bitmap, sizeof(bitmap));
+  write_canonical_table(out_data_buf, &tables[0]);
+  for (int ctx = 0; ctx < NUM_CONTEXTS; ctx++)
+    if (owns_table[ctx])
+      write_canonical_table(out_data_buf, &tables[ctx + 1]);
+
+  uint32_t chunks = num_chunks;
+  out_data_buf.write_data(&chunks, sizeof(chunks));
+  out_data_buf.write_data(chunk_offset, num_chunks * sizeof(uint64_t));
+
+  stats.end_phase(PHASE_HEADER);
+
+  unsigned char* data = out_data_buf.data + out_data_buf.curr_offset;
+  size_t in_chunk_size = UPDIV(in_data_buf.size, num_chunks);
+  parallel_for(hctx, num_chunks, num_chunks, [&](int tid, int) {
+    PERF_SCOPE("encode");
+    bit_writer writer(data + chunk_offset[tid]);
+
+    size_t i_offset = min(in_chunk_size * tid, in_data_buf.size);
+    size_t e_offset = min(i_offset + in_chunk_size, in_data_buf.size);
+
+    unsigned int ctx = 0;
+    for (; i_offset < e_offset; i_offset++) {
+      unsigned char uc = in_data_buf.data[i_offset];
+      uint32_t e = enc[ctx * MAX_SYMBOLS + uc];
+      writer.put(e & 0xFFFF, e >> 16);
+      ctx = uc;
+    }
+    writer.flush();
+  });
+
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
+
+  return 0;
+}
+
+
+int huffman_decode_order1(huffman_context& hctx, data_buf& in_data_buf,
+                          data_buf& out_data_buf) {
+  codec_stats& stats = hctx.begin_decompress(in_data_buf.size);
+
+  unsigned char codec;
+  in_data_buf.read_data(&codec, sizeof(codec));
+  assert(codec == CODEC_HUFFMAN_ORDER1);
+
+  uint64_t data_count;
+  in_data_buf.read_data(&data_count, sizeof(data_count));
+
+  unsigned char bitmap[NUM_CONTEXTS / 8];
+  in_data_buf.read_data(bitmap, sizeof(bitmap));
+
+  // decoders[0] is the shared table, the owning contexts follow in order.
+  canonical_decoder* decoders =
+      hctx.scratch<canonical_decoder>(SCRATCH_DECODERS, NUM_CONTEXTS + 1);
+  const canonical_decoder* ctx_decoder[NUM_CONTEXTS];
+  canonical_table table;
+  if (!read_canonical_table(in_data_buf, &table))
+    return 1;
+  build_canonical_decoder(&table, &decoders[0]);
+
+  int num_tables = 1;
+  for (int ctx = 0; ctx < NUM_CONTEXTS; ctx++) {
+    if (get_bit(bitmap, ctx)) {
+      if (!read_canonical_table(in_data_buf, &table))
+        return 1;
+      build_canonical_decoder(&table, &decoders[num_tables]);
+      ctx_decoder[ctx] = &decoders[num_tables++];
+    } else {
+      ctx_decoder[ctx] = &decoders[0];
+    }
+  }
+
+  uint32_t num_chunks;
+  in_data_buf.read_data(&num_chunks, sizeof(num_chunks));
+  uint64_t* chunk_offset =
+      hctx.scratch<uint64_t>(SCRATCH_OFFSETS, num_chunks + 1);
+  in_data_buf.read_data(chunk_offset, num_chunks * sizeof(uint64_t));
+  chunk_offset[num_chunks] = in_data_buf.size - in_data_buf.curr_offset;
+  const unsigned char* data = in_data_buf.data + in_data_buf.curr_offset;
+
+  stats.end_phase(PHASE_TABLE);
+
+  out_data_buf.data = new unsigned char[data_count];
+  out_data_buf.size = data_count;
+  out_data_buf.curr_offset = 0;
+
+  size_t o_chunk_size = UPDIV(data_count, num_chunks);
+  parallel_for(hctx, hctx.threads_for(data_count), num_chunks, [&](int chunk, int) {
+    PERF_SCOPE("decode");
+    bit_reader reader(data + chunk_offset[chunk],
+                      chunk_offset[chunk + 1] - chunk_offset[chunk]);
+    unsigned char* out = out_data_buf.data;
+    size_t o_offset = min(o_chunk_size * chunk, (size_t)data_count);
+    size_t o_end_offset = min(o_offset + o_chunk_size, (size_t)data_count);
+
+    // A refill guarantees 56 bits, enough for four codes.
+    unsigned int ctx = 0;
+    while (o_offset + 4 <= o_end_offset) {
+      reader.refill();
+      for (int k = 0; k < 4; k++) {
+        unsigned char uc = reader.decode(ctx_decoder[ctx]);
+        out[o_offset++] = uc;
+        ctx = uc;
+      }
+    }
+    while (o_offset < o_end_offset) {
+      reader.refill();
+      unsigned char uc = reader.decode(ctx_decoder[ctx]);
+      out[o_offset++] = uc;
+      ctx = uc;
+    }
+  });
+
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
+
+  return 0;
+}
@@ -11,6 +11,9 @@
 #include <omp.h>
 #include "util.h"
 #include "huffman.h"
+#include "worker_pool.h"
+#include "trace.h"
+#include "perf_counters.h"
 #include <iostream>
 
 #ifdef WIN32
@@ -35,67 +38,76 @@ using std::min;
 #define printf(...)
 #endif
 
-size_t* compressed_chunk_start_offset;
-
-static void
-get_symbol_frequencies_parallel(SymbolFrequencies *pSF, data_buf& buf) {
-  int c;
-  uint64_t total_count = 0;
-
-  uint64_t buf_chunk_size = UPDIV(buf.size, num_of_threads);
-  int histo_chunk_size = UPDIV(MAX_SYMBOLS, num_of_threads);
-  uint64_t* histo_per_thread = new uint64_t[num_of_threads*MAX_SYMBOLS];
-  memset(histo_per_thread, 0L, num_of_threads*MAX_SYMBOLS*sizeof(uint64_t));
-
-  /* Set all frequencies to 0. */
-  init_frequencies(pSF);
-  
-  double* time = new double[num_of_threads];
-  #pragma omp parallel
-  {
-    double t0 = CycleTimer::currentSeconds();
-    int tid = omp_get_thread_num();
-
+/*
+ * get_symbol_counts_parallel counts the frequency of each byte in buf into
+ * histo. Each task counts its chunk into a private histogram, then a second
+ * pass merges a slice of the symbols per task. It is shared by every
+ * parallel coder that works from an order-0 histogram.
+ */
+void
+get_symbol_counts_parallel(huffman_context& hctx, data_buf& buf, uint64_t* histo) {
+  int num_threads = hctx.threads_for(buf.size);
+  uint64_t buf_chunk_size = UPDIV(buf.size, num_threads);
+  int histo_chunk_size = UPDIV(MAX_SYMBOLS, num_threads);
+  uint64_t* histo_per_thread =
+      hctx.scratch<uint64_t>(SCRATCH_HISTO, num_threads*MAX_SYMBOLS);
+  memset(histo_per_thread, 0L, num_threads*MAX_SYMBOLS*sizeof(uint64_t));
+
+  parallel_for(hctx, num_threads, num_threads, [&](int tid, int) {
     // Which chunk of the buffer to read
-    uint64_t start_offset = buf_chunk_size*tid;
+    uint64_t start_offset = std::min(buf_chunk_size*tid, buf.size);
     // Prevent branches in the loop
     uint64_t end_offset = std::min(start_offset+buf_chunk_size, buf.size);
 
     // Which memory location to write the private histogram
     int histo_id = MAX_SYMBOLS*tid;
 
+    TRACE_SCOPE("histogram");
+    PERF_SCOPE("histogram");
     for (uint64_t i=start_offset; i<end_offset; i++) {
       histo_per_thread[histo_id+(buf.data[i])]++;
     }
+  });
 
-    #pragma omp barrier
+  parallel_for(hctx, num_threads, num_threads, [&](int tid, int) {
+    TRACE_SCOPE("merge");
     // Which chunk of the histogram to update
-    start_offset = histo_chunk_size*tid;
-    end_offset = std::min(start_offset+histo_chunk_size, (uint64_t)MAX_SYMBOLS);
+    uint64_t start_offset = std::min((uint64_t)histo_chunk_size*tid, (uint64_t)MAX_SYMBOLS);
+    uint64_t end_offset = std::min(start_offset+histo_chunk_size, (uint64_t)MAX_SYMBOLS);
 
     for (uint64_t i=start_offset; i<end_offset; i++) {
       uint64_t freq = 0;
-      for (int j=0; j<num_of_threads; j++) {
+      for (int j=0; j<num_threads; j++) {
         freq+=histo_per_thread[MAX_SYMBOLS*j+i];
       }
-      if (freq) {
-        (*pSF)[i] = new_leaf_node(i);
-        (*pSF)[i]->count = freq;
-      }
-      else
-        (*pSF)[i] = nullptr;
+      histo[i] = freq;
+    }
+  });
+}
+
+static void
+get_symbol_frequencies_parallel(huffman_context& hctx, SymbolFrequencies *pSF,
+                                data_buf& buf) {
+  huffman_arena *arena = &hctx.arena;
+  uint64_t histo[MAX_SYMBOLS];
+  get_symbol_counts_parallel(hctx, buf, histo);
+
+  /* Set all frequencies to 0. */
+  init_frequencies(pSF);
+
+  for (int i = 0; i < MAX_SYMBOLS; i++) {
+    if (histo[i]) {
+      (*pSF)[i] = new_leaf_node(arena, i);
+      (*pSF)[i]->count = histo[i];
     }
-    time[tid] = CycleTimer::currentSeconds() - t0;
   }
-  
-//  for (int i = 0; i < num_of_threads; i++)
-//    cout << "Thread " << i << " takes " << time[i] << " to get symbol frequencies" << endl;
-  delete[] time;
-  delete[] histo_per_thread;
 }
 
 static void
-get_symbol_frequencies(SymbolFrequencies *pSF, data_buf& buf) {
+get_symbol_frequencies(huffman_arena *arena, SymbolFrequencies *pSF,
+                       data_buf& buf) {
+  TRACE_SCOPE("histogram");
+  PERF_SCOPE("histogram");
   int c;
 
   /* Set all frequencies to 0. */
@@ -105,7 +117,7 @@ get_symbol_frequencies(SymbolFrequencies *pSF, data_buf& buf) {
   for (size_t i=0; i<buf.size; i++) {
     unsigned char uc = buf.data[i];
     if (!(*pSF)[uc])
-      (*pSF)[uc] = new_leaf_node(uc);
+      (*pSF)[uc] = new_leaf_node(arena, uc);
     ++(*pSF)[uc]->count;
   }
 }
@@ -159,35 +171,38 @@ void write_code_table_memory(data_buf& out_data_buf,
 }
 
 
-size_t get_out_size(data_buf& in_buf, SymbolEncoder *se) {
-  size_t res = 0;
-  size_t cnt = 0;
-  size_t* bytes_in_chunks = new size_t[num_of_threads];
-  #pragma omp parallel
-  {
-    int tid = omp_get_thread_num();
-    bytes_in_chunks[tid] = 0;
-    compressed_chunk_start_offset[tid] = 0;
+/*
+ * get_out_size returns the size of the compressed stream and fills
+ * chunk_offset with the start of each chunk in the data area. The chunks
+ * are the same ones do_encode gives to each thread.
+ */
+size_t get_out_size(huffman_context& hctx, data_buf& in_buf, SymbolEncoder *se,
+                    uint64_t* chunk_offset) {
+  int num_chunks = hctx.threads_for(in_buf.size);
+  size_t chunk_size = UPDIV(in_buf.size, num_chunks);
+  parallel_for(hctx, num_chunks, num_chunks, [&](int tid, int) {
+    TRACE_SCOPE("size");
+    size_t i_offset = min(chunk_size*tid, in_buf.size);
+    size_t e_offset = min(i_offset+chunk_size, in_buf.size);
     size_t cnt = 0;
-    #pragma omp for schedule(static) nowait
-    for (size_t i = 0; i < in_buf.size; i++) {
-      unsigned char uc = in_buf.data[i];
-      huffman_code *code = (*se)[uc];
-      cnt += code->numbits;
+    for (; i_offset < e_offset; i_offset++) {
+      unsigned char uc = in_buf.data[i_offset];
+      cnt += (*se)[uc]->numbits;
     }
-    bytes_in_chunks[tid] = (cnt+7)/8;
-  }
+    chunk_offset[tid] = (cnt+7)/8;
+  });
 
   size_t sum = 0;
-  compressed_chunk_start_offset[0] = 0;
-  for (int i = 0; i<num_of_threads-1; i++) {
-    sum+=bytes_in_chunks[i];
-    compressed_chunk_start_offset[i+1] = sum;
+  for (int i = 0; i < num_chunks; i++) {
+    size_t bytes = chunk_offset[i];
+    chunk_offset[i] = sum;
+    sum += bytes;
   }
-  res = num_of_threads*sizeof(size_t) + sum + bytes_in_chunks[num_of_threads-1];
+  size_t res = sum;
 
-  delete[] bytes_in_chunks;
   // Calculate the size of symbol metadata
+  // uint8_t for the codec id
+  res += 1;
   // uint32_t for number of unique symbols
   res += 4;
   // uint64_t for number of bytes in the input file
@@ -200,28 +215,28 @@ size_t get_out_size(data_buf& in_buf, SymbolEncoder *se) {
       res += numbytes_from_numbits((*se)[i]->numbits);
     }
   }
+  // uint32_t for the number of chunks, uint64_t for each chunk offset
+  res += 4 + num_chunks*sizeof(uint64_t);
 
   return res;
 }
 
 
-static int do_encode(data_buf& in_buf, data_buf& out_buf, SymbolEncoder *se) {
-  size_t chunk_size = (in_buf.size+num_of_threads-1)/num_of_threads;
-  double* time = new double[num_of_threads];
-  #pragma omp parallel
-  {
-    double t0 = CycleTimer::currentSeconds();
-    
+static int do_encode(huffman_context& hctx, data_buf& in_buf, data_buf& out_buf,
+                     SymbolEncoder *se, const uint64_t* chunk_offset) {
+  int num_chunks = hctx.threads_for(in_buf.size);
+  size_t chunk_size = UPDIV(in_buf.size, num_chunks);
+  unsigned char* data = out_buf.data+out_buf.curr_offset;
+  parallel_for(hctx, num_chunks, num_chunks, [&](int tid, int) {
     unsigned char curbyte = 0;
     unsigned char curbit = 0;
-    int tid = omp_get_thread_num();
+    TRACE_SCOPE("encode");
+    PERF_SCOPE("encode");
 
-    size_t start_offset = compressed_chunk_start_offset[tid];
-    ((size_t*)(out_buf.data+out_buf.curr_offset))[tid] = start_offset;
-    start_offset+=num_of_threads*sizeof(size_t);
+    size_t start_offset = chunk_offset[tid];
 
-    size_t i_offset = chunk_size*tid;
-    size_t e_offset = std::min(i_offset+chunk_size, in_buf.size);
+    size_t i_offset = min(chunk_size*tid, in_buf.size);
+    size_t e_offset = min(i_offset+chunk_size, in_buf.size);
 
     for (; i_offset < e_offset; i_offset++) {
       unsigned char uc = in_buf.data[i_offset];
@@ -237,7 +252,7 @@ static int do_encode(data_buf& in_buf, data_buf& out_buf, SymbolEncoder *se) {
         /* If this byte is filled up then write it
          * out and reset the curbit and curbyte. */
         if (++curbit == 8) {
-          (out_buf.data+out_buf.curr_offset)[start_offset++] = curbyte;
+          data[start_offset++] = curbyte;
           curbyte = 0;
           curbit = 0;
         }
@@ -252,20 +267,13 @@ static int do_encode(data_buf& in_buf, data_buf& out_buf, SymbolEncoder *se) {
      * then output it.
      */
     if (curbit > 0)
-      (out_buf.data+out_buf.curr_offset)[start_offset] = curbyte;
-    
-    time[tid] = CycleTimer::currentSeconds() - t0;
-  }
-  
-  // Print per thread time stats
-//  for (int i = 0; i < num_of_threads; i++)
-//    cout << "Thread " << i << " takes " << time[i] << "s to encode chunk" << endl;
-  delete[] time;
+      data[start_offset] = curbyte;
+  });
 
   return 0;
 }
 
-huffman_node * read_code_table_memory(data_buf& buf, uint64_t& num_bytes) {
+huffman_node * read_code_table_memory(huffman_arena *arena, data_buf& buf, uint64_t& num_bytes) {
   // Read number of symbol count
   uint32_t count;
   buf.read_data(&count, sizeof(count));
@@ -275,7 +283,7 @@ huffman_node * read_code_table_memory(data_buf& buf, uint64_t& num_bytes) {
   printf("[DEBUG] Offset after reading data_size = %ld\n", buf.curr_offset);
 
   // Read the symbols and build huffman tree
-  huffman_node *root = new_nonleaf_node(0, NULL, NULL);
+  huffman_node *root = new_nonleaf_node(arena, 0, NULL, NULL);
   while (count-- > 0) {
     huffman_node *p = root;
 
@@ -289,7 +297,7 @@ huffman_node * read_code_table_memory(data_buf& buf, uint64_t& num_bytes) {
 
     // Read the actual symbol bits
     unsigned char numbytes = (unsigned char) numbytes_from_numbits(numbits);
-    unsigned char *bytes = new unsigned char[numbytes];
+    unsigned char bytes[MAX_CODE_BYTES];
     buf.read_data(bytes, numbytes);
 
     // Traverse the huffman tree based on symbol bits
@@ -298,96 +306,131 @@ huffman_node * read_code_table_memory(data_buf& buf, uint64_t& num_bytes) {
       if (get_bit(bytes, curbit)) {
         if (p->one == NULL) {
           p->one = curbit == (unsigned char) (numbits - 1)
-                   ? new_leaf_node(symbol)
-                   : new_nonleaf_node(0, NULL, NULL);
+                   ? new_leaf_node(arena, symbol)
+                   : new_nonleaf_node(arena, 0, NULL, NULL);
           p->one->parent = p;
         }
         p = p->one;
       } else {
         if (p->zero == NULL) {
           p->zero = curbit == (unsigned char) (numbits - 1)
-                    ? new_leaf_node(symbol)
-                    : new_nonleaf_node(0, NULL, NULL);
+                    ? new_leaf_node(arena, symbol)
+                    : new_nonleaf_node(arena, 0, NULL, NULL);
           p->zero->parent = p;
         }
         p = p->zero;
       }
     }
-
-    delete[] bytes;
   }
 
   return root;
 }
 
-int huffman_encode_parallel(
+int huffman_encode_parallel(huffman_context& hctx,
     data_buf& in_data_buf, data_buf& out_data_buf, parallel_type type) {
-  compressed_chunk_start_offset = new size_t[num_of_threads];
+  // Small inputs are not worth a parallel region. The order-1, tANS and
+  // block adaptive coders keep their own formats and only get fewer
+  // threads, so a small block can still be stored raw.
+  if (in_data_buf.size < hctx.small_input_size &&
+      type != parallel_type::OPENMP_Order1 && type != parallel_type::OPENMP_TANS &&
+      type != parallel_type::OPENMP_BlockAdaptive)
+    return huffman_encode_small(hctx, in_data_buf, out_data_buf);
+  if (type == parallel_type::OPENMP_Order1)
+    return huffman_encode_order1(hctx, in_data_buf, out_data_buf);
+  if (type == parallel_type::OPENMP_TANS)
+    return tans_encode_parallel(hctx, in_data_buf, out_data_buf);
+  if (type == parallel_type::OPENMP_BlockAdaptive)
+    return huffman_encode_block(hctx, in_data_buf, out_data_buf);
+
+  uint32_t num_chunks = hctx.threads_for(in_data_buf.size);
   printf("[DEBUG] Start Compression\n");
-  c_time[0] = CycleTimer::currentSeconds();
+  codec_stats& stats = hctx.begin_compress(in_data_buf.size);
+  uint64_t* chunk_offset = hctx.scratch<uint64_t>(SCRATCH_OFFSETS, num_chunks);
+  // Drop the tree of the previous call
+  hctx.arena.reset();
 
   // Get the frequency of each symbol in the input file.
   SymbolFrequencies sf;
   uint64_t symbol_count = in_data_buf.size;
   printf("[DEBUG] Generate Histogram\n");
   if (type == parallel_type::OPENMP_NAIVE)
-    get_symbol_frequencies(&sf, in_data_buf);
+    get_symbol_frequencies(&hctx.arena, &sf, in_data_buf);
   else if (type == parallel_type::OPENMP_ParallelHistogram)
-    get_symbol_frequencies_parallel(&sf, in_data_buf);
+    get_symbol_frequencies_parallel(hctx, &sf, in_data_buf);
   printf("[DEBUG] Input Size = %ld\n", symbol_count);
 
-  c_time[1] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_HISTOGRAM);
   printf("[DEBUG] Construct Huffman Codes\n");
   // Build an optimal table from the symbolCount.
-  SymbolEncoder *se = calculate_huffman_codes(&sf);
+  SymbolEncoder *se;
+  {
+    TRACE_SCOPE("tree");
+    se = calculate_huffman_codes(&hctx.arena, &sf);
+  }
   printf("[DEBUG] Get Output Size\n");
-  size_t out_size = get_out_size(in_data_buf, se);
+  size_t out_size = get_out_size(hctx, in_data_buf, se, chunk_offset);
   printf("[DEBUG] Output Size = %ld, new output buffer\n", out_size);
   out_data_buf.data = new unsigned char[out_size];
   out_data_buf.size = out_size;
   out_data_buf.curr_offset = 0;
   
-  c_time[2] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_TABLE);
 
   printf("[DEBUG] Write code table\n");
-  // Write symbol table
+  // Write codec id, symbol table and chunk index
+  unsigned char codec = CODEC_HUFFMAN;
+  out_data_buf.write_data(&codec, sizeof(codec));
   write_code_table_memory(out_data_buf, se, symbol_count);
+  out_data_buf.write_data(&num_chunks, sizeof(num_chunks));
+  out_data_buf.write_data(chunk_offset, num_chunks*sizeof(uint64_t));
   
-  c_time[3] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_HEADER);
 
   printf("[DEBUG] Compress File\n");
   // Encode file
-  do_encode(in_data_buf, out_data_buf, se);
+  do_encode(hctx, in_data_buf, out_data_buf, se, chunk_offset);
   
-  c_time[4] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
   printf("[DEBUG] Finish Compression\n");
 
-  /* Free the Huffman tree. */
-  delete[] compressed_chunk_start_offset;
-  free_huffman_tree(sf[0]);
-  free_encoder(se);
   return 0;
 }
 
 
 int
-huffman_decode_parallel(
+huffman_decode_parallel(huffman_context& hctx,
     data_buf& in_data_buf, data_buf& out_data_buf, parallel_type type) {
-  omp_set_num_threads(num_of_threads);
-  num_of_threads = num_of_threads;
-  compressed_chunk_start_offset = new size_t[num_of_threads];
+  // The codec is recorded in the stream, so the type is not needed here.
+  unsigned char codec = in_data_buf.data[in_data_buf.curr_offset];
+  if (codec == CODEC_HUFFMAN_ORDER1)
+    return huffman_decode_order1(hctx, in_data_buf, out_data_buf);
+  if (codec == CODEC_TANS)
+    return tans_decode_parallel(hctx, in_data_buf, out_data_buf);
+  if (codec == CODEC_HUFFMAN_BLOCK)
+    return huffman_decode_block(hctx, in_data_buf, out_data_buf);
+  if (codec == CODEC_HUFFMAN_SMALL)
+    return huffman_decode_small(hctx, in_data_buf, out_data_buf);
+
   printf("[DEBUG] Start Decompression\n");
 
-  d_time[0] = CycleTimer::currentSeconds();
+  codec_stats& stats = hctx.begin_decompress(in_data_buf.size);
+  hctx.arena.reset();
 
   printf("[DEBUG] Read Code Table\n");
+  in_data_buf.read_data(&codec, sizeof(codec));
+  assert(codec == CODEC_HUFFMAN);
 
   // Read the symbol list from input buffer and build Huffman Tree
   size_t data_count;
-  huffman_node *root = read_code_table_memory(in_data_buf, data_count);
+  huffman_node *root;
+  {
+    TRACE_SCOPE("tree");
+    root = read_code_table_memory(&hctx.arena, in_data_buf, data_count);
+  }
   printf("[DEBUG] Output Size = %ld, new output buffer\n", data_count);
 
-  d_time[1] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_TABLE);
 
   // Initialize output buffer
   out_data_buf.data = new unsigned char[data_count];
@@ -395,20 +438,21 @@ huffman_decode_parallel(
   out_data_buf.curr_offset = 0;
 
   printf("[DEBUG] Decompres File\n");
-  // Decode the file using Huffman Tree
-  in_data_buf.read_data(compressed_chunk_start_offset, num_of_threads*sizeof(size_t));
-  size_t o_chunk_size = (data_count+num_of_threads-1)/num_of_threads;
+  // Decode the file using Huffman Tree. The chunks were set by the encoder
+  // and do not depend on the number of threads used here.
+  uint32_t num_chunks;
+  in_data_buf.read_data(&num_chunks, sizeof(num_chunks));
+  uint64_t* chunk_offset = hctx.scratch<uint64_t>(SCRATCH_OFFSETS, num_chunks);
+  in_data_buf.read_data(chunk_offset, num_chunks*sizeof(uint64_t));
+  size_t o_chunk_size = UPDIV(data_count, num_chunks);
   
-  double* time = new double[num_of_threads];
-  #pragma omp parallel
-  {
-    double t0 = CycleTimer::currentSeconds();
-    
+  parallel_for(hctx, hctx.threads_for(data_count), num_chunks, [&](int chunk, int) {
+    TRACE_SCOPE("decode");
+    PERF_SCOPE("decode");
     huffman_node *p = root;
-    int tid = omp_get_thread_num();
-    size_t i_offset = compressed_chunk_start_offset[tid] + in_data_buf.curr_offset;
+    size_t i_offset = chunk_offset[chunk] + in_data_buf.curr_offset;
 
-    size_t o_start_offset = o_chunk_size * tid;
+    size_t o_start_offset = min(o_chunk_size * chunk, (size_t)data_count);
     size_t o_end_offset = min(o_start_offset+o_chunk_size, (size_t)data_count);
     
     while (o_start_offset < o_end_offset) {
@@ -424,19 +468,11 @@ huffman_decode_parallel(
         }
       }
     }
-    
-    time[tid] = CycleTimer::currentSeconds() - t0;
-  }
+  });
   
-//  for (int i = 0; i < num_of_threads; i++)
-//    cout << "Thread " << i << " takes " << time[i] << "s to decode chunk" << endl;
-  delete[] time;
-  
-  d_time[2] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
   printf("[DEBUG] Finish Decompression\n");
 
-  delete[] compressed_chunk_start_offset;
-  free_huffman_tree(root);
   return 0;
 }
-
@@ -11,6 +11,7 @@
 #include "util.h"
 #include "huffman.h"
 #include "util.h"
+#include "perf_counters.h"
 
 #ifdef WIN32
 #include <winsock2.h>
@@ -37,7 +38,8 @@ using std::endl;
 
 /****************** Helper functions ***********************/
 
-static void get_symbol_frequencies(SymbolFrequencies *pSF, data_buf& buf) {
+static void get_symbol_frequencies(huffman_arena *arena, SymbolFrequencies *pSF,
+                       data_buf& buf) {
   int c;
 
   /* Set all frequencies to 0. */
@@ -47,7 +49,7 @@ static void get_symbol_frequencies(SymbolFrequencies *pSF, data_buf& buf) {
   for (size_t i=0; i<buf.size; i++) {
     unsigned char uc = buf.data[i];
     if (!(*pSF)[uc])
-      (*pSF)[uc] = new_leaf_node(uc);
+      (*pSF)[uc] = new_leaf_node(arena, uc);
     ++(*pSF)[uc]->count;
   }
 }
@@ -167,7 +169,7 @@ static int do_encode(data_buf& in_buf, data_buf& out_buf, SymbolEncoder *se) {
   return 0;
 }
 
-static huffman_node * read_code_table_memory(data_buf& buf, size_t& num_bytes) {
+static huffman_node * read_code_table_memory(huffman_arena *arena, data_buf& buf, size_t& num_bytes) {
   // Read number of symbol count
   uint32_t count;
   buf.read_data(&count, sizeof(count));
@@ -176,7 +178,7 @@ static huffman_node * read_code_table_memory(data_buf& buf, size_t& num_bytes) {
   buf.read_data(&num_bytes, sizeof(num_bytes));
 
   // Read the symbols and build huffman tree
-  huffman_node *root = new_nonleaf_node(0, NULL, NULL);
+  huffman_node *root = new_nonleaf_node(arena, 0, NULL, NULL);
   while (count-- > 0) {
     huffman_node *p = root;
     
@@ -190,7 +192,7 @@ static huffman_node * read_code_table_memory(data_buf& buf, size_t& num_bytes) {
     
     // Read the actual symbol bits
     unsigned char numbytes = (unsigned char) numbytes_from_numbits(numbits);
-    unsigned char *bytes = new unsigned char[numbytes];
+    unsigned char bytes[MAX_CODE_BYTES];
     buf.read_data(bytes, numbytes);
     
     // Traverse the huffman tree based on symbol bits
@@ -199,30 +201,30 @@ static huffman_node * read_code_table_memory(data_buf& buf, size_t& num_bytes) {
       if (get_bit(bytes, curbit)) {
         if (p->one == NULL) {
           p->one = curbit == (unsigned char) (numbits - 1)
-                   ? new_leaf_node(symbol)
-                   : new_nonleaf_node(0, NULL, NULL);
+                   ? new_leaf_node(arena, symbol)
+                   : new_nonleaf_node(arena, 0, NULL, NULL);
           p->one->parent = p;
         }
         p = p->one;
       } else {
         if (p->zero == NULL) {
           p->zero = curbit == (unsigned char) (numbits - 1)
-                    ? new_leaf_node(symbol)
-                    : new_nonleaf_node(0, NULL, NULL);
+                    ? new_leaf_node(arena, symbol)
+                    : new_nonleaf_node(arena, 0, NULL, NULL);
           p->zero->parent = p;
         }
         p = p->zero;
       }
     }
-
-    delete[] bytes;
   }
 
   return root;
 }
                      
-int huffman_encode_seq(data_buf& in_data_buf, data_buf& out_data_buf) {
-  c_time[0] = CycleTimer::currentSeconds();
+int huffman_encode_seq(huffman_context& hctx, data_buf& in_data_buf, data_buf& out_data_buf) {
+  codec_stats& stats = hctx.begin_compress(in_data_buf.size);
+  // Drop the tree of the previous call
+  hctx.arena.reset();
   printf("[DEBUG] Start Compression\n");
 
   // Get the frequency of each symbol in the input file.
@@ -230,15 +232,18 @@ int huffman_encode_seq(data_buf& in_data_buf, data_buf& out_data_buf) {
   size_t symbol_count = in_data_buf.size;
   printf("[DEBUG] Generate Histogram\n");
 
-  get_symbol_frequencies(&sf, in_data_buf);
+  {
+    PERF_SCOPE("histogram");
+    get_symbol_frequencies(&hctx.arena, &sf, in_data_buf);
+  }
   printf("[DEBUG] Input Size = %ld\n", symbol_count);
 
-  c_time[1] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_HISTOGRAM);
   
   // Build an optimal table from the symbolCount.
   printf("[DEBUG] Construct Huffman Codes\n");
 
-  SymbolEncoder *se = calculate_huffman_codes(&sf);
+  SymbolEncoder *se = calculate_huffman_codes(&hctx.arena, &sf);
   printf("[DEBUG] Get Output Size\n");
 
   size_t out_size = get_out_size(in_data_buf, se);
@@ -248,40 +253,41 @@ int huffman_encode_seq(data_buf& in_data_buf, data_buf& out_data_buf) {
   out_data_buf.size = out_size;
   out_data_buf.curr_offset = 0;
   
-  c_time[2] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_TABLE);
 
   printf("[DEBUG] Write code table\n");
   // Write symbol information into out_data_buf
   write_code_table_memory(out_data_buf, se, symbol_count);
   
-  c_time[3] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_HEADER);
   printf("[DEBUG] Compress File\n");
 
   // Encode file and write to out_data_buf
-  do_encode(in_data_buf, out_data_buf, se);
+  {
+    PERF_SCOPE("encode");
+    do_encode(in_data_buf, out_data_buf, se);
+  }
   
   // By now, data_buf should all be used
   assert(out_data_buf.curr_offset == out_data_buf.size);
   
-  c_time[4] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
   printf("[DEBUG] Finish Compression\n");
 
-  // Free the Huffman tree.
-  free_huffman_tree(sf[0]);
-  free_encoder(se);
-  
   return 0;
 }
 
 
-int huffman_decode_seq(data_buf& in_data_buf, data_buf& out_data_buf) {
-  d_time[0] = CycleTimer::currentSeconds();
+int huffman_decode_seq(huffman_context& hctx, data_buf& in_data_buf, data_buf& out_data_buf) {
+  codec_stats& stats = hctx.begin_decompress(in_data_buf.size);
+  hctx.arena.reset();
   
   // Read the symbol list from input buffer and build Huffman Tree
   size_t data_count;
-  huffman_node *root = read_code_table_memory(in_data_buf, data_count);
+  huffman_node *root = read_code_table_memory(&hctx.arena, in_data_buf, data_count);
   
-  d_time[1] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_TABLE);
 
   // Initialize output buffer
   out_data_buf.data = new unsigned char[data_count];
@@ -289,6 +295,7 @@ int huffman_decode_seq(data_buf& in_data_buf, data_buf& out_data_buf) {
   out_data_buf.curr_offset = 0;
   
   // Decode the file using Huffman Tree
+  PERF_SCOPE("decode");
   huffman_node *p = root;
   while (data_count > 0) {
     unsigned char byte;
@@ -307,10 +314,9 @@ int huffman_decode_seq(data_buf& in_data_buf, data_buf& out_data_buf) {
     }
   }
   
-  d_time[2] = CycleTimer::currentSeconds();
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
   
-  // Free the Huffman Tree
-  free_huffman_tree(root);
   return 0;
 }
 
@@ -0,0 +1,92 @@
+/*
+ *  huffman - Encode/Decode small inputs on the calling thread.
+ *
+ *  For small inputs the cost of starting parallel regions is larger than
+ *  the work itself. This coder counts, builds a canonical table and codes
+ *  in one call on the calling thread, with every temporary on the stack.
+ *  Only the output buffer is allocated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "util.h"
+#include "huffman.h"
+#include "canonical.h"
+
+/*
+ * Compressed layout:
+ *   uint8_t              codec id (CODEC_HUFFMAN_SMALL)
+ *   uint64_t             number of bytes in the input
+ *   table
+ *   data
+ */
+
+int huffman_encode_small(huffman_context& hctx, data_buf& in_data_buf,
+                         data_buf& out_data_buf) {
+  codec_stats& stats = hctx.begin_compress(in_data_buf.size);
+
+  uint64_t symbol_count = in_data_buf.size;
+  uint64_t histo[MAX_SYMBOLS] = {0};
+  for (size_t i = 0; i < in_data_buf.size; i++)
+    histo[in_data_buf.data[i]]++;
+
+  stats.end_phase(PHASE_HISTOGRAM);
+
+  canonical_table table;
+  build_canonical_table(histo, &table);
+  size_t out_size = 1 + sizeof(symbol_count) + canonical_table_size(&table) +
+                    UPDIV(canonical_cost_bits(&table, histo), 8);
+  out_data_buf.data = new unsigned char[out_size];
+  out_data_buf.size = out_size;
+  out_data_buf.curr_offset = 0;
+
+  stats.end_phase(PHASE_TABLE);
+
+  unsigned char codec = CODEC_HUFFMAN_SMALL;
+  out_data_buf.write_data(&codec, sizeof(codec));
+  out_data_buf.write_data(&symbol_count, sizeof(symbol_count));
+  write_canonical_table(out_data_buf, &table);
+
+  stats.end_phase(PHASE_HEADER);
+
+  canonical_encode(&table, in_data_buf.data, in_data_buf.size,
+                   out_data_buf.data + out_data_buf.curr_offset);
+
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
+  return 0;
+}
+
+
+int huffman_decode_small(huffman_context& hctx, data_buf& in_data_buf,
+                         data_buf& out_data_buf) {
+  codec_stats& stats = hctx.begin_decompress(in_data_buf.size);
+
+  unsigned char codec;
+  in_data_buf.read_data(&codec, sizeof(codec));
+  assert(codec == CODEC_HUFFMAN_SMALL);
+
+  uint64_t data_count;
+  in_data_buf.read_data(&data_count, sizeof(data_count));
+  canonical_table table;
+  if (!read_canonical_table(in_data_buf, &table))
+    return 1;
+  canonical_decoder dec;
+  build_canonical_decoder(&table, &dec);
+
+  stats.end_phase(PHASE_TABLE);
+
+  out_data_buf.data = new unsigned char[data_count];
+  out_data_buf.size = data_count;
+  out_data_buf.curr_offset = 0;
+
+  canonical_decode(&dec, in_data_buf.data + in_data_buf.curr_offset,
+                   in_data_buf.size - in_data_buf.curr_offset,
+                   out_data_buf.data, data_count);
+
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
+  return 0;
+}
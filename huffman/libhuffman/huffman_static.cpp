@@ -0,0 +1,117 @@
+/*
+ *  huffman - Encode/Decode small records against a pretrained table.
+ *
+ *  Small records cannot pay for their own histogram and table. The table
+ *  is trained once from sample records, stored next to the data, and each
+ *  record is coded against it with no per-record header. The caller keeps
+ *  the original size of each record, as it usually does to frame records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "huffman_static.h"
+
+
+/*
+ * huffman_static_train builds a table from the byte frequencies of the
+ * samples. Every symbol gets a code, even ones not seen in the samples,
+ * so the table can code any record.
+ */
+void
+huffman_static_train(const data_buf* samples, size_t num_samples,
+                     huffman_static_table* st) {
+  uint64_t freqs[MAX_SYMBOLS] = {0};
+  for (size_t i = 0; i < num_samples; ++i)
+    for (size_t j = 0; j < samples[i].size; ++j)
+      freqs[samples[i].data[j]]++;
+
+  // Scale up so that the smoothing only matters for unseen symbols.
+  for (int i = 0; i < MAX_SYMBOLS; ++i)
+    freqs[i] = freqs[i] * MAX_SYMBOLS + 1;
+
+  build_canonical_table(freqs, &st->table);
+  huffman_static_init(st);
+}
+
+// Build the decoding table. Called once after the table is trained or read.
+void
+huffman_static_init(huffman_static_table* st) {
+  build_canonical_decoder(&st->table, &st->dec);
+}
+
+void
+huffman_static_write(data_buf& buf, const huffman_static_table* st) {
+  write_canonical_table(buf, &st->table);
+}
+
+/*
+ * A record may hold any byte, and the encoder has no escape for a byte
+ * without a code, so a table must code all of them.
+ */
+bool
+huffman_static_read(data_buf& buf, huffman_static_table* st) {
+  if (!read_canonical_table(buf, &st->table))
+    return false;
+  for (int i = 0; i < MAX_SYMBOLS; ++i)
+    if (!st->table.numbits[i])
+      return false;
+  huffman_static_init(st);
+  return true;
+}
+
+bool
+huffman_static_save(const char* file_name, const huffman_static_table* st) {
+  unsigned char bytes[HUFFMAN_STATIC_TABLE_BOUND];
+  size_t size = sizeof(bytes);
+  data_buf buf(bytes, size);
+  huffman_static_write(buf, st);
+
+  FILE* fp = fopen(file_name, "wb");
+  if (!fp)
+    return false;
+  bool ok = fwrite(bytes, 1, buf.curr_offset, fp) == buf.curr_offset;
+  return fclose(fp) == 0 && ok;
+}
+
+/*
+ * huffman_static_load reads a table written by huffman_static_save. The
+ * bitmap gives the number of code lengths that must follow it.
+ */
+bool
+huffman_static_load(const char* file_name, huffman_static_table* st) {
+  unsigned char bytes[HUFFMAN_STATIC_TABLE_BOUND];
+  FILE* fp = fopen(file_name, "rb");
+  if (!fp)
+    return false;
+  size_t size = fread(bytes, 1, sizeof(bytes), fp);
+  fclose(fp);
+
+  size_t coded = 0;
+  if (size < MAX_SYMBOLS / 8)
+    return false;
+  for (int i = 0; i < MAX_SYMBOLS; ++i)
+    coded += get_bit(bytes, i);
+  if (size != MAX_SYMBOLS / 8 + UPDIV(coded, 2))
+    return false;
+
+  data_buf buf(bytes, size);
+  return huffman_static_read(buf, st);
+}
+
+/*
+ * huffman_static_encode codes a record into out, which must hold at least
+ * HUFFMAN_STATIC_BOUND(size) bytes. Return the compressed size.
+ */
+size_t
+huffman_static_encode(const huffman_static_table* st, const unsigned char* in,
+                      size_t size, unsigned char* out) {
+  return canonical_encode(&st->table, in, size, out) - out;
+}
+
+void
+huffman_static_decode(const huffman_static_table* st, const unsigned char* in,
+                      size_t in_size, unsigned char* out, size_t size) {
+  canonical_decode(&st->dec, in, in_size, out, size);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "canonical.h"
+#include "util.h"
+
+/*
+ * A static table is trained once from a sample corpus and shared by every
+ * record coded with it, so records carry no histogram and no table. It is
+ * read only after huffman_static_init, so any number of threads can code
+ * with the same table at once.
+ */
+typedef struct huffman_static_table_tag {
+  canonical_table table;
+  canonical_decoder dec;
+} huffman_static_table;
+
+// Largest compressed size of a record of size bytes.
+#define HUFFMAN_STATIC_BOUND(size) UPDIV((size) * MAX_CODE_BITS, 8)
+
+// Largest serialized table: a bitmap of coded symbols and 4 bit lengths.
+#define HUFFMAN_STATIC_TABLE_BOUND (MAX_SYMBOLS / 8 + MAX_SYMBOLS / 2)
+
+void
+huffman_static_train(const data_buf* samples, size_t num_samples,
+                     huffman_static_table* st);
+
+void
+huffman_static_init(huffman_static_table* st);
+
+void
+huffman_static_write(data_buf& buf, const huffman_static_table* st);
+
+// Return false if the table isn't a complete code over every symbol.
+bool
+huffman_static_read(data_buf& buf, huffman_static_table* st);
+
+// Serialize a table to a file and back. Return false if the file can't be
+// written or doesn't hold a whole, valid table.
+bool
+huffman_static_save(const char* file_name, const huffman_static_table* st);
+
+bool
+huffman_static_load(const char* file_name, huffman_static_table* st);
+
+size_t
+huffman_static_encode(const huffman_static_table* st, const unsigned char* in,
+                      size_t size, unsigned char* out);
+
+void
+huffman_static_decode(const huffman_static_table* st, const unsigned char* in,
+                      size_t in_size, unsigned char* out, size_t size);
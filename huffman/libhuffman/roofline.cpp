@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <omp.h>
+#include "roofline.h"
+#include "util.h"
+#include "CycleTimer.h"
+
+#define ROOFLINE_PASSES 5
+// Smaller inputs are gone before the timer or a thread team resolves a pass
+#define ROOFLINE_MIN_SIZE (64 * 1024)
+
+/*
+ * Sum the buffer in 8-byte words. The sum is returned so the compiler
+ * cannot drop the loads.
+ */
+static uint64_t read_kernel(const unsigned char* src, size_t size,
+                            int num_threads) {
+  uint64_t sum = 0;
+  size_t words = size / sizeof(uint64_t);
+  size_t chunk = UPDIV(words, num_threads);
+  #pragma omp parallel num_threads(num_threads) reduction(+:sum)
+  {
+    int tid = omp_get_thread_num();
+    size_t start = chunk * tid < words ? chunk * tid : words;
+    size_t end = start + chunk < words ? start + chunk : words;
+    const uint64_t* p = (const uint64_t*)src;
+    uint64_t s = 0;
+    for (size_t i = start; i < end; i++)
+      s += p[i];
+    sum += s;
+  }
+  return sum;
+}
+
+static void copy_kernel(const unsigned char* src, unsigned char* dst,
+                        size_t size, int num_threads) {
+  size_t chunk = UPDIV(size, num_threads);
+  #pragma omp parallel num_threads(num_threads)
+  {
+    int tid = omp_get_thread_num();
+    size_t start = chunk * tid < size ? chunk * tid : size;
+    size_t end = start + chunk < size ? start + chunk : size;
+    memcpy(dst + start, src + start, end - start);
+  }
+}
+
+roofline measure_roofline(const unsigned char* src, unsigned char* dst,
+                          size_t size, int num_threads) {
+  roofline r;
+  r.num_threads = 0;
+  r.read_gbps = 0;
+  r.copy_gbps = 0;
+  if (size < ROOFLINE_MIN_SIZE)
+    return r;
+
+  // The first pass of each kernel also faults in the pages of dst.
+  volatile uint64_t sink = 0;
+  double best_read = 0, best_copy = 0;
+  for (int pass = 0; pass <= ROOFLINE_PASSES; pass++) {
+    double t0 = CycleTimer::currentSeconds();
+    sink += read_kernel(src, size, num_threads);
+    double t1 = CycleTimer::currentSeconds();
+    copy_kernel(src, dst, size, num_threads);
+    double t2 = CycleTimer::currentSeconds();
+    if (pass == 0)
+      continue;
+    if (best_read == 0 || t1 - t0 < best_read)
+      best_read = t1 - t0;
+    if (best_copy == 0 || t2 - t1 < best_copy)
+      best_copy = t2 - t1;
+  }
+  if (best_read <= 0 || best_copy <= 0)
+    return r;
+  r.num_threads = num_threads;
+  r.read_gbps = size / best_read / 1e9;
+  // A copy reads and writes every byte.
+  r.copy_gbps = 2.0 * size / best_copy / 1e9;
+  return r;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Memory bandwidth a phase can reach at most with a given number of
+ * threads, measured with STREAM-like kernels over the buffers the phase
+ * works on. A phase that only reads its input is bound by read_gbps; one
+ * that reads its input and writes its output by copy_gbps, counting the
+ * bytes of both.
+ */
+struct roofline {
+  int num_threads;
+  double read_gbps;
+  double copy_gbps;
+};
+
+// Best of a few passes over size bytes of src, reading and copying into
+// dst, which must hold size bytes. num_threads is 0 if the input is too
+// small for the passes to be timed.
+roofline measure_roofline(const unsigned char* src, unsigned char* dst,
+                          size_t size, int num_threads);
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "huffman.h"
+#include "worker_pool.h"
+
+static const char* phase_name[NUM_PHASES] = {
+  "histogram", "table", "header", "code"
+};
+
+static codec_stats&
+begin_stats(huffman_context& hctx, codec_stats& stats, size_t size) {
+  stats = codec_stats();
+  stats.bytes_in = size;
+  // Every slot a parallel region of this context may run in
+  int slots = hctx.num_threads;
+  if (hctx.pool && hctx.pool->num_slots() > slots)
+    slots = hctx.pool->num_slots();
+  stats.thread_busy.assign(slots, 0);
+  for (int i = 0; i < NUM_SCRATCH_SLOTS; i++)
+    hctx.scratch_used[i] = 0;
+  stats.start_time = stats.last_time = CycleTimer::currentSeconds();
+  hctx.active_stats = &stats;
+  return stats;
+}
+
+codec_stats& huffman_context::begin_compress(size_t size) {
+  return begin_stats(*this, compress_stats, size);
+}
+
+codec_stats& huffman_context::begin_decompress(size_t size) {
+  codec_stats& stats = begin_stats(*this, decompress_stats, size);
+  stats.decompress = true;
+  return stats;
+}
+
+void huffman_context::end_stats(codec_stats& stats, size_t out_size) {
+  stats.total_time = CycleTimer::currentSeconds() - stats.start_time;
+  stats.bytes_out = out_size;
+  // Scratch kept from earlier, larger calls is not this call's
+  size_t peak = out_size;
+  for (int i = 0; i < NUM_SCRATCH_SLOTS; i++)
+    peak += scratch_used[i];
+  stats.peak_alloc_bytes = peak;
+  active_stats = NULL;
+}
+
+/*
+ * write_stats_json prints stats without a trailing newline, so callers can
+ * nest the object in their own output.
+ */
+void write_stats_json(FILE* out, const codec_stats& stats) {
+  fprintf(out, "{\"total_seconds\": %.9f, \"phases\": {", stats.total_time);
+  for (int i = 0; i < NUM_PHASES; i++)
+    fprintf(out, "%s\"%s\": %.9f", i ? ", " : "", phase_name[i],
+            stats.phase_time[i]);
+  fprintf(out, "}, \"thread_busy_seconds\": [");
+  for (size_t i = 0; i < stats.thread_busy.size(); i++)
+    fprintf(out, "%s%.9f", i ? ", " : "", stats.thread_busy[i]);
+  fprintf(out, "], \"bytes_in\": %zu, \"bytes_out\": %zu, "
+          "\"gb_per_sec\": %.6f, \"imbalance\": %.4f, "
+          "\"peak_alloc_bytes\": %zu}",
+          stats.bytes_in, stats.bytes_out, stats.gb_per_sec(),
+          stats.imbalance(), stats.peak_alloc_bytes);
+}
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "synth.h"
+
+using std::string;
+using std::vector;
+
+// Bytes generated from one seed. Units are filled in parallel, so the
+// output doesn't depend on the thread count.
+#define SYNTH_UNIT_SIZE (1 << 20)
+
+// Letters, space and punctuation of the markov pattern
+static const char markov_alphabet[] = "etaoinshrdlcumwfgypbvkjxqz ,.\n'-";
+#define MARKOV_SYMBOLS 32
+
+enum synth_pattern {
+  SYNTH_UNIFORM,
+  SYNTH_ZIPF,
+  SYNTH_RUNS,
+  SYNTH_MARKOV,
+  SYNTH_MIXED,
+};
+
+static const char* pattern_names[] = {
+  "uniform", "zipf", "runs", "markov", "mixed"
+};
+
+struct synth_spec {
+  synth_pattern pattern;
+  size_t size;
+  double s;
+  int n;
+  size_t run;
+  int order;
+  size_t block;
+  double p;
+  uint64_t seed;
+};
+
+// splitmix64: small, fast and the same everywhere
+struct synth_rng {
+  uint64_t state;
+  explicit synth_rng(uint64_t seed) : state(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform in [0, 1)
+  double uniform() {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+};
+
+// Seed of one unit of a dataset
+static uint64_t unit_seed(uint64_t seed, uint64_t unit) {
+  synth_rng rng(seed ^ (unit * 0xd1b54a32d192ed03ULL));
+  return rng.next();
+}
+
+/*
+ * Symbols of rank k drawn with weight 1/(k+1)^s. The ranks are given to
+ * byte values in a random order so the frequent symbols aren't all small.
+ */
+struct zipf_table {
+  vector<double> cdf;
+  vector<unsigned char> symbol;
+
+  void init(int n, double s, synth_rng& rng, const unsigned char* alphabet) {
+    cdf.resize(n);
+    symbol.resize(n);
+    double sum = 0;
+    for (int k = 0; k < n; k++) {
+      sum += 1.0 / pow(k + 1, s);
+      cdf[k] = sum;
+      symbol[k] = alphabet ? alphabet[k] : (unsigned char)k;
+    }
+    for (int k = 0; k < n; k++)
+      cdf[k] /= sum;
+    cdf[n - 1] = 1.0;
+    for (int k = n - 1; k > 0; k--)
+      std::swap(symbol[k], symbol[rng.next() % (k + 1)]);
+  }
+
+  unsigned char sample(synth_rng& rng) const {
+    size_t k = std::upper_bound(cdf.begin(), cdf.end(), rng.uniform()) -
+               cdf.begin();
+    return symbol[std::min(k, cdf.size() - 1)];
+  }
+};
+
+// Tables shared by every unit, drawn from the seed of the spec
+struct synth_model {
+  zipf_table zipf;
+  // One table per context of the markov pattern
+  vector<zipf_table> markov;
+};
+
+static void init_model(const synth_spec& spec, synth_model& model) {
+  synth_rng rng(spec.seed);
+  model.zipf.init(spec.n, spec.s, rng, NULL);
+  if (spec.pattern == SYNTH_MARKOV) {
+    size_t contexts = spec.order == 1 ? MARKOV_SYMBOLS :
+                      MARKOV_SYMBOLS * MARKOV_SYMBOLS;
+    model.markov.resize(contexts);
+    for (size_t c = 0; c < contexts; c++)
+      model.markov[c].init(MARKOV_SYMBOLS, spec.s, rng,
+                           (const unsigned char*)markov_alphabet);
+  }
+}
+
+static void fill_uniform(unsigned char* out, size_t size, synth_rng& rng) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word = rng.next();
+    memcpy(out + i, &word, sizeof(word));
+  }
+  uint64_t word = rng.next();
+  for (; i < size; i++, word >>= 8)
+    out[i] = (unsigned char)word;
+}
+
+static void fill_zipf(unsigned char* out, size_t size, synth_rng& rng,
+                      const zipf_table& zipf) {
+  for (size_t i = 0; i < size; i++)
+    out[i] = zipf.sample(rng);
+}
+
+static void fill_runs(unsigned char* out, size_t size, synth_rng& rng,
+                      const synth_spec& spec, const zipf_table& zipf) {
+  size_t i = 0;
+  while (i < size) {
+    size_t len = std::min(size - i, (size_t)(1 + rng.next() % (2 * spec.run)));
+    memset(out + i, zipf.sample(rng), len);
+    i += len;
+  }
+}
+
+// Each letter is drawn from the table of the one or two letters before it.
+// Every unit starts after a space.
+static void fill_markov(unsigned char* out, size_t size, synth_rng& rng,
+                        const synth_spec& spec, const synth_model& model) {
+  const char* space = strchr(markov_alphabet, ' ');
+  size_t prev1 = space - markov_alphabet, prev2 = prev1;
+  // Index of every byte in the alphabet
+  unsigned char index[256] = {0};
+  for (int i = 0; i < MARKOV_SYMBOLS; i++)
+    index[(unsigned char)markov_alphabet[i]] = (unsigned char)i;
+  for (size_t i = 0; i < size; i++) {
+    size_t context = spec.order == 1 ? prev1 : prev2 * MARKOV_SYMBOLS + prev1;
+    out[i] = model.markov[context].sample(rng);
+    prev2 = prev1;
+    prev1 = index[out[i]];
+  }
+}
+
+static void fill_unit(unsigned char* out, size_t size, uint64_t unit,
+                      const synth_spec& spec, const synth_model& model) {
+  synth_rng rng(unit_seed(spec.seed, unit));
+  switch (spec.pattern) {
+    case SYNTH_UNIFORM:
+      fill_uniform(out, size, rng);
+      break;
+    case SYNTH_ZIPF:
+      fill_zipf(out, size, rng, model.zipf);
+      break;
+    case SYNTH_RUNS:
+      fill_runs(out, size, rng, spec, model.zipf);
+      break;
+    case SYNTH_MARKOV:
+      fill_markov(out, size, rng, spec, model);
+      break;
+    case SYNTH_MIXED:
+      // A unit is one block
+      if (rng.uniform() < spec.p)
+        fill_uniform(out, size, rng);
+      else
+        fill_zipf(out, size, rng, model.zipf);
+      break;
+  }
+}
+
+// Parse a size with an optional K, M or G suffix
+static bool parse_size(const string& text, size_t* size) {
+  char* end;
+  unsigned long long value = strtoull(text.c_str(), &end, 10);
+  if (end == text.c_str())
+    return false;
+  switch (*end) {
+    case 'G': case 'g': value <<= 10;  // fall through
+    case 'M': case 'm': value <<= 10;  // fall through
+    case 'K': case 'k': value <<= 10; end++; break;
+    default: break;
+  }
+  *size = (size_t)value;
+  return *end == '\0';
+}
+
+static bool parse_param(const string& param, synth_spec& spec) {
+  size_t eq = param.find('=');
+  if (eq == string::npos)
+    return false;
+  string key = param.substr(0, eq);
+  string value = param.substr(eq + 1);
+  const char* v = value.c_str();
+  if (key == "s")
+    spec.s = atof(v);
+  else if (key == "n")
+    spec.n = atoi(v);
+  else if (key == "run")
+    return parse_size(value, &spec.run) && spec.run > 0;
+  else if (key == "order")
+    spec.order = atoi(v);
+  else if (key == "block")
+    return parse_size(value, &spec.block) && spec.block > 0;
+  else if (key == "p")
+    spec.p = atof(v);
+  else if (key == "seed")
+    spec.seed = strtoull(v, NULL, 10);
+  else
+    return false;
+  return true;
+}
+
+static bool parse_spec(const string& text, synth_spec& spec) {
+  vector<string> fields;
+  size_t start = 0;
+  for (int i = 0; i < 3; i++) {
+    size_t colon = text.find(':', start);
+    fields.push_back(text.substr(start, colon - start));
+    if (colon == string::npos) {
+      start = text.size();
+      break;
+    }
+    start = colon + 1;
+  }
+  if (fields.size() < 3 || fields[0] != "synth")
+    return false;
+
+  int num_patterns = sizeof(pattern_names) / sizeof(pattern_names[0]);
+  int p = 0;
+  while (p < num_patterns && fields[1] != pattern_names[p])
+    p++;
+  if (p == num_patterns)
+    return false;
+  spec.pattern = (synth_pattern)p;
+  spec.s = spec.pattern == SYNTH_MARKOV ? 1.2 : 1.0;
+  spec.n = 256;
+  spec.run = 64;
+  spec.order = 2;
+  spec.block = 64 * 1024;
+  spec.p = 0.5;
+  spec.seed = 1;
+  if (!parse_size(fields[2], &spec.size))
+    return false;
+
+  // Parameters follow the size
+  while (start < text.size()) {
+    size_t comma = text.find(',', start);
+    if (comma == string::npos)
+      comma = text.size();
+    if (!parse_param(text.substr(start, comma - start), spec))
+      return false;
+    start = comma + 1;
+  }
+  return spec.n >= 1 && spec.n <= 256 && spec.s >= 0 &&
+         (spec.order == 1 || spec.order == 2) && spec.p >= 0 && spec.p <= 1;
+}
+
+bool is_synth_spec(const string& name) {
+  return name.compare(0, 6, "synth:") == 0;
+}
+
+const char* synth_pattern_names() {
+  return "uniform,zipf,runs,markov,mixed";
+}
+
+bool synth_generate(const string& text, vector<unsigned char>& data) {
+  synth_spec spec;
+  if (!parse_spec(text, spec)) {
+    fprintf(stderr, "Bad dataset spec %s; expected "
+            "synth:<%s>:<size>[:key=value,...]\n", text.c_str(),
+            synth_pattern_names());
+    return false;
+  }
+  synth_model model;
+  init_model(spec, model);
+
+  data.resize(spec.size);
+  size_t unit_size = spec.pattern == SYNTH_MIXED ? spec.block : SYNTH_UNIT_SIZE;
+  long num_units = (long)((spec.size + unit_size - 1) / unit_size);
+  #pragma omp parallel for schedule(dynamic)
+  for (long u = 0; u < num_units; u++) {
+    size_t offset = u * unit_size;
+    fill_unit(data.data() + offset, std::min(unit_size, spec.size - offset),
+              u, spec, model);
+  }
+  return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Synthetic datasets, named by a spec that can stand in for an input file:
+ *
+ *   synth:<pattern>:<size>[:<key>=<value>,...]
+ *
+ * e.g. synth:zipf:64M:s=1.2,seed=3. Sizes take K, M and G suffixes.
+ *
+ *   uniform  random bytes
+ *   zipf     bytes of rank k drawn with weight 1/k^s over n symbols
+ *   runs     runs of one symbol, of 1 to 2*run bytes, symbols as zipf
+ *   markov   text from an order 1 or 2 letter model skewed by s
+ *   mixed    blocks of block bytes, a fraction p of them uniform and the
+ *            others zipf
+ *
+ * Keys: s (default 1.0, 1.2 for markov), n (256), run (64), order (2),
+ * block (64K), p (0.5), seed (1). The bytes depend only on the spec, not on
+ * the machine or the number of threads that generate them.
+ */
+
+// Whether an input name is a synthetic spec rather than a file
+bool is_synth_spec(const std::string& name);
+
+// Generate the dataset of a spec. Returns false and says why on stderr if
+// the spec is malformed.
+bool synth_generate(const std::string& spec, std::vector<unsigned char>& data);
+
+// Comma separated names of the patterns
+const char* synth_pattern_names();
@@ -0,0 +1,396 @@
+/*
+ *  tans - Encode/Decode files using table based asymmetric numeral systems.
+ *
+ *  Shares the histogram pass and the chunked stream layout with the
+ *  parallel Huffman coder. Each chunk is coded with TANS_NUM_STATES
+ *  interleaved states to expose instruction level parallelism.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <omp.h>
+#include "util.h"
+#include "huffman.h"
+#include "worker_pool.h"
+#include "perf_counters.h"
+#include "canonical.h"
+#include "tans.h"
+#include <iostream>
+
+using std::min;
+
+/*
+ * Compressed layout:
+ *   uint8_t              codec id (CODEC_TANS)
+ *   uint64_t             number of bytes in the input
+ *   32 bytes             bitmap of the symbols present
+ *   uint16_t * n         normalized count of each present symbol
+ *   uint32_t             number of chunks
+ *   uint64_t * chunks    start offset of each chunk in the data area
+ *   data
+ * A chunk is decoded backwards from its end, starting with the final
+ * encoder states.
+ */
+
+static inline unsigned int
+highbit(uint32_t v) {
+  return 31 - __builtin_clz(v);
+}
+
+/*
+ * Bits saved by coding the count occurrences of a symbol with norm + 1
+ * slots instead of norm.
+ */
+static inline double
+slot_gain(uint64_t count, unsigned int norm) {
+  return count * log2((norm + 1.0) / norm);
+}
+
+/*
+ * tans_normalize_counts scales freqs so that they sum to TANS_TABLE_SIZE
+ * at the least cost in coded bits, as FSE does. Symbols too rare for a
+ * slot of their own get exactly one, everything else starts from its
+ * scaled count rounded down. Slots are then added where they save the
+ * most bits, or taken where they cost the least, and finally moved
+ * between symbols while that still saves bits. The cost is convex in
+ * each count, so no single move improving it means no set of moves can.
+ */
+void
+tans_normalize_counts(const uint64_t* freqs, uint16_t* norm) {
+  uint64_t total = 0;
+  for (int i = 0; i < MAX_SYMBOLS; i++)
+    total += freqs[i];
+
+  memset(norm, 0, MAX_SYMBOLS * sizeof(uint16_t));
+  if (total == 0)
+    return;
+
+  int sum = 0;
+  for (int i = 0; i < MAX_SYMBOLS; i++) {
+    if (!freqs[i])
+      continue;
+    uint64_t n = freqs[i] * TANS_TABLE_SIZE / total;
+    norm[i] = n ? (uint16_t)n : 1;
+    sum += norm[i];
+  }
+
+  // Gain of one more slot, and loss of one slot less; a symbol never drops
+  // below one slot.
+  double gain[MAX_SYMBOLS], loss[MAX_SYMBOLS];
+  for (int i = 0; i < MAX_SYMBOLS; i++) {
+    gain[i] = norm[i] ? slot_gain(freqs[i], norm[i]) : -1;
+    loss[i] = norm[i] > 1 ? slot_gain(freqs[i], norm[i] - 1) : INFINITY;
+  }
+
+  for (;;) {
+    int best = -1, cheapest = -1;
+    for (int i = 0; i < MAX_SYMBOLS; i++) {
+      if (gain[i] > (best < 0 ? 0 : gain[best]))
+        best = i;
+      if (loss[i] < (cheapest < 0 ? INFINITY : loss[cheapest]))
+        cheapest = i;
+    }
+    if (sum == TANS_TABLE_SIZE &&
+        (best < 0 || cheapest < 0 || best == cheapest ||
+         gain[best] <= loss[cheapest]))
+      break;
+    if (sum <= TANS_TABLE_SIZE) {
+      norm[best]++;
+      sum++;
+      loss[best] = gain[best];
+      gain[best] = slot_gain(freqs[best], norm[best]);
+    }
+    if (sum > TANS_TABLE_SIZE) {
+      norm[cheapest]--;
+      sum--;
+      gain[cheapest] = loss[cheapest];
+      loss[cheapest] = norm[cheapest] > 1 ?
+          slot_gain(freqs[cheapest], norm[cheapest] - 1) : INFINITY;
+    }
+  }
+}
+
+/*
+ * Spread the symbols over the states with a fixed odd step, so every
+ * symbol's slots are scattered across the whole table.
+ */
+static void
+spread_symbols(const uint16_t* norm, unsigned char* table_symbol) {
+  const unsigned int mask = TANS_TABLE_SIZE - 1;
+  const unsigned int step = (TANS_TABLE_SIZE >> 1) + (TANS_TABLE_SIZE >> 3) + 3;
+  unsigned int pos = 0;
+
+  for (int s = 0; s < MAX_SYMBOLS; s++) {
+    for (int i = 0; i < norm[s]; i++) {
+      table_symbol[pos] = (unsigned char)s;
+      pos = (pos + step) & mask;
+    }
+  }
+}
+
+void
+build_tans_encoder(const uint16_t* norm, tans_encoder* enc) {
+  unsigned char table_symbol[TANS_TABLE_SIZE];
+  unsigned int cumul[MAX_SYMBOLS + 1];
+
+  spread_symbols(norm, table_symbol);
+
+  cumul[0] = 0;
+  for (int s = 0; s < MAX_SYMBOLS; s++)
+    cumul[s + 1] = cumul[s] + norm[s];
+
+  // Encoder states live in [TANS_TABLE_SIZE, 2 * TANS_TABLE_SIZE).
+  for (unsigned int u = 0; u < TANS_TABLE_SIZE; u++) {
+    unsigned char s = table_symbol[u];
+    enc->state_table[cumul[s]++] = (uint16_t)(TANS_TABLE_SIZE + u);
+  }
+
+  unsigned int total = 0;
+  for (int s = 0; s < MAX_SYMBOLS; s++) {
+    tans_symbol_transform* tt = &enc->symbol_tt[s];
+    if (norm[s] == 0) {
+      tt->delta_nbbits = 0;
+      tt->delta_find_state = 0;
+    } else if (norm[s] == 1) {
+      tt->delta_nbbits = (TANS_TABLE_LOG << 16) - TANS_TABLE_SIZE;
+      tt->delta_find_state = (int32_t)total - 1;
+      total++;
+    } else {
+      unsigned int max_bits_out = TANS_TABLE_LOG - highbit(norm[s] - 1);
+      unsigned int min_state_plus = (unsigned int)norm[s] << max_bits_out;
+      tt->delta_nbbits = (max_bits_out << 16) - min_state_plus;
+      tt->delta_find_state = (int32_t)total - norm[s];
+      total += norm[s];
+    }
+  }
+}
+
+void
+build_tans_decoder(const uint16_t* norm, tans_decoder* dec) {
+  unsigned char table_symbol[TANS_TABLE_SIZE];
+  unsigned int next[MAX_SYMBOLS];
+
+  spread_symbols(norm, table_symbol);
+  for (int s = 0; s < MAX_SYMBOLS; s++)
+    next[s] = norm[s];
+
+  for (unsigned int u = 0; u < TANS_TABLE_SIZE; u++) {
+    unsigned char s = table_symbol[u];
+    unsigned int x = next[s]++;
+    unsigned int nbbits = TANS_TABLE_LOG - highbit(x);
+    dec->entry[u].symbol = s;
+    dec->entry[u].nbbits = (unsigned char)nbbits;
+    dec->entry[u].new_state = (uint16_t)((x << nbbits) - TANS_TABLE_SIZE);
+  }
+}
+
+static inline void
+encode_symbol(bit_writer& writer, uint32_t& state, const tans_encoder* enc,
+              unsigned char symbol) {
+  const tans_symbol_transform tt = enc->symbol_tt[symbol];
+  uint32_t nbbits = (state + tt.delta_nbbits) >> 16;
+  writer.put(state & ((1u << nbbits) - 1), nbbits);
+  state = enc->state_table[(state >> nbbits) + tt.delta_find_state];
+}
+
+/*
+ * Encode one chunk into out and return the number of bytes written. ANS is
+ * last in first out, so the chunk is coded from its end; symbol i uses
+ * state i % TANS_NUM_STATES.
+ */
+static size_t
+encode_chunk(const unsigned char* in, size_t size, const tans_encoder* enc,
+             unsigned char* out) {
+  bit_writer writer(out);
+  uint32_t state[TANS_NUM_STATES];
+  for (int k = 0; k < TANS_NUM_STATES; k++)
+    state[k] = TANS_TABLE_SIZE;
+
+  size_t i = size;
+  while (i % TANS_NUM_STATES) {
+    i--;
+    encode_symbol(writer, state[i % TANS_NUM_STATES], enc, in[i]);
+  }
+  while (i > 0) {
+    i -= TANS_NUM_STATES;
+    for (int k = TANS_NUM_STATES - 1; k >= 0; k--)
+      encode_symbol(writer, state[k], enc, in[i + k]);
+  }
+
+  for (int k = 0; k < TANS_NUM_STATES; k++)
+    writer.put(state[k] - TANS_TABLE_SIZE, TANS_TABLE_LOG);
+  // End marker so the decoder can find the last bit.
+  writer.put(1, 1);
+  return writer.flush() - out;
+}
+
+static void
+decode_chunk(const unsigned char* in, size_t in_size, const tans_decoder* dec,
+             unsigned char* out, size_t out_size) {
+  bit_reader_backward reader(in, in_size);
+  uint32_t state[TANS_NUM_STATES];
+  for (int k = TANS_NUM_STATES - 1; k >= 0; k--)
+    state[k] = reader.read(TANS_TABLE_LOG);
+  reader.reload();
+
+  // One round consumes at most TANS_NUM_STATES * TANS_TABLE_LOG bits,
+  // which always fits after a reload.
+  size_t i = 0;
+  for (; i + TANS_NUM_STATES <= out_size; i += TANS_NUM_STATES) {
+    for (int k = 0; k < TANS_NUM_STATES; k++) {
+      tans_decode_entry e = dec->entry[state[k]];
+      out[i + k] = e.symbol;
+      state[k] = e.new_state + reader.read(e.nbbits);
+    }
+    reader.reload();
+  }
+  for (; i < out_size; i++) {
+    tans_decode_entry e = dec->entry[state[i % TANS_NUM_STATES]];
+    out[i] = e.symbol;
+    state[i % TANS_NUM_STATES] = e.new_state + reader.read(e.nbbits);
+  }
+}
+
+int tans_encode_parallel(huffman_context& hctx, data_buf& in_data_buf,
+                         data_buf& out_data_buf) {
+  int num_chunks = hctx.threads_for(in_data_buf.size);
+  codec_stats& stats = hctx.begin_compress(in_data_buf.size);
+
+  uint64_t symbol_count = in_data_buf.size;
+  uint64_t histo[MAX_SYMBOLS];
+  get_symbol_counts_parallel(hctx, in_data_buf, histo);
+
+  stats.end_phase(PHASE_HISTOGRAM);
+
+  uint16_t norm[MAX_SYMBOLS];
+  tans_normalize_counts(histo, norm);
+  tans_encoder* enc = hctx.scratch<tans_encoder>(SCRATCH_TABLES, 1);
+  build_tans_encoder(norm, enc);
+
+  // The coded size is only known after coding, so each chunk is coded into
+  // scratch space bounded by TANS_TABLE_LOG bits per symbol and then
+  // copied to its offset in the output.
+  size_t in_chunk_size = UPDIV(in_data_buf.size, num_chunks);
+  size_t scratch_chunk_size =
+      UPDIV(in_chunk_size * TANS_TABLE_LOG, 8) +
+      UPDIV(TANS_NUM_STATES * TANS_TABLE_LOG + 1, 8) + sizeof(uint32_t);
+  unsigned char* scratch =
+      hctx.scratch<unsigned char>(SCRATCH_CODED, num_chunks * scratch_chunk_size);
+  uint64_t* chunk_offset =
+      hctx.scratch<uint64_t>(SCRATCH_OFFSETS, num_chunks + 1);
+
+  stats.end_phase(PHASE_TABLE);
+
+  parallel_for(hctx, num_chunks, num_chunks, [&](int tid, int) {
+    PERF_SCOPE("encode");
+    size_t i_offset = min(in_chunk_size * tid, in_data_buf.size);
+    size_t e_offset = min(i_offset + in_chunk_size, in_data_buf.size);
+    chunk_offset[tid + 1] =
+        encode_chunk(in_data_buf.data + i_offset, e_offset - i_offset, enc,
+                     scratch + tid * scratch_chunk_size);
+  });
+
+  chunk_offset[0] = 0;
+  for (int i = 0; i < num_chunks; i++)
+    chunk_offset[i + 1] += chunk_offset[i];
+
+  stats.end_phase(PHASE_CODE);
+  int present = 0;
+  unsigned char bitmap[MAX_SYMBOLS / 8] = {0};
+  for (int i = 0; i < MAX_SYMBOLS; i++) {
+    if (norm[i]) {
+      bitmap[i / 8] |= 1 << (i % 8);
+      present++;
+    }
+  }
+
+  size_t out_size = 1 + sizeof(symbol_count) + sizeof(bitmap) +
+                    present * sizeof(uint16_t) + sizeof(uint32_t) +
+                    num_chunks * sizeof(uint64_t) + chunk_offset[num_chunks];
+  out_data_buf.data = new unsigned char[out_size];
+  out_data_buf.size = out_size;
+  out_data_buf.curr_offset = 0;
+
+  unsigned char codec = CODEC_TANS;
+  out_data_buf.write_data(&codec, sizeof(codec));
+  out_data_buf.write_data(&symbol_count, sizeof(symbol_count));
+  out_data_buf.write_data(bitmap, sizeof(bitmap));
+  for (int i = 0; i < MAX_SYMBOLS; i++)
+    if (norm[i])
+      out_data_buf.write_data(&norm[i], sizeof(norm[i]));
+  uint32_t chunks = num_chunks;
+  out_data_buf.write_data(&chunks, sizeof(chunks));
+  out_data_buf.write_data(chunk_offset, num_chunks * sizeof(uint64_t));
+
+  // Coding happens before the header is written; the copy below adds to
+  // the code phase.
+  stats.end_phase(PHASE_HEADER);
+
+  unsigned char* data = out_data_buf.data + out_data_buf.curr_offset;
+  parallel_for(hctx, num_chunks, num_chunks, [&](int tid, int) {
+    memcpy(data + chunk_offset[tid], scratch + tid * scratch_chunk_size,
+           chunk_offset[tid + 1] - chunk_offset[tid]);
+  });
+
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
+
+  return 0;
+}
+
+
+int tans_decode_parallel(huffman_context& hctx, data_buf& in_data_buf,
+                         data_buf& out_data_buf) {
+  codec_stats& stats = hctx.begin_decompress(in_data_buf.size);
+
+  unsigned char codec;
+  in_data_buf.read_data(&codec, sizeof(codec));
+  assert(codec == CODEC_TANS);
+
+  uint64_t data_count;
+  in_data_buf.read_data(&data_count, sizeof(data_count));
+
+  unsigned char bitmap[MAX_SYMBOLS / 8];
+  in_data_buf.read_data(bitmap, sizeof(bitmap));
+  uint16_t norm[MAX_SYMBOLS];
+  for (int i = 0; i < MAX_SYMBOLS; i++) {
+    norm[i] = 0;
+    if (get_bit(bitmap, i))
+      in_data_buf.read_data(&norm[i], sizeof(norm[i]));
+  }
+
+  tans_decoder* dec = hctx.scratch<tans_decoder>(SCRATCH_DECODERS, 1);
+  build_tans_decoder(norm, dec);
+
+  uint32_t num_chunks;
+  in_data_buf.read_data(&num_chunks, sizeof(num_chunks));
+  uint64_t* chunk_offset =
+      hctx.scratch<uint64_t>(SCRATCH_OFFSETS, num_chunks + 1);
+  in_data_buf.read_data(chunk_offset, num_chunks * sizeof(uint64_t));
+  chunk_offset[num_chunks] = in_data_buf.size - in_data_buf.curr_offset;
+  const unsigned char* data = in_data_buf.data + in_data_buf.curr_offset;
+
+  stats.end_phase(PHASE_TABLE);
+
+  out_data_buf.data = new unsigned char[data_count];
+  out_data_buf.size = data_count;
+  out_data_buf.curr_offset = 0;
+
+  size_t o_chunk_size = UPDIV(data_count, num_chunks);
+  parallel_for(hctx, hctx.threads_for(data_count), num_chunks, [&](int chunk, int) {
+    PERF_SCOPE("decode");
+    size_t o_offset = min(o_chunk_size * chunk, (size_t)data_count);
+    size_t o_end_offset = min(o_offset + o_chunk_size, (size_t)data_count);
+    decode_chunk(data + chunk_offset[chunk],
+                 chunk_offset[chunk + 1] - chunk_offset[chunk], dec,
+                 out_data_buf.data + o_offset, o_end_offset - o_offset);
+  });
+
+  stats.end_phase(PHASE_CODE);
+  hctx.end_stats(stats, out_data_buf.size);
+
+  return 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "huffman.h"
+
+// Number of states of the tANS automaton is 1 << TANS_TABLE_LOG.
+#define TANS_TABLE_LOG 12
+#define TANS_TABLE_SIZE (1 << TANS_TABLE_LOG)
+
+// Number of interleaved states per chunk. Consecutive symbols use
+// different states, so their table lookups do not depend on each other.
+#define TANS_NUM_STATES 4
+
+typedef struct tans_symbol_transform_tag {
+  int32_t delta_find_state;
+  uint32_t delta_nbbits;
+} tans_symbol_transform;
+
+typedef struct tans_encoder_tag {
+  uint16_t state_table[TANS_TABLE_SIZE];
+  tans_symbol_transform symbol_tt[MAX_SYMBOLS];
+} tans_encoder;
+
+typedef struct tans_decode_entry_tag {
+  uint16_t new_state;
+  unsigned char symbol;
+  unsigned char nbbits;
+} tans_decode_entry;
+
+typedef struct tans_decoder_tag {
+  tans_decode_entry entry[TANS_TABLE_SIZE];
+} tans_decoder;
+
+// Reads a bit stream written LSB first by bit_writer, starting from its last
+// bit and going backwards. The writer terminates the stream with a 1 bit so
+// the reader can find where the data ends.
+struct bit_reader_backward {
+  bit_reader_backward(const unsigned char* in, size_t size) {
+    if (size >= sizeof(acc)) {
+      start = in;
+      ptr = in + size - sizeof(acc);
+    } else {
+      // Short stream: right-align it in a zero padded word.
+      memset(pad, 0, sizeof(pad));
+      memcpy(pad + sizeof(pad) - size, in, size);
+      start = ptr = pad;
+    }
+    memcpy(&acc, ptr, sizeof(acc));
+    unsigned char last = size ? in[size - 1] : 1;
+    consumed = __builtin_clz(last) - 24 + 1;
+  }
+
+  inline uint32_t read(unsigned int n) {
+    uint32_t value = (uint32_t)((acc << consumed) >> 1 >> (63 - n));
+    consumed += n;
+    return value;
+  }
+
+  // Move back over the bytes that have been fully consumed.
+  inline void reload() {
+    size_t nbytes = consumed >> 3;
+    if ((size_t)(ptr - start) < nbytes)
+      nbytes = ptr - start;
+    ptr -= nbytes;
+    consumed -= nbytes * 8;
+    memcpy(&acc, ptr, sizeof(acc));
+  }
+
+  const unsigned char* start;
+  const unsigned char* ptr;
+  uint64_t acc;
+  unsigned int consumed;
+  unsigned char pad[sizeof(uint64_t)];
+};
+
+void
+tans_normalize_counts(const uint64_t* freqs, uint16_t* norm);
+
+void
+build_tans_encoder(const uint16_t* norm, tans_encoder* enc);
+
+void
+build_tans_decoder(const uint16_t* norm, tans_decoder* dec);
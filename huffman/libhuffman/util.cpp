@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 #include <iostream>
 #include "util.h"
 
@@ -49,34 +50,30 @@ reverse_bits(unsigned char *bits, unsigned long numbits) {
 
 /*
  * new_code builds a huffman_code from a leaf in
- * a Huffman tree.
+ * a Huffman tree. The code and its bits are
+ * allocated from arena.
  */
 huffman_code *
-new_code(const huffman_node *leaf) {
+new_code(huffman_arena *arena, const huffman_node *leaf) {
   /* Build the libhuffman code by walking up to
    * the root node and then reversing the bits,
    * since the Huffman code is calculated by
    * walking down the tree. */
   unsigned long numbits = 0;
-  unsigned char *bits = NULL;
   huffman_code *p;
 
+  assert(arena->num_codes < MAX_SYMBOLS);
+  unsigned char *bits = arena->code_bits[arena->num_codes];
+  memset(bits, 0, MAX_CODE_BYTES);
+
   while (leaf && leaf->parent) {
     huffman_node *parent = leaf->parent;
     unsigned char cur_bit = (unsigned char) (numbits % 8);
     unsigned long cur_byte = numbits / 8;
 
-    /* If we need another byte to hold the code,
-       then allocate it. */
-    if (cur_bit == 0) {
-      size_t newSize = cur_byte + 1;
-      bits = (unsigned char *) realloc(bits, newSize);
-      bits[newSize - 1] = 0; /* Initialize the new byte. */
-    }
-
     /* If a one must be added then or it in. If a zero
-     * must be added then do nothing, since the byte
-     * was initialized to zero. */
+     * must be added then do nothing, since the bytes
+     * were initialized to zero. */
     if (leaf == parent->one)
       bits[cur_byte] |= 1 << cur_bit;
 
@@ -84,18 +81,19 @@ new_code(const huffman_node *leaf) {
     leaf = parent;
   }
 
-  if (bits)
+  if (numbits)
     reverse_bits(bits, numbits);
 
-  p = (huffman_code *) malloc(sizeof(huffman_code));
+  p = &arena->codes[arena->num_codes++];
   p->numbits = numbits;
   p->bits = bits;
   return p;
 }
 
 huffman_node *
-new_leaf_node(unsigned char symbol) {
-  huffman_node *p = (huffman_node *) malloc(sizeof(huffman_node));
+new_leaf_node(huffman_arena *arena, unsigned char symbol) {
+  assert(arena->num_nodes < 2 * MAX_SYMBOLS);
+  huffman_node *p = &arena->nodes[arena->num_nodes++];
   p->isLeaf = 1;
   p->symbol = symbol;
   p->count = 0;
@@ -104,8 +102,10 @@ new_leaf_node(unsigned char symbol) {
 }
 
 huffman_node *
-new_nonleaf_node(unsigned long count, huffman_node *zero, huffman_node *one) {
-  huffman_node *p = (huffman_node *) malloc(sizeof(huffman_node));
+new_nonleaf_node(huffman_arena *arena, unsigned long count,
+                 huffman_node *zero, huffman_node *one) {
+  assert(arena->num_nodes < 2 * MAX_SYMBOLS);
+  huffman_node *p = &arena->nodes[arena->num_nodes++];
   p->isLeaf = 0;
   p->count = count;
   p->zero = zero;
@@ -115,37 +115,6 @@ new_nonleaf_node(unsigned long count, huffman_node *zero, huffman_node *one) {
   return p;
 }
 
-void
-free_huffman_tree(huffman_node *subtree) {
-  if (subtree == NULL)
-    return;
-
-  if (!subtree->isLeaf) {
-    free_huffman_tree(subtree->zero);
-    free_huffman_tree(subtree->one);
-  }
-
-  free(subtree);
-}
-
-void
-free_code(huffman_code *p) {
-  free(p->bits);
-  free(p);
-}
-
-void
-free_encoder(SymbolEncoder *pSE) {
-  unsigned long i;
-  for (i = 0; i < MAX_SYMBOLS; ++i) {
-    huffman_code *p = (*pSE)[i];
-    if (p)
-      free_code(p);
-  }
-
-  free(pSE);
-}
-
 void
 init_frequencies(SymbolFrequencies *pSF) {
   memset(*pSF, 0, sizeof(SymbolFrequencies));
@@ -191,15 +160,16 @@ SFComp(const void *p1, const void *p2) {
  * for each leaf, determines its code.
  */
 void
-build_symbol_encoder(huffman_node *subtree, SymbolEncoder *pSF) {
+build_symbol_encoder(huffman_arena *arena, huffman_node *subtree,
+                     SymbolEncoder *pSF) {
   if (subtree == NULL)
     return;
 
   if (subtree->isLeaf)
-    (*pSF)[subtree->symbol] = new_code(subtree);
+    (*pSF)[subtree->symbol] = new_code(arena, subtree);
   else {
-    build_symbol_encoder(subtree->zero, pSF);
-    build_symbol_encoder(subtree->one, pSF);
+    build_symbol_encoder(arena, subtree->zero, pSF);
+    build_symbol_encoder(arena, subtree->one, pSF);
   }
 }
 
@@ -210,7 +180,7 @@ build_symbol_encoder(huffman_node *subtree, SymbolEncoder *pSF) {
  * which is an array of libhuffman codes index by symbol value.
  */
 SymbolEncoder *
-calculate_huffman_codes(SymbolFrequencies *pSF) {
+calculate_huffman_codes(huffman_arena *arena, SymbolFrequencies *pSF) {
   auto endTime1 = CycleTimer::currentSeconds();
 
   unsigned int i = 0;
@@ -241,7 +211,7 @@ calculate_huffman_codes(SymbolFrequencies *pSF) {
    * Note that this implementation uses a simple
    * count instead of probability.
    */
-  for (i = 0; i < n - 1; ++i) {
+  for (i = 0; i + 1 < n; ++i) {
     /* Set m1 and m2 to the two subsets of least probability. */
     m1 = (*pSF)[0];
     m2 = (*pSF)[1];
@@ -249,7 +219,7 @@ calculate_huffman_codes(SymbolFrequencies *pSF) {
     /* Replace m1 and m2 with a set {m1, m2} whose probability
      * is the sum of that of m1 and m2. */
     (*pSF)[0] = m1->parent = m2->parent =
-        new_nonleaf_node(m1->count + m2->count, m1, m2);
+        new_nonleaf_node(arena, m1->count + m2->count, m1, m2);
     (*pSF)[1] = NULL;
 
     /* Put newSet into the correct count position in pSF. */
@@ -260,11 +230,34 @@ calculate_huffman_codes(SymbolFrequencies *pSF) {
 //  std::cout << "Build Tree Elapse time = " << endTime2 - endTime1 << std::endl;
 
   /* Build the SymbolEncoder array from the tree. */
-  pSE = (SymbolEncoder *) malloc(sizeof(SymbolEncoder));
+  pSE = &arena->encoder;
   memset(pSE, 0, sizeof(SymbolEncoder));
-  build_symbol_encoder((*pSF)[0], pSE);
+  build_symbol_encoder(arena, (*pSF)[0], pSE);
 
   auto endTime3 = CycleTimer::currentSeconds();
 //  std::cout << "Construct Code Elapse time = " << endTime3 - endTime2 << std::endl;
   return pSE;
-}
\ No newline at end of file
+}
+
+/*
+ * histogram_entropy returns the order-0 entropy of a histogram in bits per
+ * symbol. It is a lower bound on the size a Huffman code can reach, so a
+ * value close to 8 means coding the symbols cannot save anything.
+ */
+double
+histogram_entropy(const uint64_t* histo) {
+  uint64_t total = 0;
+  for (int i = 0; i < MAX_SYMBOLS; ++i)
+    total += histo[i];
+  if (total == 0)
+    return 0;
+
+  double entropy = 0;
+  for (int i = 0; i < MAX_SYMBOLS; ++i) {
+    if (!histo[i])
+      continue;
+    double p = (double)histo[i] / total;
+    entropy -= p * log2(p);
+  }
+  return entropy;
+}
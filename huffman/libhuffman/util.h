@@ -15,22 +15,14 @@ void
 reverse_bits(unsigned char *bits, unsigned long numbits);
 
 huffman_code *
-new_code(const huffman_node *leaf);
+new_code(huffman_arena *arena, const huffman_node *leaf);
 
 huffman_node *
-new_leaf_node(unsigned char symbol);
+new_leaf_node(huffman_arena *arena, unsigned char symbol);
 
 huffman_node *
-new_nonleaf_node(unsigned long count, huffman_node *zero, huffman_node *one);
-
-void
-free_huffman_tree(huffman_node *subtree);
-
-void
-free_code(huffman_code *p);
-
-void
-free_encoder(SymbolEncoder *pSE);
+new_nonleaf_node(huffman_arena *arena, unsigned long count,
+                 huffman_node *zero, huffman_node *one);
 
 void
 init_frequencies(SymbolFrequencies *pSF);
@@ -39,9 +31,14 @@ int
 SFComp(const void *p1, const void *p2);
 
 void
-build_symbol_encoder(huffman_node *subtree, SymbolEncoder *pSF);
+build_symbol_encoder(huffman_arena *arena, huffman_node *subtree,
+                     SymbolEncoder *pSF);
 
 SymbolEncoder *
-calculate_huffman_codes(SymbolFrequencies *pSF);
+calculate_huffman_codes(huffman_arena *arena, SymbolFrequencies *pSF);
 
+void
+get_symbol_counts_parallel(huffman_context& hctx, data_buf& buf, uint64_t* histo);
 
+double
+histogram_entropy(const uint64_t* histo);
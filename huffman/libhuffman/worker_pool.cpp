@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "worker_pool.h"
+
+using std::mutex;
+using std::unique_lock;
+
+worker_pool::worker_pool(int num_workers, bool pin) : stopping(false) {
+  unsigned int num_cpus = std::thread::hardware_concurrency();
+  for (int i = 0; i < num_workers; i++) {
+    workers.push_back(std::thread(&worker_pool::worker_main, this, i));
+#ifdef __linux__
+    if (pin && num_cpus > 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(i % num_cpus, &cpus);
+      pthread_setaffinity_np(workers.back().native_handle(),
+                             sizeof(cpus), &cpus);
+    }
+#endif
+  }
+}
+
+worker_pool::~worker_pool() {
+  {
+    unique_lock<mutex> lock(queue_mutex);
+    stopping = true;
+  }
+  work_ready.notify_all();
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+/*
+ * The next task is claimed before the current one is marked done. The owner
+ * of a job frees it once every task is done, so a thread only touches the
+ * job while it holds a task that is not done yet.
+ */
+void worker_pool::run_tasks(job* j, int task, int slot) {
+  int num_tasks = j->num_tasks;
+  while (task < num_tasks) {
+    (*j->fn)(task, slot);
+    int next = j->next.fetch_add(1);
+    if (j->done.fetch_add(1) + 1 == num_tasks) {
+      // Take the lock so the owner cannot miss the wake up.
+      unique_lock<mutex> lock(queue_mutex);
+      job_done.notify_all();
+    }
+    task = next;
+  }
+}
+
+void worker_pool::worker_main(int slot) {
+  for (;;) {
+    job* j;
+    int task;
+    {
+      unique_lock<mutex> lock(queue_mutex);
+      work_ready.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (stopping)
+        return;
+      // Claim a task under the lock so the job stays alive. A job whose
+      // tasks are all claimed leaves the queue.
+      j = jobs.front();
+      task = j->next.fetch_add(1);
+      if (task >= j->num_tasks) {
+        jobs.pop_front();
+        continue;
+      }
+    }
+    run_tasks(j, task, slot);
+  }
+}
+
+void worker_pool::run(int num_tasks, const std::function<void(int, int)>& fn) {
+  if (num_tasks <= 0)
+    return;
+
+  job j;
+  j.fn = &fn;
+  j.num_tasks = num_tasks;
+  j.next = 0;
+  j.done = 0;
+
+  if (num_tasks > 1) {
+    unique_lock<mutex> lock(queue_mutex);
+    jobs.push_back(&j);
+    lock.unlock();
+    work_ready.notify_all();
+  }
+
+  // The caller works on its own job in the last slot.
+  run_tasks(&j, j.next.fetch_add(1), num_workers());
+
+  unique_lock<mutex> lock(queue_mutex);
+  job_done.wait(lock, [&j] { return j.done.load() == j.num_tasks; });
+  // Make sure no worker still sees the job in the queue.
+  for (std::deque<job*>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+    if (*it == &j) {
+      jobs.erase(it);
+      break;
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <omp.h>
+#include "huffman.h"
+
+/*
+ * A set of worker threads started once and kept for the life of the pool,
+ * each pinned to a core. run() splits a job into tasks that the workers and
+ * the calling thread take in order; any number of threads may call run()
+ * at once, and their jobs share the workers.
+ */
+class worker_pool {
+ public:
+  worker_pool(int num_workers, bool pin = true);
+  ~worker_pool();
+
+  // Run fn(task, slot) for every task in [0, num_tasks) and return when all
+  // are done. slot is in [0, num_slots()) and no two tasks of the job run
+  // at the same time in one slot, so it can index per-thread scratch.
+  void run(int num_tasks, const std::function<void(int, int)>& fn);
+
+  int num_workers() const { return (int)workers.size(); }
+  int num_slots() const { return num_workers() + 1; }
+
+ private:
+  struct job {
+    const std::function<void(int, int)>* fn;
+    int num_tasks;
+    std::atomic<int> next;
+    std::atomic<int> done;
+  };
+
+  void worker_main(int slot);
+  // Run the claimed task of j, then claim and run more until none are left.
+  void run_tasks(job* j, int task, int slot);
+
+  std::vector<std::thread> workers;
+  std::deque<job*> jobs;
+  std::mutex queue_mutex;
+  std::condition_variable work_ready;
+  std::condition_variable job_done;
+  bool stopping;
+};
+
+/*
+ * Run fn(task, slot) for every task, on the pool of the context if it has
+ * one and on an OpenMP team of num_threads otherwise.
+ */
+template <typename F>
+void parallel_for(huffman_context& hctx, int num_threads, int num_tasks, F fn) {
+  if (hctx.pool) {
+    std::function<void(int, int)> f = [&](int task, int slot) {
+      busy_timer busy(hctx, slot);
+      fn(task, slot);
+    };
+    hctx.pool->run(num_tasks, f);
+    return;
+  }
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+  for (int i = 0; i < num_tasks; i++) {
+    int slot = omp_get_thread_num();
+    busy_timer busy(hctx, slot);
+    fn(i, slot);
+  }
+}
+
+// Number of slots parallel_for may pass to fn.
+inline int parallel_slots(const huffman_context& hctx, int num_threads) {
+  return hctx.pool ? hctx.pool->num_slots() : num_threads;
+}
@@ -0,0 +1,264 @@
+/***************************************************************************
+*                  Bit Stream Reader and Writer over Memory
+*
+*   File    : bitstream.h
+*   Purpose : Inline replacements for the bitfile calls in the LZSS
+*             encoder and decoder.  Bits are gathered in a 64 bit
+*             accumulator and moved to or from memory 32 or 64 bits at a
+*             time instead of one stdio call per byte.
+*
+*             The stream is the one bitfile writes: bits are packed MSB
+*             first, the last byte is padded with zeros, and the *Num calls
+*             write an integer in the order BitFilePutBitsNum uses on a
+*             little endian machine (low byte first, then the remaining
+*             high bits).
+*
+***************************************************************************/
+#ifndef _BITSTREAM_H_
+#define _BITSTREAM_H_
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/***************************************************************************
+*                                 MACROS
+***************************************************************************/
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define BitStreamBE32(x)    __builtin_bswap32(x)
+#define BitStreamBE64(x)    __builtin_bswap64(x)
+#else
+#define BitStreamBE32(x)    (x)
+#define BitStreamBE64(x)    (x)
+#endif
+
+/***************************************************************************
+*                                 CLASSES
+***************************************************************************/
+
+/***************************************************************************
+* BitWriter appends to a vector.  PutBits takes up to 32 bits at a time.
+* Flush must be called once at the end; it pads the last byte and trims
+* the vector to the bytes written.
+***************************************************************************/
+class BitWriter
+{
+public:
+    BitWriter(std::vector<uint8_t> &out) :
+        out_(out), pos_(out.size()), acc_(0), count_(0)
+    {
+    }
+
+    inline void PutBits(uint32_t bits, unsigned int count)
+    {
+        /* count_ < 32 between calls, so the accumulator never overflows */
+        acc_ = (acc_ << count) | bits;
+        count_ += count;
+
+        if (count_ >= 32)
+        {
+            uint32_t word;
+
+            count_ -= 32;
+            word = BitStreamBE32((uint32_t)(acc_ >> count_));
+            Reserve(sizeof(word));
+            memcpy(&out_[pos_], &word, sizeof(word));
+            pos_ += sizeof(word);
+        }
+    }
+
+    inline void PutBit(int bit)
+    {
+        PutBits(bit != 0, 1);
+    }
+
+    inline void PutChar(int c)
+    {
+        PutBits((uint8_t)c, 8);
+    }
+
+    /* bitfile's little endian BitFilePutBitsNum order */
+    inline void PutBitsNum(uint32_t bits, unsigned int count)
+    {
+        while (count >= 8)
+        {
+            PutBits(bits & 0xFF, 8);
+            bits >>= 8;
+            count -= 8;
+        }
+
+        if (count != 0)
+        {
+            PutBits(bits & ((1u << count) - 1), count);
+        }
+    }
+
+    void Flush(void)
+    {
+        /* whole bytes left in the accumulator, then the padded last one */
+        Reserve(5);
+
+        while (count_ >= 8)
+        {
+            count_ -= 8;
+            out_[pos_++] = (uint8_t)(acc_ >> count_);
+        }
+
+        if (count_ != 0)
+        {
+            out_[pos_++] = (uint8_t)(acc_ << (8 - count_));
+            count_ = 0;
+        }
+
+        out_.resize(pos_);
+    }
+
+    /* bytes written so far, not counting bits still in the accumulator */
+    size_t Size(void) const
+    {
+        return pos_;
+    }
+
+private:
+    inline void Reserve(size_t bytes)
+    {
+        if (pos_ + bytes > out_.size())
+        {
+            out_.resize((out_.size() + bytes) * 2);
+        }
+    }
+
+    std::vector<uint8_t> &out_;
+    size_t pos_;
+    uint64_t acc_;
+    unsigned int count_;
+};
+
+/***************************************************************************
+* BitReader reads from a flat buffer.  The Get calls return EOF, like their
+* bitfile counterparts, once fewer bits are left than asked for.
+***************************************************************************/
+class BitReader
+{
+public:
+    BitReader(const uint8_t *data, size_t size) :
+        data_(data), size_(size), pos_(0), acc_(0), count_(0)
+    {
+    }
+
+    /* up to 32 bits */
+    inline int GetBits(uint32_t *bits, unsigned int count)
+    {
+        if (count_ < count)
+        {
+            Refill();
+
+            if (count_ < count)
+            {
+                return EOF;
+            }
+        }
+
+        count_ -= count;
+        *bits = (uint32_t)(acc_ >> count_) & (uint32_t)((1ULL << count) - 1);
+        return count;
+    }
+
+    inline int GetBit(void)
+    {
+        uint32_t bit;
+
+        if (GetBits(&bit, 1) == EOF)
+        {
+            return EOF;
+        }
+
+        return bit;
+    }
+
+    inline int GetChar(void)
+    {
+        uint32_t c;
+
+        if (GetBits(&c, 8) == EOF)
+        {
+            return EOF;
+        }
+
+        return c;
+    }
+
+    /* bitfile's little endian BitFileGetBitsNum order */
+    inline int GetBitsNum(uint32_t *bits, unsigned int count)
+    {
+        uint32_t part;
+        unsigned int shift;
+
+        *bits = 0;
+
+        for (shift = 0; shift + 8 <= count; shift += 8)
+        {
+            if (GetBits(&part, 8) == EOF)
+            {
+                return EOF;
+            }
+
+            *bits |= part << shift;
+        }
+
+        if (shift < count)
+        {
+            if (GetBits(&part, count - shift) == EOF)
+            {
+                return EOF;
+            }
+
+            *bits |= part << shift;
+        }
+
+        return count;
+    }
+
+private:
+    /* top up the accumulator with as many whole bytes as fit */
+    inline void Refill(void)
+    {
+        unsigned int take = (63 - count_) >> 3;
+
+        if (take == 0)
+        {
+            return;
+        }
+
+        if (pos_ + sizeof(uint64_t) <= size_)
+        {
+            uint64_t word;
+
+            memcpy(&word, data_ + pos_, sizeof(word));
+            word = BitStreamBE64(word);
+            acc_ = (acc_ << (8 * take)) | (word >> (64 - 8 * take));
+            count_ += 8 * take;
+            pos_ += take;
+            return;
+        }
+
+        while (take > 0 && pos_ < size_)
+        {
+            acc_ = (acc_ << 8) | data_[pos_++];
+            count_ += 8;
+            take--;
+        }
+    }
+
+    const uint8_t *data_;
+    size_t size_;
+    size_t pos_;
+    uint64_t acc_;
+    unsigned int count_;
+};
+
+#endif      /* ndef _BITSTREAM_H_ */
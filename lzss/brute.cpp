@@ -36,13 +36,6 @@
 ***************************************************************************/
 #include "lzlocal.h"
 
-/***************************************************************************
-*                            GLOBAL VARIABLES
-***************************************************************************/
-/* cyclic buffer sliding window of already read characters */
-extern unsigned char slidingWindow[];
-extern unsigned char uncodedLookahead[];
-
 /***************************************************************************
 *                                FUNCTIONS
 ***************************************************************************/
@@ -53,13 +46,15 @@ extern unsigned char uncodedLookahead[];
 *                process of mathcing uncoded strings to strings in the
 *                sliding window.  The brute force search doesn't use any
 *                special structures, so this function doesn't do anything.
-*   Parameters : None
+*   Parameters : ctx - not used
 *   Effects    : None
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
-int InitializeSearchStructures(void)
+template <class F>
+static int InitializeSearchStructures(lzss_context_t *ctx)
 {
+    (void)ctx;              /* prevents unused variable warning */
     return 0;
 }
 
@@ -68,16 +63,20 @@ int InitializeSearchStructures(void)
 *   Description: This function will search through the slidingWindow
 *                dictionary for the longest sequence matching the MAX_CODED
 *                long string stored in uncodedLookahed.
-*   Parameters : windowHead - head of sliding window
+*   Parameters : ctx - the encoder context
+*                windowHead - head of sliding window
 *                uncodedHead - head of uncoded lookahead buffer
 *   Effects    : None
 *   Returned   : The sliding window index where the match starts and the
 *                length of the match.  If there is no match a length of
 *                zero will be returned.
 ****************************************************************************/
-encoded_string_t FindMatch(const unsigned int windowHead,
-    unsigned int uncodedHead)
+template <class F>
+static encoded_string_t FindMatch(lzss_context_t *ctx,
+    const unsigned int windowHead, unsigned int uncodedHead)
 {
+    const unsigned char *slidingWindow = ctx->slidingWindow;
+    const unsigned char *uncoded = ctx->uncodedLookahead + uncodedHead;
     encoded_string_t matchData;
     unsigned int i;
     unsigned int j;
@@ -89,20 +88,10 @@ encoded_string_t FindMatch(const unsigned int windowHead,
 
     while (1)
     {
-        if (slidingWindow[i] == uncodedLookahead[uncodedHead])
+        if (slidingWindow[i] == uncoded[0])
         {
             /* we matched one. how many more match? */
-            j = 1;
-
-            while(slidingWindow[Wrap((i + j), WINDOW_SIZE)] ==
-                uncodedLookahead[Wrap((uncodedHead + j), MAX_CODED)])
-            {
-                if (j >= MAX_CODED)
-                {
-                    break;
-                }
-                j++;
-            }
+            j = MatchLength(slidingWindow + i, uncoded, F::MAX_CODED);
 
             if (j > matchData.length)
             {
@@ -111,13 +100,13 @@ encoded_string_t FindMatch(const unsigned int windowHead,
             }
         }
 
-        if (j >= MAX_CODED)
+        if (j >= F::MAX_CODED)
         {
-            matchData.length = MAX_CODED;
+            matchData.length = F::MAX_CODED;
             break;
         }
 
-        i = Wrap((i + 1), WINDOW_SIZE);
+        i = Wrap((i + 1), F::WINDOW_SIZE);
         if (i == windowHead)
         {
             /* we wrapped around */
@@ -133,14 +122,38 @@ encoded_string_t FindMatch(const unsigned int windowHead,
 *   Description: This function replaces the character stored in
 *                slidingWindow[charIndex] with the one specified by
 *                replacement.
-*   Parameters : charIndex - sliding window index of the character to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
 *                            removed from the linked list.
+*                replacement - new character
 *   Effects    : slidingWindow[charIndex] is replaced by replacement.
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
-int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
+template <class F>
+static int ReplaceChar(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned char replacement)
 {
-    slidingWindow[charIndex] = replacement;
+    SetWindowChar<F>(ctx, charIndex, replacement);
     return 0;
 }
+
+/***************************************************************************
+*                              MATCH FINDER
+***************************************************************************/
+/* the brute finder built for one format */
+#define BRUTE_FINDER(offsetBits, lengthBits) \
+    { \
+        "brute", \
+        0,                      /* no search structures */ \
+        InitializeSearchStructures< \
+            format_traits_t<offsetBits, lengthBits> >, \
+        ReplaceChar<format_traits_t<offsetBits, lengthBits> >, \
+        FindMatch<format_traits_t<offsetBits, lengthBits> >, \
+        NULL                    /* nothing to free */ \
+    },
+
+const match_finder_t bruteFinder[] =
+{
+    LZSS_FORMATS(BRUTE_FINDER)
+};
@@ -0,0 +1,362 @@
+/***************************************************************************
+*          Lempel, Ziv, Storer, and Szymanski Encoding and Decoding
+*
+*   File    : chain.cpp
+*   Purpose : Implement hash chain matching of uncoded strings for the LZSS
+*             algorithm, in the style of gzip and zstd.  The hash is a
+*             multiplicative hash of the last four bytes written, rolled one
+*             byte at a time, and the search of each chain is cut short by
+*             the compression level.
+*
+*             Positions are counted from the start of the encode rather
+*             than kept as window indices, so strings that have slid out of
+*             the window are recognized by their age and are never removed
+*             from the chains.  The newest positions of each hash are kept
+*             in a bucket that fills one cache line; older ones are reached
+*             through prev[].
+*
+***************************************************************************/
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include "lzlocal.h"
+
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+#define CHAIN_KEY_SIZE  4           /* bytes hashed for each string */
+#define BUCKET_WAYS     16          /* positions in one 64 byte bucket */
+
+/* position counts are rebased before they reach this */
+#define REBASE_POSITION 0x80000000u
+
+/* of the format F the function using them is built for */
+#define BUCKET_BITS     ((F::OFFSET_BITS < 18) ? (F::OFFSET_BITS - 2) : 16)
+#define BUCKETS         (1u << BUCKET_BITS)
+
+/* the first position in the window; every position below it is empty */
+#define FIRST_POSITION  (2u * F::WINDOW_SIZE)
+
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+
+/***************************************************************************
+* The newest positions of strings with one hash, newest first.  Older
+* positions have slid out or are 0.
+***************************************************************************/
+typedef struct alignas(64) chain_bucket_t
+{
+    uint32_t position[BUCKET_WAYS];
+} chain_bucket_t;
+
+/***************************************************************************
+* The search structures kept in an encoder's context.  prev[p % WINDOW_SIZE]
+* is the position with the same hash as p that came before it.  position is
+* that of the next character written to the window, and key holds the four
+* characters before it, the oldest in the high byte.
+***************************************************************************/
+template <class F>
+struct chain_state_t
+{
+    chain_bucket_t buckets[BUCKETS];
+    uint32_t prev[F::WINDOW_SIZE];
+    uint32_t position;
+    uint32_t key;
+};
+
+/***************************************************************************
+*                                 MACROS
+***************************************************************************/
+/* chain search structures of a context */
+#define ChainState(ctx)     ((chain_state_t<F> *)((ctx)->finderState))
+
+/***************************************************************************
+*                               PROTOTYPES
+***************************************************************************/
+
+/***************************************************************************
+*                                FUNCTIONS
+***************************************************************************/
+
+/****************************************************************************
+*   Function   : ChainHash
+*   Description: This function returns the bucket of a key by Fibonacci
+*                hashing: the key is multiplied by 2^32 divided by the
+*                golden ratio and the top bits of the product are used.
+*   Parameters : key - four characters, the first in the high byte
+*   Effects    : NONE
+*   Returned   : The index of the key's bucket.
+****************************************************************************/
+template <class F>
+static inline unsigned int ChainHash(const uint32_t key)
+{
+    return (uint32_t)(key * 2654435761u) >> (32 - BUCKET_BITS);
+}
+
+/****************************************************************************
+*   Function   : AddPosition
+*   Description: This function makes a position the newest in the chain
+*                of its key.
+*   Parameters : state - the chain search structures
+*                position - the position of the string to add
+*                key - the first four characters of the string
+*   Effects    : position is at the front of its bucket and prev[] links it
+*                to the position it displaced.
+*   Returned   : NONE
+****************************************************************************/
+template <class F>
+static inline void AddPosition(chain_state_t<F> *state,
+    const uint32_t position, const uint32_t key)
+{
+    uint32_t *bucket = state->buckets[ChainHash<F>(key)].position;
+
+    state->prev[position & (F::WINDOW_SIZE - 1)] = bucket[0];
+    memmove(bucket + 1, bucket, (BUCKET_WAYS - 1) * sizeof(uint32_t));
+    bucket[0] = position;
+}
+
+/****************************************************************************
+*   Function   : Rebase
+*   Description: This function moves every position back by a multiple of
+*                the window size, so the next one written is within a
+*                window of FIRST_POSITION again.  Positions that are no
+*                longer in the window stay too old to be matched.
+*   Parameters : state - the chain search structures
+*   Effects    : Every position in state is reduced by the same amount.
+*   Returned   : NONE
+****************************************************************************/
+template <class F>
+static void Rebase(chain_state_t<F> *state)
+{
+    const uint32_t shift = (state->position & ~(F::WINDOW_SIZE - 1)) -
+        FIRST_POSITION;
+    unsigned int i, j;
+
+    for (i = 0; i < BUCKETS; i++)
+    {
+        uint32_t *bucket = state->buckets[i].position;
+
+        for (j = 0; j < BUCKET_WAYS; j++)
+        {
+            bucket[j] = (bucket[j] > shift) ? bucket[j] - shift : 0;
+        }
+    }
+
+    for (i = 0; i < F::WINDOW_SIZE; i++)
+    {
+        state->prev[i] =
+            (state->prev[i] > shift) ? state->prev[i] - shift : 0;
+    }
+
+    state->position -= shift;
+}
+
+/****************************************************************************
+*   Function   : InitializeSearchStructures
+*   Description: This function initializes structures used to speed up the
+*                process of matching uncoded strings to strings in the
+*                sliding window.  The buckets are emptied and the strings
+*                of the initial window are added to them.
+*   Parameters : ctx - the encoder context
+*   Effects    : The buckets hold the strings that are entirely in the
+*                initial window and the position count starts over.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+*
+*   NOTE: This function assumes that the sliding window is initially filled
+*         with all identical characters.
+****************************************************************************/
+template <class F>
+static int InitializeSearchStructures(lzss_context_t *ctx)
+{
+    chain_state_t<F> *state = ChainState(ctx);
+    uint32_t key;
+    unsigned int i;
+
+    memset(state->buckets, 0, sizeof(state->buckets));
+
+    key = 0;
+
+    for (i = 0; i < CHAIN_KEY_SIZE; i++)
+    {
+        key = (key << 8) | ctx->slidingWindow[0];
+    }
+
+    /* window index 0 is at FIRST_POSITION - WINDOW_SIZE */
+    for (i = 0; i <= F::WINDOW_SIZE - CHAIN_KEY_SIZE; i++)
+    {
+        AddPosition<F>(state, FIRST_POSITION - F::WINDOW_SIZE + i, key);
+    }
+
+    state->position = FIRST_POSITION;
+    state->key = key;
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : FindMatch
+*   Description: This function will search the chain of the hash of the
+*                first four characters in the uncoded lookahead for the
+*                longest string matching it.  The search stops after the
+*                number of candidates allowed by the compression level, or
+*                at a match of the level's nice length.
+*   Parameters : ctx - the encoder context
+*                windowHead - not used
+*                uncodedHead - head of uncoded lookahead buffer
+*   Effects    : NONE
+*   Returned   : The sliding window index where the match starts and the
+*                length of the match.  If there is no match a length of
+*                zero will be returned.
+****************************************************************************/
+template <class F>
+static encoded_string_t FindMatch(lzss_context_t *ctx,
+    const unsigned int windowHead, const unsigned int uncodedHead)
+{
+    const chain_state_t<F> *state = ChainState(ctx);
+    const unsigned char *slidingWindow = ctx->slidingWindow;
+    const unsigned char *uncoded = ctx->uncodedLookahead + uncodedHead;
+    const uint32_t oldest = state->position - F::WINDOW_SIZE;
+    const uint32_t *bucket;
+    encoded_string_t matchData;
+    unsigned int chainLeft;
+    unsigned int niceLength;
+    uint32_t key;
+    uint32_t position;
+    unsigned int i;
+    unsigned int j;
+
+    (void)windowHead;       /* prevents unused variable warning */
+    matchData.length = 0;
+    matchData.offset = 0;
+
+    chainLeft = ctx->config->maxChain;
+    niceLength = ctx->config->niceLength;
+
+    if (niceLength > (unsigned int)F::MAX_CODED)
+    {
+        niceLength = F::MAX_CODED;
+    }
+
+    key = 0;
+
+    for (i = 0; i < CHAIN_KEY_SIZE; i++)
+    {
+        key = (key << 8) | uncoded[i];
+    }
+
+    /* the newest candidates share a cache line */
+    bucket = state->buckets[ChainHash<F>(key)].position;
+    position = 0;
+
+    for (i = 0; (i < BUCKET_WAYS) && (chainLeft > 0); i++, chainLeft--)
+    {
+        position = bucket[i];
+
+        if (position < oldest)
+        {
+            return matchData;       /* the rest are older */
+        }
+
+        j = MatchLength(slidingWindow + (position & (F::WINDOW_SIZE - 1)),
+            uncoded, F::MAX_CODED);
+
+        if (j > matchData.length)
+        {
+            matchData.length = j;
+            matchData.offset = position & (F::WINDOW_SIZE - 1);
+
+            if (j >= niceLength)
+            {
+                return matchData;
+            }
+        }
+    }
+
+    /* then the older ones, one link at a time */
+    while (chainLeft > 0)
+    {
+        position = state->prev[position & (F::WINDOW_SIZE - 1)];
+
+        if (position < oldest)
+        {
+            break;
+        }
+
+        j = MatchLength(slidingWindow + (position & (F::WINDOW_SIZE - 1)),
+            uncoded, F::MAX_CODED);
+
+        if (j > matchData.length)
+        {
+            matchData.length = j;
+            matchData.offset = position & (F::WINDOW_SIZE - 1);
+
+            if (j >= niceLength)
+            {
+                break;
+            }
+        }
+
+        chainLeft--;
+    }
+
+    return matchData;
+}
+
+/****************************************************************************
+*   Function   : ReplaceChar
+*   Description: This function replaces the character stored in
+*                slidingWindow[charIndex] with the one specified by
+*                replacement.  Characters are replaced in window order, so
+*                replacement completes the four character string starting
+*                three characters before it, which is added to its chain.
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
+*                            replaced.
+*                replacement - new character
+*   Effects    : slidingWindow[charIndex] is replaced by replacement and the
+*                string it completes is added to the chains.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+template <class F>
+static int ReplaceChar(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned char replacement)
+{
+    chain_state_t<F> *state = ChainState(ctx);
+
+    SetWindowChar<F>(ctx, charIndex, replacement);
+
+    if (state->position >= REBASE_POSITION)
+    {
+        Rebase<F>(state);
+    }
+
+    state->key = (state->key << 8) | replacement;
+    state->position++;
+    AddPosition<F>(state, state->position - CHAIN_KEY_SIZE, state->key);
+
+    return 0;
+}
+
+/***************************************************************************
+*                              MATCH FINDER
+***************************************************************************/
+/* the chain finder built for one format */
+#define CHAIN_FINDER(offsetBits, lengthBits) \
+    { \
+        "chain", \
+        sizeof(chain_state_t<format_traits_t<offsetBits, lengthBits> >), \
+        InitializeSearchStructures< \
+            format_traits_t<offsetBits, lengthBits> >, \
+        ReplaceChar<format_traits_t<offsetBits, lengthBits> >, \
+        FindMatch<format_traits_t<offsetBits, lengthBits> >, \
+        NULL                    /* nothing to free */ \
+    },
+
+const match_finder_t chainFinder[] =
+{
+    LZSS_FORMATS(CHAIN_FINDER)
+};
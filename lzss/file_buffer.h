@@ -1,42 +1,68 @@
 #pragma once
 
 #include <stdio.h>
+#include <vector>
 
-#define BUFFER_SIZE 40960000
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
+/* Block size FileMap reads streams that can't be mapped in */
+#define READ_BLOCK_SIZE (1 << 20)
 
-
-class FileBuffer {
+// The rest of a file from its current position as one flat array. Regular
+// files are mapped; pipes and memory streams are read in blocks. The file
+// is left at its end, as if it had been read.
+class FileMap {
 public:
-    FileBuffer(FILE* file) {
-        file_ = file;
-        offset_ = 0;
-        len_ = 0;
-        buffer_ = new unsigned char[BUFFER_SIZE];
-    }
-    
-    ~FileBuffer() {
-        delete[] buffer_;
-    }
-  
-    // Get one char from buffer. If buffer becomes empty, refill the buffer
-    inline int GetChar() {
-        return getc(file_);
-        // Run out of characters. Read more from
-        if (offset_ == len_) {
-            len_ = fread(buffer_, sizeof(unsigned char), BUFFER_SIZE, file_);
-            offset_ = 0;
-            if (len_ == 0) {
-                // Reach the end of file;
-                return EOF;
+    FileMap(FILE* file) : data_(NULL), size_(0), map_(NULL), mapLen_(0) {
+#ifdef __linux__
+        struct stat sbuf;
+        long start = ftell(file);
+        int fd = fileno(file);
+        if (start >= 0 && fd >= 0 && fstat(fd, &sbuf) == 0 &&
+            S_ISREG(sbuf.st_mode) && sbuf.st_size > start) {
+            void* map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, sbuf.st_size, MADV_SEQUENTIAL);
+                map_ = map;
+                mapLen_ = sbuf.st_size;
+                data_ = (const unsigned char*)map + start;
+                size_ = sbuf.st_size - start;
+                fseek(file, 0, SEEK_END);
+                return;
             }
         }
-        return buffer_[offset_++];
+#endif
+        size_t n;
+        do {
+            size_t old = blocks_.size();
+            blocks_.resize(old + READ_BLOCK_SIZE);
+            n = fread(&blocks_[old], 1, READ_BLOCK_SIZE, file);
+            blocks_.resize(old + n);
+        } while (n == READ_BLOCK_SIZE);
+        data_ = blocks_.data();
+        size_ = blocks_.size();
+    }
+
+    ~FileMap() {
+#ifdef __linux__
+        if (map_)
+            munmap(map_, mapLen_);
+#endif
     }
-  
+
+    const unsigned char* Data() const { return data_; }
+    size_t Size() const { return size_; }
+
 private:
-    FILE* file_;
-    unsigned char* buffer_;
-    unsigned int offset_;
-    unsigned int len_;
-};
\ No newline at end of file
+    FileMap(const FileMap&);
+    FileMap& operator=(const FileMap&);
+
+    const unsigned char* data_;
+    size_t size_;
+    void* map_;
+    size_t mapLen_;
+    std::vector<unsigned char> blocks_;
+};
@@ -36,6 +36,14 @@
 ***************************************************************************/
 #include "lzlocal.h"
 
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+/* of the format F the function using them is built for */
+#define NULL_INDEX      (F::WINDOW_SIZE + 1)
+
+#define HASH_SIZE       (F::WINDOW_SIZE >> 2)   /* size of hash table */
+
 /***************************************************************************
 *                            TYPE DEFINITIONS
 ***************************************************************************/
@@ -46,21 +54,21 @@ typedef enum
 } hash_src_t;
 
 /***************************************************************************
-*                                CONSTANTS
+* The search structures kept in an encoder's context: the list head for
+* each hash key and the indices of the next in each hash list.
 ***************************************************************************/
-#define NULL_INDEX      (WINDOW_SIZE + 1)
-
-#define HASH_SIZE       (WINDOW_SIZE >> 2)  /* size of hash table */
+template <class F>
+struct hash_state_t
+{
+    unsigned int hashTable[HASH_SIZE];
+    unsigned int next[F::WINDOW_SIZE];
+};
 
 /***************************************************************************
-*                            GLOBAL VARIABLES
+*                                 MACROS
 ***************************************************************************/
-/* cyclic buffer sliding window of already read characters */
-extern unsigned char slidingWindow[];
-extern unsigned char uncodedLookahead[];
-
-unsigned int hashTable[HASH_SIZE];          /* list head for each hash key */
-unsigned int next[WINDOW_SIZE];             /* indices of next in hash list */
+/* hash search structures of a context */
+#define HashState(ctx)      ((hash_state_t<F> *)((ctx)->finderState))
 
 /***************************************************************************
 *                               PROTOTYPES
@@ -79,7 +87,8 @@ unsigned int next[WINDOW_SIZE];             /* indices of next in hash list */
 *                reported in K. Sadakane, H. Imai. "Improving the Speed of
 *                LZ77 Compression by Hashing and Suffix Sorting". IEICE
 *                Trans. Fundamentals, Vol. E83-A, No. 12 (December 2000)
-*   Parameters : offset - offset into either the uncoded lookahead or the
+*   Parameters : ctx - the encoder context
+*                offset - offset into either the uncoded lookahead or the
 *                         sliding window.
 *                hashSource - indicate whether offset is an offset into the
 *                             sliding window uncoded lookahead buffer.
@@ -88,21 +97,25 @@ unsigned int next[WINDOW_SIZE];             /* indices of next in hash list */
 *                length of the match.  If there is no match a length of
 *                zero will be returned.
 ****************************************************************************/
-static unsigned int HashKey(const unsigned int offset,
+template <class F>
+static unsigned int HashKey(lzss_context_t *ctx, const unsigned int offset,
     const hash_src_t hashSource)
 {
+    const unsigned char *slidingWindow = ctx->slidingWindow;
+    const unsigned char *uncodedLookahead = ctx->uncodedLookahead;
     unsigned int i;
     unsigned int hashKey;
 
     hashKey = 0;
 
+    /* offset is a buffer index, so the mirrors cover offset + i */
     if (SRC_LOOKAHEAD == hashSource)
     {
         /* string is in the lookahead buffer */
         for (i = 0; i < (MAX_UNCODED + 1); i++)
         {
             hashKey = (hashKey << 5) ^
-                uncodedLookahead[Wrap((offset + i), MAX_CODED)];
+                uncodedLookahead[offset + i];
             hashKey %= HASH_SIZE;
         }
     }
@@ -112,7 +125,7 @@ static unsigned int HashKey(const unsigned int offset,
         for (i = 0; i < (MAX_UNCODED + 1); i++)
         {
             hashKey = (hashKey << 5) ^
-                slidingWindow[Wrap((offset + i), WINDOW_SIZE)];
+                slidingWindow[offset + i];
             hashKey %= HASH_SIZE;
         }
     }
@@ -126,7 +139,7 @@ static unsigned int HashKey(const unsigned int offset,
 *                process of mathcing uncoded strings to strings in the
 *                sliding window.  For hashed searches, this means that a
 *                hash table pointing to linked lists is initialized.
-*   Parameters : None
+*   Parameters : ctx - the encoder context
 *   Effects    : The hash table and next array are initialized.
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
@@ -134,8 +147,11 @@ static unsigned int HashKey(const unsigned int offset,
 *   NOTE: This function assumes that the sliding window is initially filled
 *         with all identical characters.
 ****************************************************************************/
-int InitializeSearchStructures()
+template <class F>
+static int InitializeSearchStructures(lzss_context_t *ctx)
 {
+    unsigned int *hashTable = HashState(ctx)->hashTable;
+    unsigned int *next = HashState(ctx)->next;
     unsigned int i;
 
     /************************************************************************
@@ -143,13 +159,13 @@ int InitializeSearchStructures()
     * character, there is only one hash key for the entier sliding window.
     * That means all positions are in the same linked list.
     ************************************************************************/
-    for (i = 0; i < (WINDOW_SIZE - 1); i++)
+    for (i = 0; i < (F::WINDOW_SIZE - 1); i++)
     {
         next[i] = i + 1;
     }
 
     /* there's no next for the last character */
-    next[WINDOW_SIZE - 1] = NULL_INDEX;
+    next[F::WINDOW_SIZE - 1] = NULL_INDEX;
 
     /* the only list right now is the "   " list */
     for (i = 0; i < HASH_SIZE; i++)
@@ -157,7 +173,7 @@ int InitializeSearchStructures()
         hashTable[i] = NULL_INDEX;
     }
 
-    hashTable[HashKey(0, SRC_SLIDING_WINDOW)] = 0;
+    hashTable[HashKey<F>(ctx, 0, SRC_SLIDING_WINDOW)] = 0;
 
     return 0;
 }
@@ -167,15 +183,21 @@ int InitializeSearchStructures()
 *   Description: This function will search through the slidingWindow
 *                dictionary for the longest sequence matching the MAX_CODED
 *                long string stored in uncodedLookahead.
-*   Parameters : uncodedHead - head of uncoded lookahead buffer
+*   Parameters : ctx - the encoder context
+*                windowHead - not used
+*                uncodedHead - head of uncoded lookahead buffer
 *   Effects    : NONE
 *   Returned   : The sliding window index where the match starts and the
 *                length of the match.  If there is no match a length of
 *                zero will be returned.
 ****************************************************************************/
-encoded_string_t FindMatch(const unsigned int windowHead,
-    const unsigned int uncodedHead)
+template <class F>
+static encoded_string_t FindMatch(lzss_context_t *ctx,
+    const unsigned int windowHead, const unsigned int uncodedHead)
 {
+    const unsigned int *next = HashState(ctx)->next;
+    const unsigned char *slidingWindow = ctx->slidingWindow;
+    const unsigned char *uncoded = ctx->uncodedLookahead + uncodedHead;
     encoded_string_t matchData;
     unsigned int i;
     unsigned int j;
@@ -185,25 +207,16 @@ encoded_string_t FindMatch(const unsigned int windowHead,
     matchData.offset = 0;
 
     /* use hash to find the start of the list that we need to check */
-    i = hashTable[HashKey(uncodedHead, SRC_LOOKAHEAD)];
+    i = HashState(ctx)->hashTable[
+        HashKey<F>(ctx, uncodedHead, SRC_LOOKAHEAD)];
     j = 0;
 
     while (i != NULL_INDEX)
     {
-        if (slidingWindow[i] == uncodedLookahead[uncodedHead])
+        if (slidingWindow[i] == uncoded[0])
         {
             /* we matched one how many more match? */
-            j = 1;
-
-            while(slidingWindow[Wrap((i + j), WINDOW_SIZE)] ==
-                uncodedLookahead[Wrap((uncodedHead + j), MAX_CODED)])
-            {
-                if (j >= MAX_CODED)
-                {
-                    break;
-                }
-                j++;
-            }
+            j = MatchLength(slidingWindow + i, uncoded, F::MAX_CODED);
 
             if (j > matchData.length)
             {
@@ -212,9 +225,9 @@ encoded_string_t FindMatch(const unsigned int windowHead,
             }
         }
 
-        if (j >= MAX_CODED)
+        if (j >= F::MAX_CODED)
         {
-            matchData.length = MAX_CODED;
+            matchData.length = F::MAX_CODED;
             break;
         }
 
@@ -229,21 +242,25 @@ encoded_string_t FindMatch(const unsigned int windowHead,
 *   Description: This function adds the (MAX_UNCODED + 1) long string
 *                starting at slidingWindow[charIndex] to the hash table's
 *                linked list associated with its hash key.
-*   Parameters : charIndex - sliding window index of the string to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the string to be
 *                            added to the linked list.
 *   Effects    : The string starting at slidingWindow[charIndex] is appended
 *                to the end of the appropriate linked list.
 *   Returned   : NONE
 ****************************************************************************/
-static void AddString(const unsigned int charIndex)
+template <class F>
+static void AddString(lzss_context_t *ctx, const unsigned int charIndex)
 {
+    unsigned int *hashTable = HashState(ctx)->hashTable;
+    unsigned int *next = HashState(ctx)->next;
     unsigned int i;
     unsigned int hashKey;
 
     /* inserted character will be at the end of the list */
     next[charIndex] = NULL_INDEX;
 
-    hashKey = HashKey(charIndex, SRC_SLIDING_WINDOW);
+    hashKey = HashKey<F>(ctx, charIndex, SRC_SLIDING_WINDOW);
 
     if (hashTable[hashKey] == NULL_INDEX)
     {
@@ -269,14 +286,18 @@ static void AddString(const unsigned int charIndex)
 *   Description: This function removes the (MAX_UNCODED + 1) long string
 *                starting at slidingWindow[charIndex] from the hash table's
 *                linked list associated with its hash key.
-*   Parameters : charIndex - sliding window index of the string to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the string to be
 *                            removed from the linked list.
 *   Effects    : The string starting at slidingWindow[charIndex] is removed
 *                from its linked list.
 *   Returned   : NONE
 ****************************************************************************/
-static void RemoveString(const unsigned int charIndex)
+template <class F>
+static void RemoveString(lzss_context_t *ctx, const unsigned int charIndex)
 {
+    unsigned int *hashTable = HashState(ctx)->hashTable;
+    unsigned int *next = HashState(ctx)->next;
     unsigned int i;
     unsigned int hashKey;
     unsigned int nextIndex;
@@ -284,7 +305,7 @@ static void RemoveString(const unsigned int charIndex)
     nextIndex = next[charIndex];        /* remember where this points to */
     next[charIndex] = NULL_INDEX;
 
-    hashKey = HashKey(charIndex, SRC_SLIDING_WINDOW);
+    hashKey = HashKey<F>(ctx, charIndex, SRC_SLIDING_WINDOW);
 
     if (hashTable[hashKey] == charIndex)
     {
@@ -311,22 +332,26 @@ static void RemoveString(const unsigned int charIndex)
 *                slidingWindow[charIndex] with the one specified by
 *                replacement.  The hash table entries effected by the
 *                replacement are also corrected.
-*   Parameters : charIndex - sliding window index of the character to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
 *                            removed from the linked list.
+*                replacement - new character
 *   Effects    : slidingWindow[charIndex] is replaced by replacement.  Old
 *                hash entries for strings containing slidingWindow[charIndex]
 *                are removed and new ones are added.
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
-int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
+template <class F>
+static int ReplaceChar(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned char replacement)
 {
     unsigned int firstIndex;
     unsigned int i;
 
     if (charIndex < MAX_UNCODED)
     {
-        firstIndex = (WINDOW_SIZE + charIndex) - MAX_UNCODED;
+        firstIndex = (F::WINDOW_SIZE + charIndex) - MAX_UNCODED;
     }
     else
     {
@@ -336,16 +361,36 @@ int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
     /* remove all hash entries containing character at char index */
     for (i = 0; i < (MAX_UNCODED + 1); i++)
     {
-        RemoveString(Wrap((firstIndex + i), WINDOW_SIZE));
+        RemoveString<F>(ctx, Wrap((firstIndex + i), F::WINDOW_SIZE));
     }
 
-    slidingWindow[charIndex] = replacement;
+    SetWindowChar<F>(ctx, charIndex, replacement);
 
     /* add all hash entries containing character at char index */
     for (i = 0; i < (MAX_UNCODED + 1); i++)
     {
-        AddString(Wrap((firstIndex + i), WINDOW_SIZE));
+        AddString<F>(ctx, Wrap((firstIndex + i), F::WINDOW_SIZE));
     }
 
     return 0;
 }
+
+/***************************************************************************
+*                              MATCH FINDER
+***************************************************************************/
+/* the hash finder built for one format */
+#define HASH_FINDER(offsetBits, lengthBits) \
+    { \
+        "hash", \
+        sizeof(hash_state_t<format_traits_t<offsetBits, lengthBits> >), \
+        InitializeSearchStructures< \
+            format_traits_t<offsetBits, lengthBits> >, \
+        ReplaceChar<format_traits_t<offsetBits, lengthBits> >, \
+        FindMatch<format_traits_t<offsetBits, lengthBits> >, \
+        NULL                    /* nothing to free */ \
+    },
+
+const match_finder_t hashFinder[] =
+{
+    LZSS_FORMATS(HASH_FINDER)
+};
@@ -39,13 +39,6 @@
 ***************************************************************************/
 #include "lzlocal.h"
 
-/***************************************************************************
-*                            GLOBAL VARIABLES
-***************************************************************************/
-/* cyclic buffer sliding window of already read characters */
-extern unsigned char slidingWindow[];
-extern unsigned char uncodedLookahead[];
-
 /****************************************************************************
 *   Function   : InitializeSearchStructures
 *   Description: This function initializes structures used to speed up the
@@ -53,13 +46,15 @@ extern unsigned char uncodedLookahead[];
 *                sliding window.  The KMP search doesn't use any special
 *                structures that remain between searches, so this function
 *                doesn't do anything.
-*   Parameters : None
+*   Parameters : ctx - not used
 *   Effects    : None
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
-int InitializeSearchStructures(void)
+template <class F>
+static int InitializeSearchStructures(lzss_context_t *ctx)
 {
+    (void)ctx;              /* prevents unused variable warning */
     return 0;
 }
 
@@ -77,7 +72,8 @@ int InitializeSearchStructures(void)
 *                kmpTable[i].
 *   Returned   : None
 ****************************************************************************/
-static void FillTable(unsigned char *uncoded, int* kmpTable)
+template <class F>
+static void FillTable(const unsigned char *uncoded, int* kmpTable)
 {
     int i;  /* current position in the kmpTable */
     int j;  /* next position for the current candidate substring in uncoded */
@@ -88,7 +84,7 @@ static void FillTable(unsigned char *uncoded, int* kmpTable)
     i = 2;
     j = 0;
 
-    while (i < MAX_CODED)
+    while (i < F::MAX_CODED)
     {
         if (uncoded[i - 1] == uncoded[j])
         {
@@ -116,49 +112,48 @@ static void FillTable(unsigned char *uncoded, int* kmpTable)
 *   Description: This function will search through the slidingWindow
 *                dictionary for the longest sequence matching the MAX_CODED
 *                long string stored in uncodedLookahed.
-*   Parameters : windowHead - head of sliding window
+*   Parameters : ctx - the encoder context
+*                windowHead - head of sliding window
 *                uncodedHead - head of uncoded lookahead buffer
 *   Effects    : None
 *   Returned   : The sliding window index where the match starts and the
 *                length of the match.  If there is no match a length of
 *                zero will be returned.
 ****************************************************************************/
-encoded_string_t FindMatch(const unsigned int windowHead,
-    const unsigned int uncodedHead)
+template <class F>
+static encoded_string_t FindMatch(lzss_context_t *ctx,
+    const unsigned int windowHead, const unsigned int uncodedHead)
 {
+    const unsigned char *slidingWindow = ctx->slidingWindow;
     encoded_string_t matchData;
     unsigned int m;             /* starting position in string being searched */
     unsigned int i;             /* offset from m and uncoded data */
-    int kmpTable[MAX_CODED];    /* kmp partial match table */
-    unsigned char localUncoded[MAX_CODED];  /* non-circular copy of uncoded */
+    int kmpTable[F::MAX_CODED];     /* kmp partial match table */
 
-    /* build non-circular copy of the uncoded lookahead buffer */
-    for (i = 0; i < MAX_CODED; i++)
-    {
-        localUncoded[i] =
-            uncodedLookahead[Wrap((uncodedHead + i), MAX_CODED)];
-    }
+    /* the lookahead's mirror makes it a non-circular string here */
+    const unsigned char *localUncoded = ctx->uncodedLookahead + uncodedHead;
 
-    FillTable(localUncoded, kmpTable);      /* build kmp partial match table */
+    FillTable<F>(localUncoded, kmpTable);   /* build kmp partial match table */
 
     matchData.length = 0;
     matchData.offset = 0;
     m = 0;
     i = 0;
 
-    while (m < WINDOW_SIZE)
+    while (m < F::WINDOW_SIZE)
     {
+        /* i < MAX_CODED, so the window's mirror covers m + i */
         if (localUncoded[i] ==
-            slidingWindow[Wrap((m + i + windowHead), WINDOW_SIZE)])
+            slidingWindow[Wrap((m + windowHead), F::WINDOW_SIZE) + i])
         {
             /* one more character matches */
             i++;
 
-            if (MAX_CODED == i)
+            if (F::MAX_CODED == i)
             {
                 /* entire string is matched */
-                matchData.length = MAX_CODED;
-                matchData.offset = Wrap((m + windowHead), WINDOW_SIZE);
+                matchData.length = F::MAX_CODED;
+                matchData.offset = Wrap((m + windowHead), F::WINDOW_SIZE);
                 break;
             }
         }
@@ -168,7 +163,7 @@ encoded_string_t FindMatch(const unsigned int windowHead,
             {
                 /* partial match is longest yet */
                 matchData.length = i;
-                matchData.offset = Wrap((m + windowHead), WINDOW_SIZE);
+                matchData.offset = Wrap((m + windowHead), F::WINDOW_SIZE);
             }
 
             /* compute next position to search from */
@@ -194,14 +189,38 @@ encoded_string_t FindMatch(const unsigned int windowHead,
 *   Description: This function replaces the character stored in
 *                slidingWindow[charIndex] with the one specified by
 *                replacement.
-*   Parameters : charIndex - sliding window index of the character to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
 *                            removed from the linked list.
+*                replacement - new character
 *   Effects    : slidingWindow[charIndex] is replaced by replacement.
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
-int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
+template <class F>
+static int ReplaceChar(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned char replacement)
 {
-    slidingWindow[charIndex] = replacement;
+    SetWindowChar<F>(ctx, charIndex, replacement);
     return 0;
 }
+
+/***************************************************************************
+*                              MATCH FINDER
+***************************************************************************/
+/* the kmp finder built for one format */
+#define KMP_FINDER(offsetBits, lengthBits) \
+    { \
+        "kmp", \
+        0,                      /* no search structures */ \
+        InitializeSearchStructures< \
+            format_traits_t<offsetBits, lengthBits> >, \
+        ReplaceChar<format_traits_t<offsetBits, lengthBits> >, \
+        FindMatch<format_traits_t<offsetBits, lengthBits> >, \
+        NULL                    /* nothing to free */ \
+    },
+
+const match_finder_t kmpFinder[] =
+{
+    LZSS_FORMATS(KMP_FINDER)
+};
@@ -39,17 +39,29 @@
 /***************************************************************************
 *                                CONSTANTS
 ***************************************************************************/
-#define NULL_INDEX      (WINDOW_SIZE + 1)
+/* of the format F the function using them is built for */
+#define NULL_INDEX      (F::WINDOW_SIZE + 1)
 
 /***************************************************************************
-*                            GLOBAL VARIABLES
+*                            TYPE DEFINITIONS
 ***************************************************************************/
-/* cyclic buffer sliding window of already read characters */
-extern unsigned char slidingWindow[];
-extern unsigned char uncodedLookahead[];
 
-unsigned int lists[UCHAR_MAX];              /* heads of linked lists */
-unsigned int next[WINDOW_SIZE];             /* indices of next in list */
+/***************************************************************************
+* The search structures kept in an encoder's context: a linked list of the
+* window positions holding each character.
+***************************************************************************/
+template <class F>
+struct list_state_t
+{
+    unsigned int lists[UCHAR_MAX + 1];      /* heads of linked lists */
+    unsigned int next[F::WINDOW_SIZE];      /* indices of next in list */
+};
+
+/***************************************************************************
+*                                 MACROS
+***************************************************************************/
+/* list search structures of a context */
+#define ListState(ctx)      ((list_state_t<F> *)((ctx)->finderState))
 
 /***************************************************************************
 *                                FUNCTIONS
@@ -62,7 +74,7 @@ unsigned int next[WINDOW_SIZE];             /* indices of next in list */
 *                sliding window.  For link list optimized searches, this
 *                means that linked lists of strings all starting with
 *                the same character are initialized.
-*   Parameters : None
+*   Parameters : ctx - the encoder context
 *   Effects    : Initializes lists and next array
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
@@ -70,17 +82,20 @@ unsigned int next[WINDOW_SIZE];             /* indices of next in list */
 *   NOTE: This function assumes that the sliding window is initially filled
 *         with all identical characters.
 ****************************************************************************/
-int InitializeSearchStructures(void)
+template <class F>
+static int InitializeSearchStructures(lzss_context_t *ctx)
 {
+    unsigned int *lists = ListState(ctx)->lists;
+    unsigned int *next = ListState(ctx)->next;
     unsigned int i;
 
-    for (i = 0; i < WINDOW_SIZE; i++)
+    for (i = 0; i < F::WINDOW_SIZE; i++)
     {
         next[i] = i + 1;
     }
 
     /* there's no next for the last character */
-    next[WINDOW_SIZE - 1] = NULL_INDEX;
+    next[F::WINDOW_SIZE - 1] = NULL_INDEX;
 
     /* the only list right now is the slidingWindow[0] list */
     for (i = 0; i < 256; i++)
@@ -88,7 +103,7 @@ int InitializeSearchStructures(void)
         lists[i] = NULL_INDEX;
     }
 
-    lists[slidingWindow[0]] = 0;
+    lists[ctx->slidingWindow[0]] = 0;
     return 0;
 }
 
@@ -97,16 +112,21 @@ int InitializeSearchStructures(void)
 *   Description: This function will search through the slidingWindow
 *                dictionary for the longest sequence matching the MAX_CODED
 *                long string stored in uncodedLookahed.
-*   Parameters : windowHead - head of sliding window (unused)
+*   Parameters : ctx - the encoder context
+*                windowHead - head of sliding window (unused)
 *                uncodedHead - head of uncoded lookahead buffer
 *   Effects    : None
 *   Returned   : The sliding window index where the match starts and the
 *                length of the match.  If there is no match a length of
 *                zero will be returned.
 ****************************************************************************/
-encoded_string_t FindMatch(const unsigned int windowHead,
-    const unsigned int uncodedHead)
+template <class F>
+static encoded_string_t FindMatch(lzss_context_t *ctx,
+    const unsigned int windowHead, const unsigned int uncodedHead)
 {
+    const unsigned int *next = ListState(ctx)->next;
+    const unsigned char *slidingWindow = ctx->slidingWindow;
+    const unsigned char *uncoded = ctx->uncodedLookahead + uncodedHead;
     encoded_string_t matchData;
     unsigned int i;
     unsigned int j;
@@ -114,22 +134,14 @@ encoded_string_t FindMatch(const unsigned int windowHead,
     (void)windowHead;       /* prevents unused variable warning */
     matchData.length = 0;
     matchData.offset = 0;
-    i = lists[uncodedLookahead[uncodedHead]];   /* start of proper list */
+    /* start of proper list */
+    i = ListState(ctx)->lists[uncoded[0]];
 
     while (i != NULL_INDEX)
     {
         /* the list insures we matched one, how many more match? */
-        j = 1;
-
-        while(slidingWindow[Wrap((i + j), WINDOW_SIZE)] ==
-            uncodedLookahead[Wrap((uncodedHead + j), MAX_CODED)])
-        {
-            if (j >= MAX_CODED)
-            {
-                break;
-            }
-            j++;
-        }
+        j = 1 + MatchLength(slidingWindow + i + 1, uncoded + 1,
+            F::MAX_CODED - 1);
 
         if (j > matchData.length)
         {
@@ -137,9 +149,9 @@ encoded_string_t FindMatch(const unsigned int windowHead,
             matchData.offset = i;
         }
 
-        if (j >= MAX_CODED)
+        if (j >= F::MAX_CODED)
         {
-            matchData.length = MAX_CODED;
+            matchData.length = F::MAX_CODED;
             break;
         }
 
@@ -153,14 +165,19 @@ encoded_string_t FindMatch(const unsigned int windowHead,
 *   Function   : AddChar
 *   Description: This function adds the character stored in
 *                slidingWindow[charIndex] to the linked lists.
-*   Parameters : charIndex - sliding window index of the character to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
 *                            added to the linked list.
 *   Effects    : slidingWindow[charIndex] appended to the end of the
 *                appropriate linked list.
 *   Returned   : NONE
 ****************************************************************************/
-static void AddChar(const unsigned int charIndex)
+template <class F>
+static void AddChar(lzss_context_t *ctx, const unsigned int charIndex)
 {
+    unsigned int *lists = ListState(ctx)->lists;
+    unsigned int *next = ListState(ctx)->next;
+    const unsigned char *slidingWindow = ctx->slidingWindow;
     unsigned int i;
 
     /* inserted character will be at the end of the list */
@@ -188,14 +205,19 @@ static void AddChar(const unsigned int charIndex)
 *   Function   : RemoveChar
 *   Description: This function removes the character stored in
 *                slidingWindow[charIndex] from the linked lists.
-*   Parameters : charIndex - sliding window index of the character to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
 *                            removed from the linked list.
 *   Effects    : slidingWindow[charIndex] is removed from it's linked list
 *                and the list is appropriately reconnected.
 *   Returned   : NONE
 ****************************************************************************/
-static void RemoveChar(const unsigned int charIndex)
+template <class F>
+static void RemoveChar(lzss_context_t *ctx, const unsigned int charIndex)
 {
+    unsigned int *lists = ListState(ctx)->lists;
+    unsigned int *next = ListState(ctx)->next;
+    const unsigned char *slidingWindow = ctx->slidingWindow;
     unsigned int i;
     unsigned int nextIndex;
 
@@ -227,19 +249,43 @@ static void RemoveChar(const unsigned int charIndex)
 *                slidingWindow[charIndex] with the one specified by
 *                replacement.  The linked list entries effected by the
 *                replacement are also corrected.
-*   Parameters : charIndex - sliding window index of the character to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
 *                            removed from the linked list.
+*                replacement - new character
 *   Effects    : slidingWindow[charIndex] is replaced by replacement.  Old
 *                list entries for strings containing slidingWindow[charIndex]
 *                are removed and new ones are added.
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
-int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
+template <class F>
+static int ReplaceChar(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned char replacement)
 {
-    RemoveChar(charIndex);
-    slidingWindow[charIndex] = replacement;
-    AddChar(charIndex);
+    RemoveChar<F>(ctx, charIndex);
+    SetWindowChar<F>(ctx, charIndex, replacement);
+    AddChar<F>(ctx, charIndex);
 
     return 0;
 }
+
+/***************************************************************************
+*                              MATCH FINDER
+***************************************************************************/
+/* the list finder built for one format */
+#define LIST_FINDER(offsetBits, lengthBits) \
+    { \
+        "list", \
+        sizeof(list_state_t<format_traits_t<offsetBits, lengthBits> >), \
+        InitializeSearchStructures< \
+            format_traits_t<offsetBits, lengthBits> >, \
+        ReplaceChar<format_traits_t<offsetBits, lengthBits> >, \
+        FindMatch<format_traits_t<offsetBits, lengthBits> >, \
+        NULL                    /* nothing to free */ \
+    },
+
+const match_finder_t listFinder[] =
+{
+    LZSS_FORMATS(LIST_FINDER)
+};
@@ -37,36 +37,41 @@
 *                             INCLUDED FILES
 ***************************************************************************/
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "lzss.h"
 
 /***************************************************************************
 *                                CONSTANTS
 ***************************************************************************/
 
-#define OFFSET_BITS     12
-#define LENGTH_BITS     4
-
-#if (((1 << (OFFSET_BITS + LENGTH_BITS)) - 1) > UINT_MAX)
-#error "Size of encoded data must not exceed the size of an unsigned int"
-#endif
-
-/* We want a sliding window*/
-#define WINDOW_SIZE     (1 << OFFSET_BITS)
-
-/* maximum match length not encoded and maximum length encoded (4 bits) */
+/* maximum match length not encoded */
 #define MAX_UNCODED     2
-#define MAX_CODED       ((1 << LENGTH_BITS) + MAX_UNCODED)
 
 #define ENCODED     0       /* encoded string */
 #define UNCODED     1       /* unencoded character */
 
+/* bytes MatchLength may read past the strings it compares */
+#define MATCH_SLACK     32
+
+/* finderState is aligned to a cache line */
+#define FINDER_STATE_ALIGN  64
+
 /***************************************************************************
 *                            TYPE DEFINITIONS
 ***************************************************************************/
 
 /***************************************************************************
 * This data structure stores an encoded string in (offset, length) format.
-* The actual encoded string is stored using OFFSET_BITS for the offset and
-* LENGTH_BITS for the length.
+* The actual encoded string is stored using the offset bits and length bits
+* of the stream's format.
 ***************************************************************************/
 typedef struct encoded_string_t
 {
@@ -74,6 +79,48 @@ typedef struct encoded_string_t
     unsigned int length;    /* length of longest match */
 } encoded_string_t;
 
+/***************************************************************************
+* How the encoder chooses the strings it codes from the matches it finds.
+***************************************************************************/
+typedef enum
+{
+    PARSE_GREEDY,       /* the longest match at each position */
+    PARSE_LAZY,         /* unless the next position has a longer one */
+    PARSE_OPTIMAL       /* the fewest bits over a block */
+} parse_t;
+
+/***************************************************************************
+* How hard a compression level searches.  The chain finder checks at most
+* maxChain candidates for each match, and stops at one of niceLength bytes
+* or more.  The parse applies to every finder; the lazy parse only looks
+* past matches shorter than maxLazy.
+***************************************************************************/
+typedef struct level_config_t
+{
+    unsigned int maxChain;      /* candidates checked for a match */
+    unsigned int niceLength;    /* a match this long ends the search */
+    parse_t parse;
+    unsigned int maxLazy;       /* longest match the lazy parse defers */
+} level_config_t;
+
+/***************************************************************************
+* The sizes that follow from a format, as compile time constants.  The
+* match finders are built once for each format with these, so the 4 KB
+* window costs no more to search than when its size was fixed.
+***************************************************************************/
+template <unsigned int offsetBits, unsigned int lengthBits>
+struct format_traits_t
+{
+    static const int OFFSET_BITS = offsetBits;
+    static const int LENGTH_BITS = lengthBits;
+
+    /* We want a sliding window*/
+    static const int WINDOW_SIZE = 1 << offsetBits;
+
+    /* maximum length encoded */
+    static const int MAX_CODED = (1 << lengthBits) + MAX_UNCODED;
+};
+
 /***************************************************************************
 *                                 MACROS
 ***************************************************************************/
@@ -82,12 +129,102 @@ typedef struct encoded_string_t
     (((value) < (limit)) ? (value) : ((value) - (limit)))
 
 /***************************************************************************
-*                               PROTOTYPES
+* Every format the library supports, as X(offsetBits, lengthBits).  The
+* match finder tables and the format index follow this order.
+***************************************************************************/
+#define LZSS_FORMATS(X) \
+    X(12, 4) X(13, 4) X(14, 4) X(15, 4) X(16, 4) \
+    X(17, 4) X(18, 4) X(19, 4) X(20, 4) \
+    X(12, 8) X(13, 8) X(14, 8) X(15, 8) X(16, 8) \
+    X(17, 8) X(18, 8) X(19, 8) X(20, 8)
+
+/***************************************************************************
+*                            INLINE FUNCTIONS
 ***************************************************************************/
 
 /***************************************************************************
-* These are the prototypes for functions that must be provided by any
-* methods for maintaining and searching the sliding window dictionary.
+* MatchLength returns how many of the bytes at a and b match, up to limit.
+* It compares 32 bytes at a time with AVX2, 16 with SSE2 and 8 otherwise,
+* and counts the trailing zeros of the mismatch mask to find the first
+* byte that differs.  It may read up to MATCH_SLACK bytes past a + limit
+* and b + limit, so both buffers need that much slack at their ends.
+***************************************************************************/
+static inline unsigned int MatchLength(const unsigned char *a,
+    const unsigned char *b, const unsigned int limit)
+{
+    unsigned int len;
+
+#if defined(__AVX2__)
+    for (len = 0; len < limit; len += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + len));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + len));
+        uint32_t mask =
+            ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+        if (0 != mask)
+        {
+            len += __builtin_ctz(mask);
+            return (len < limit) ? len : limit;
+        }
+    }
+#elif defined(__SSE2__)
+    for (len = 0; len < limit; len += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + len));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + len));
+        uint32_t mask =
+            ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+
+        if (0 != mask)
+        {
+            len += __builtin_ctz(mask);
+            return (len < limit) ? len : limit;
+        }
+    }
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    for (len = 0; len < limit; len += 8)
+    {
+        uint64_t x, y;
+
+        memcpy(&x, a + len, sizeof(x));
+        memcpy(&y, b + len, sizeof(y));
+
+        if (x != y)
+        {
+            len += __builtin_ctzll(x ^ y) >> 3;
+            return (len < limit) ? len : limit;
+        }
+    }
+#else
+    for (len = 0; len < limit; len++)
+    {
+        if (a[len] != b[len])
+        {
+            return len;
+        }
+    }
+#endif
+
+    return limit;
+}
+
+/***************************************************************************
+*                            MATCH FINDERS
+***************************************************************************/
+
+/***************************************************************************
+* A match finder is the set of functions that must be provided by any
+* method for maintaining and searching the sliding window dictionary.  Every
+* method is compiled into the library, once for each format, and the
+* encoder calls the one selected for each stream through this structure.
+* A finder's functions are templates on the format_traits_t of the format
+* they are built for.
+*
+* A finder keeps its search structures in the context it is given, in
+* stateSize bytes at finderState, so every encoder has its own.  The
+* compression level of the stream is at ctx->config for finders that can
+* trade matches for speed.
 *
 * InitializeSearchStructures and ReplaceChar return 0 for success and -1
 * for a failure.  errno will be set in the event of a failure.
@@ -95,11 +232,97 @@ typedef struct encoded_string_t
 * FindMatch will return the encoded_string_t value referencing the match
 * in the sliding window dictionary.  the length field will be 0 if no
 * match is found.
+*
+* A finder that searches the whole input at once reads it from ctx->input
+* in InitializeSearchStructures or later.  FreeSearchStructures, if not
+* NULL, frees what its state points to before the state itself is freed.
+***************************************************************************/
+typedef struct match_finder_t
+{
+    const char *name;
+    size_t stateSize;       /* bytes of search structures */
+    int (*InitializeSearchStructures)(lzss_context_t *ctx);
+    int (*ReplaceChar)(lzss_context_t *ctx, const unsigned int charIndex,
+        const unsigned char replacement);
+    encoded_string_t (*FindMatch)(lzss_context_t *ctx,
+        const unsigned int windowHead, const unsigned int uncodedHead);
+    void (*FreeSearchStructures)(lzss_context_t *ctx);
+} match_finder_t;
+
+/* each finder for every format, in LZSS_FORMATS order */
+extern const match_finder_t bruteFinder[];  /* brute.cpp */
+extern const match_finder_t listFinder[];   /* list.cpp */
+extern const match_finder_t hashFinder[];   /* hash.cpp */
+extern const match_finder_t kmpFinder[];    /* kmp.cpp */
+extern const match_finder_t treeFinder[];   /* tree.cpp */
+extern const match_finder_t chainFinder[];  /* chain.cpp */
+extern const match_finder_t suffixFinder[]; /* suffix.cpp */
+
+/***************************************************************************
+*                                CONTEXTS
+***************************************************************************/
+
+/***************************************************************************
+* Everything an encoder or decoder changes while it runs.  The window and
+* lookahead are allocated for the format of the last stream and finderState
+* for the match finder last used; both are kept for the next call that
+* needs the same.
+*
+* Both cyclic buffers are followed by a copy of their start, so a string
+* of up to maxCoded bytes at any index can be read without wrapping:
+* slidingWindow[windowSize + i] mirrors slidingWindow[i] for i < maxCoded
+* and uncodedLookahead[maxCoded + i] mirrors uncodedLookahead[i].  After
+* the copies are MATCH_SLACK bytes for MatchLength to read into.
+***************************************************************************/
+struct lzss_context_t
+{
+    lzss_format_t format;           /* of the stream being coded */
+    unsigned int windowSize;        /* bytes in the slidingWindow cycle */
+    unsigned int maxCoded;          /* bytes in the uncodedLookahead cycle */
+
+    /* cyclic buffer sliding window of already read characters */
+    unsigned char *slidingWindow;   /* windowSize + maxCoded + slack */
+    unsigned char *uncodedLookahead;    /* 2 * maxCoded + slack */
+
+    const match_finder_t *finder;   /* owner of finderState */
+    void *finderState;              /* FINDER_STATE_ALIGN aligned */
+    const level_config_t *config;   /* level of the stream being encoded */
+
+    /* the input being encoded, after primeSize bytes already in the window */
+    const unsigned char *input;
+    size_t inputSize;
+    size_t primeSize;
+
+    lzss_stats_t stats;
+};
+
+/***************************************************************************
+* SetWindowChar writes a sliding window character and its mirror.  Match
+* finders use it in ReplaceChar.
+***************************************************************************/
+template <class F>
+static inline void SetWindowChar(lzss_context_t *ctx,
+    const unsigned int charIndex, const unsigned char c)
+{
+    ctx->slidingWindow[charIndex] = c;
+
+    if (charIndex < (unsigned int)F::MAX_CODED)
+    {
+        ctx->slidingWindow[F::WINDOW_SIZE + charIndex] = c;
+    }
+}
+
+/***************************************************************************
+*                               PROTOTYPES
 ***************************************************************************/
-int InitializeSearchStructures(void);
-int ReplaceChar(const unsigned int charIndex, const unsigned char replacement);
 
-encoded_string_t FindMatch(const unsigned int windowHead,
-    const unsigned int uncodedHead);
+/* index of a format in LZSS_FORMATS, or -1 if it isn't supported */
+int LZSSFormatIndex(lzss_format_t format);
+
+/* EncodeLZSS with the primeSize bytes before in already in the window and
+ * no stream header */
+int EncodePrimedLZSS(lzss_context_t *ctx, const uint8_t *in, size_t size,
+    size_t primeSize, std::vector<uint8_t> &out, lzss_finder_t finder,
+    lzss_format_t format, int level);
 
 #endif      /* ndef _LZSS_LOCAL_H */
@@ -35,66 +35,412 @@
 ***************************************************************************/
 #include "lzss.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <algorithm>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 #include "lzlocal.h"
-#include "bitfile.h"
+#include "bitstream.h"
 #include "CycleTimer.h"
 #include "file_buffer.h"
+#include "trace.h"
+#include "perf_counters.h"
 
 /***************************************************************************
 *                            TYPE DEFINITIONS
 ***************************************************************************/
 
+/***************************************************************************
+* Where an encoder is in its input.  The lookahead holds the len bytes
+* before in[next]; once the input runs out, len counts down to 0.
+***************************************************************************/
+typedef struct encode_cursor_t
+{
+    const unsigned char *in;
+    size_t size;                /* bytes at in */
+    size_t next;                /* next input byte to read */
+    unsigned int len;           /* input bytes in the lookahead */
+
+    /* head of sliding window and lookahead */
+    unsigned int windowHead, uncodedHead;
+} encode_cursor_t;
+
 /***************************************************************************
 *                                CONSTANTS
 ***************************************************************************/
+/* a stream starts with the magic, then a byte each of offset and length
+ * bits */
+#define STREAM_MAGIC        "LZSS"
+#define STREAM_MAGIC_SIZE   4
+#define HEADER_SIZE         (STREAM_MAGIC_SIZE + 2)
+
+/* bytes the optimal parse prices at a time */
+#define OPTIMAL_BLOCK       (1 << 16)
+
+/***************************************************************************
+*                                 MACROS
+***************************************************************************/
+#define FORMAT_ENTRY(offsetBits, lengthBits)    {offsetBits, lengthBits},
+
+/* index in the input of the character at the head of the lookahead */
+#define CursorPosition(cur)     ((cur)->next - (cur)->len)
 
 /***************************************************************************
 *                            GLOBAL VARIABLES
 ***************************************************************************/
-/* cyclic buffer sliding window of already read characters */
-unsigned char slidingWindow[WINDOW_SIZE];
-unsigned char uncodedLookahead[MAX_CODED];
+/* match finders by lzss_finder_t, each built for every format */
+static const match_finder_t *finders[LZSS_NUM_FINDERS] =
+{
+    bruteFinder,
+    listFinder,
+    hashFinder,
+    kmpFinder,
+    treeFinder,
+    chainFinder,
+    suffixFinder
+};
 
 /***************************************************************************
-*                               Statistics
+* The search and parse of each compression level, 1 to 9, after gzip's
+* table: greedy parses for the fastest levels and lazy ones after them.
+* The optimal parse searches every position, so levels 8 and 9 use the
+* chain depths of 6 and 8 with it.
 ***************************************************************************/
-double encoding_times[3];
+static const level_config_t levels[] =
+{
+    {4, 8, PARSE_GREEDY, 0},
+    {8, 16, PARSE_GREEDY, 0},
+    {16, 32, PARSE_GREEDY, 0},
+    {32, 32, PARSE_LAZY, 16},
+    {64, 64, PARSE_LAZY, 32},
+    {128, 128, PARSE_LAZY, 128},
+    {256, 258, PARSE_LAZY, 258},
+    {128, 258, PARSE_OPTIMAL, 0},
+    {1024, 258, PARSE_OPTIMAL, 0}
+};
+
+/* the supported formats, in the order of the finder tables */
+static const lzss_format_t formats[] =
+{
+    LZSS_FORMATS(FORMAT_ENTRY)
+};
 
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
+static int UseFormat(lzss_context_t *ctx, lzss_format_t format);
+static int UseFinder(lzss_context_t *ctx, const match_finder_t *finder);
+static void *AllocFinderState(size_t size);
+static void FreeFinderState(void *state);
+static int EncodeBuffer(lzss_context_t *ctx, const unsigned char *in,
+    size_t size, size_t primeSize, BitWriter &bitsOut);
+static inline void Slide(lzss_context_t *ctx, encode_cursor_t *cur,
+    unsigned int count);
+static inline encoded_string_t Find(lzss_context_t *ctx,
+    const encode_cursor_t *cur);
+static inline void PutLiteral(lzss_context_t *ctx, BitWriter &bitsOut,
+    unsigned char c);
+static inline void PutString(lzss_context_t *ctx, BitWriter &bitsOut,
+    encoded_string_t matchData);
+static void ParseGreedy(lzss_context_t *ctx, encode_cursor_t *cur,
+    BitWriter &bitsOut);
+static void ParseLazy(lzss_context_t *ctx, encode_cursor_t *cur,
+    BitWriter &bitsOut);
+static void ParseOptimal(lzss_context_t *ctx, encode_cursor_t *cur,
+    BitWriter &bitsOut);
+static int DecodeStream(lzss_context_t *ctx, const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out, FILE *fpOut);
+static int DecodeBuffer(lzss_context_t *ctx, BitReader &bitsIn,
+    std::vector<uint8_t> &out, FILE *fpOut);
 
 /***************************************************************************
 *                                FUNCTIONS
 ***************************************************************************/
 
+/****************************************************************************
+*   Function   : LZSSCreateContext
+*   Description: This function allocates a context for encoding and
+*                decoding.  The search structures of a match finder are
+*                allocated by the first encode that uses it.
+*   Parameters : None
+*   Effects    : A context with zeroed statistics is allocated.
+*   Returned   : The new context, or NULL for failure.  errno will be set
+*                in the event of a failure.
+****************************************************************************/
+lzss_context_t *LZSSCreateContext(void)
+{
+    lzss_context_t *ctx;
+
+    ctx = (lzss_context_t *)calloc(1, sizeof(lzss_context_t));
+
+    if (NULL == ctx)
+    {
+        errno = ENOMEM;
+    }
+
+    return ctx;
+}
+
+/****************************************************************************
+*   Function   : LZSSFreeContext
+*   Description: This function frees a context allocated by
+*                LZSSCreateContext.
+*   Parameters : ctx - the context to free.  NULL is ignored.
+*   Effects    : ctx, its window and its search structures are freed.
+*   Returned   : None
+****************************************************************************/
+void LZSSFreeContext(lzss_context_t *ctx)
+{
+    if (NULL != ctx)
+    {
+        free(ctx->slidingWindow);
+        free(ctx->uncodedLookahead);
+
+        if ((NULL != ctx->finder) &&
+            (NULL != ctx->finder->FreeSearchStructures))
+        {
+            ctx->finder->FreeSearchStructures(ctx);
+        }
+
+        FreeFinderState(ctx->finderState);
+        free(ctx);
+    }
+}
+
+/****************************************************************************
+*   Function   : LZSSGetStats
+*   Description: This function returns the statistics gathered by the
+*                encodes done with a context.
+*   Parameters : ctx - the context
+*   Effects    : None
+*   Returned   : The statistics of ctx.  They are valid until ctx is freed.
+****************************************************************************/
+const lzss_stats_t *LZSSGetStats(const lzss_context_t *ctx)
+{
+    return &ctx->stats;
+}
+
+/****************************************************************************
+*   Function   : LZSSFormatIndex
+*   Description: This function finds a format in the list of supported
+*                formats, which is also the order of the match finders
+*                built for each format.
+*   Parameters : format - the format
+*   Effects    : None
+*   Returned   : The index of format in LZSS_FORMATS, or -1 if the library
+*                doesn't support it.
+****************************************************************************/
+int LZSSFormatIndex(lzss_format_t format)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        if ((formats[i].offsetBits == format.offsetBits) &&
+            (formats[i].lengthBits == format.lengthBits))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/****************************************************************************
+*   Function   : UseFormat
+*   Description: This function sizes the sliding window and lookahead of a
+*                context for a format, reallocating them if the last stream
+*                had a different one.
+*   Parameters : ctx - the context
+*                format - a supported format
+*   Effects    : ctx->format is format, and the window and lookahead are
+*                big enough for it.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+static int UseFormat(lzss_context_t *ctx, lzss_format_t format)
+{
+    unsigned int windowSize = 1u << format.offsetBits;
+    unsigned int maxCoded = (1u << format.lengthBits) + MAX_UNCODED;
+
+    if ((ctx->windowSize == windowSize) && (ctx->maxCoded == maxCoded))
+    {
+        ctx->format = format;
+        return 0;
+    }
+
+    free(ctx->slidingWindow);
+    free(ctx->uncodedLookahead);
+    ctx->slidingWindow =
+        (unsigned char *)malloc(windowSize + maxCoded + MATCH_SLACK);
+    ctx->uncodedLookahead =
+        (unsigned char *)malloc(2 * maxCoded + MATCH_SLACK);
+
+    if ((NULL == ctx->slidingWindow) || (NULL == ctx->uncodedLookahead))
+    {
+        free(ctx->slidingWindow);
+        free(ctx->uncodedLookahead);
+        ctx->slidingWindow = NULL;
+        ctx->uncodedLookahead = NULL;
+        ctx->windowSize = 0;
+        ctx->maxCoded = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ctx->format = format;
+    ctx->windowSize = windowSize;
+    ctx->maxCoded = maxCoded;
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : UseFinder
+*   Description: This function makes finder the match finder of a context,
+*                replacing the search structures of the previous one if it
+*                was different.
+*   Parameters : ctx - the context
+*                finder - the match finder the next encode will use
+*   Effects    : ctx->finderState is big enough for finder.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+static int UseFinder(lzss_context_t *ctx, const match_finder_t *finder)
+{
+    if (ctx->finder == finder)
+    {
+        return 0;
+    }
+
+    if ((NULL != ctx->finder) && (NULL != ctx->finder->FreeSearchStructures))
+    {
+        ctx->finder->FreeSearchStructures(ctx);
+    }
+
+    FreeFinderState(ctx->finderState);
+    ctx->finderState = NULL;
+    ctx->finder = NULL;
+
+    if (finder->stateSize > 0)
+    {
+        ctx->finderState = AllocFinderState(finder->stateSize);
+
+        if (NULL == ctx->finderState)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        /* pointers in a new state are NULL */
+        memset(ctx->finderState, 0, finder->stateSize);
+    }
+
+    ctx->finder = finder;
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : AllocFinderState
+*   Description: This function allocates the search structures of a match
+*                finder on a cache line boundary, so finders can lay out
+*                tables a line at a time.
+*   Parameters : size - bytes to allocate
+*   Effects    : size bytes aligned to FINDER_STATE_ALIGN are allocated.
+*   Returned   : The allocation, or NULL for failure.
+****************************************************************************/
+static void *AllocFinderState(size_t size)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, FINDER_STATE_ALIGN);
+#else
+    void *state;
+
+    if (posix_memalign(&state, FINDER_STATE_ALIGN, size) != 0)
+    {
+        return NULL;
+    }
+
+    return state;
+#endif
+}
+
+/****************************************************************************
+*   Function   : FreeFinderState
+*   Description: This function frees search structures allocated by
+*                AllocFinderState.
+*   Parameters : state - the search structures.  NULL is ignored.
+*   Effects    : state is freed.
+*   Returned   : None
+****************************************************************************/
+static void FreeFinderState(void *state)
+{
+#ifdef _WIN32
+    _aligned_free(state);
+#else
+    free(state);
+#endif
+}
+
 /****************************************************************************
 *   Function   : EncodeLZSS
 *   Description: This function will read an input file and write an output
 *                file encoded according to the traditional LZSS algorithm.
-*                This algorithm encodes strings as 16 bits (a 12 bit offset
-*                + a 4 bit length).
+*                This algorithm encodes strings as an offset into the
+*                sliding window and a length, with the number of bits in
+*                each given by the format.
 *   Parameters : fpIn - pointer to the open binary file to encode
 *                fpOut - pointer to the open binary file to write encoded
 *                       output
+*                finder - method used to search the sliding window
+*                format - window size and maximum match length
+*                level - how hard to search for matches
 *   Effects    : fpIn is encoded and written to fpOut.  Neither file is
-*                closed after exit.
+*                closed after exit.  Regular files are mapped rather than
+*                read.
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
-int EncodeLZSS(FILE *fpIn, FILE *fpOut)
+int EncodeLZSS(FILE *fpIn, FILE *fpOut, lzss_finder_t finder,
+    lzss_format_t format, int level)
 {
-    bit_file_t *bfpOut;
-    encoded_string_t matchData;
-    FileBuffer file_buf(fpIn);
-    int c;
-    unsigned int i;
-    unsigned int len;                       /* length of string */
+    lzss_context_t *ctx;
+    int result;
 
-    /* head of sliding window and lookahead */
-    unsigned int windowHead, uncodedHead;
+    if (NULL == (ctx = LZSSCreateContext()))
+    {
+        return -1;
+    }
+
+    result = EncodeLZSS(ctx, fpIn, fpOut, finder, format, level);
+    LZSSFreeContext(ctx);
+
+    return result;
+}
+
+/****************************************************************************
+*   Function   : EncodeLZSS
+*   Description: This function is the file version of EncodeLZSS using a
+*                context supplied by the caller.
+*   Parameters : ctx - the context to encode with
+*                fpIn - pointer to the open binary file to encode
+*                fpOut - pointer to the open binary file to write encoded
+*                       output
+*                finder - method used to search the sliding window
+*                format - window size and maximum match length
+*                level - how hard to search for matches
+*   Effects    : fpIn is encoded and written to fpOut.  Neither file is
+*                closed after exit.  The statistics of ctx are updated.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int EncodeLZSS(lzss_context_t *ctx, FILE *fpIn, FILE *fpOut,
+    lzss_finder_t finder, lzss_format_t format, int level)
+{
+    std::vector<uint8_t> out;
+    int result;
 
     /* validate arguments */
     if ((NULL == fpIn) || (NULL == fpOut))
@@ -103,135 +449,635 @@ int EncodeLZSS(FILE *fpIn, FILE *fpOut)
         return -1;
     }
 
-    /* convert output file to bitfile */
-    bfpOut = MakeBitFile(fpOut, BF_WRITE);
+    FileMap input(fpIn);
+    result = EncodeLZSS(ctx, input.Data(), input.Size(), out, finder,
+        format, level);
+
+    if ((0 == result) && (fwrite(out.data(), 1, out.size(), fpOut) !=
+        out.size()))
+    {
+        return -1;
+    }
+
+    return result;
+}
+
+/****************************************************************************
+*   Function   : EncodeLZSS
+*   Description: This function will encode a buffer in memory according to
+*                the traditional LZSS algorithm, in the same format as the
+*                file version.
+*   Parameters : in - the bytes to encode
+*                size - the number of bytes at in
+*                out - vector the encoded bytes are appended to
+*                finder - method used to search the sliding window
+*                format - window size and maximum match length
+*                level - how hard to search for matches
+*   Effects    : The encoded bytes are appended to out.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int EncodeLZSS(const uint8_t *in, size_t size, std::vector<uint8_t> &out,
+    lzss_finder_t finder, lzss_format_t format, int level)
+{
+    lzss_context_t *ctx;
+    int result;
+
+    if (NULL == (ctx = LZSSCreateContext()))
+    {
+        return -1;
+    }
+
+    result = EncodeLZSS(ctx, in, size, out, finder, format, level);
+    LZSSFreeContext(ctx);
+
+    return result;
+}
 
-    if (NULL == bfpOut)
+/****************************************************************************
+*   Function   : EncodeLZSS
+*   Description: This function is the memory version of EncodeLZSS using a
+*                context supplied by the caller.
+*   Parameters : ctx - the context to encode with
+*                in - the bytes to encode
+*                size - the number of bytes at in
+*                out - vector the encoded bytes are appended to
+*                finder - method used to search the sliding window
+*                format - window size and maximum match length
+*                level - how hard to search for matches
+*   Effects    : A header recording the format and the encoded bytes are
+*                appended to out.  The statistics of ctx are updated.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int EncodeLZSS(lzss_context_t *ctx, const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out, lzss_finder_t finder, lzss_format_t format,
+    int level)
+{
+    size_t headerStart = out.size();
+
+    if (LZSSFormatIndex(format) < 0)
     {
-        perror("Making Output File a BitFile");
+        errno = EINVAL;
         return -1;
     }
 
-    windowHead = 0;
-    uncodedHead = 0;
+    out.resize(headerStart + HEADER_SIZE);
+    memcpy(&out[headerStart], STREAM_MAGIC, STREAM_MAGIC_SIZE);
+    out[headerStart + STREAM_MAGIC_SIZE] = (uint8_t)format.offsetBits;
+    out[headerStart + STREAM_MAGIC_SIZE + 1] = (uint8_t)format.lengthBits;
+
+    if (EncodePrimedLZSS(ctx, in, size, 0, out, finder, format, level) != 0)
+    {
+        out.resize(headerStart);
+        return -1;
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : EncodePrimedLZSS
+*   Description: This function encodes a buffer in memory like EncodeLZSS,
+*                but starts with the bytes before the buffer in the sliding
+*                window instead of spaces.  It lets a block of a larger
+*                buffer be encoded on its own and still refer to the data
+*                before it.
+*   Parameters : ctx - the context to encode with
+*                in - the bytes to encode
+*                size - the number of bytes at in
+*                primeSize - the number of bytes before in to put in the
+*                            sliding window, at most the window size
+*                out - vector the encoded bytes are appended to
+*                finder - method used to search the sliding window
+*                format - window size and maximum match length
+*                level - how hard to search for matches
+*   Effects    : The encoded bytes are appended to out, without a header.
+*                The statistics of ctx are updated.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int EncodePrimedLZSS(lzss_context_t *ctx, const uint8_t *in, size_t size,
+    size_t primeSize, std::vector<uint8_t> &out, lzss_finder_t finder,
+    lzss_format_t format, int level)
+{
+    int formatIndex;
+    int result;
+
+    formatIndex = LZSSFormatIndex(format);
+
+    if ((NULL == ctx) || ((NULL == in) && (size > 0)) || (finder < 0) ||
+        (finder >= LZSS_NUM_FINDERS) || (formatIndex < 0) ||
+        (level < LZSS_MIN_LEVEL) || (level > LZSS_MAX_LEVEL) ||
+        (primeSize > (1u << format.offsetBits)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((UseFormat(ctx, format) != 0) ||
+        (UseFinder(ctx, &finders[finder][formatIndex]) != 0))
+    {
+        return -1;
+    }
+
+    ctx->config = &levels[level - LZSS_MIN_LEVEL];
+
+    BitWriter bitsOut(out);
+    result = EncodeBuffer(ctx, in, size, primeSize, bitsOut);
+
+    /* pad the last byte and drop the unused end of out */
+    bitsOut.Flush();
+
+    return result;
+}
+
+/****************************************************************************
+*   Function   : EncodeBuffer
+*   Description: This function encodes size bytes at in and writes them to
+*                a bit stream.  It is the body of both versions of
+*                EncodeLZSS.  The parse of the context's level chooses the
+*                strings that are coded.
+*   Parameters : ctx - the context to encode with.  Its finder searches
+*                      the sliding window.
+*                in - the bytes to encode
+*                size - the number of bytes at in
+*                primeSize - the number of bytes before in that the
+*                            sliding window starts with
+*                bitsOut - the bit stream to write the encoded output to
+*   Effects    : in is encoded and written to bitsOut.  The statistics of
+*                ctx are updated.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+static int EncodeBuffer(lzss_context_t *ctx, const unsigned char *in,
+    size_t size, size_t primeSize, BitWriter &bitsOut)
+{
+    const match_finder_t *finder = ctx->finder;
+    const unsigned int windowSize = ctx->windowSize;
+    const unsigned int maxCoded = ctx->maxCoded;
+    unsigned char *slidingWindow = ctx->slidingWindow;
+    unsigned char *uncodedLookahead = ctx->uncodedLookahead;
+    encode_cursor_t cur;
+    unsigned int i;
+
+    TRACE_SCOPE("encode");
+    PERF_SCOPE("encode");
+
+    cur.in = in;
+    cur.size = size;
+    cur.next = 0;
+    cur.windowHead = 0;
+    cur.uncodedHead = 0;
 
     /************************************************************************
     * Fill the sliding window buffer with some known vales.  DecodeLZSS must
     * use the same values.  If common characters are used, there's an
-    * increased chance of matching to the earlier strings.
+    * increased chance of matching to the earlier strings.  The window's
+    * mirror and slack get the same, and the lookahead is cleared so the
+    * bytes past a short input are the same on every run.
     ************************************************************************/
-    memset(slidingWindow, ' ', WINDOW_SIZE * sizeof(unsigned char));
+    memset(slidingWindow, ' ',
+        (windowSize + maxCoded + MATCH_SLACK) * sizeof(unsigned char));
+    memset(uncodedLookahead, 0,
+        (2 * maxCoded + MATCH_SLACK) * sizeof(unsigned char));
 
     /************************************************************************
-    * Copy MAX_CODED bytes from the input file into the uncoded lookahead
-    * buffer.
+    * Copy maxCoded bytes from the input into the uncoded lookahead
+    * buffer and its mirror.
     ************************************************************************/
-    for (len = 0; len < MAX_CODED && (c = file_buf.GetChar()) != EOF; len++)
+    for (cur.len = 0; cur.len < maxCoded && cur.next < size; cur.len++)
     {
-        uncodedLookahead[len] = c;
+        uncodedLookahead[cur.len] = in[cur.next];
+        uncodedLookahead[cur.len + maxCoded] = in[cur.next];
+        cur.next++;
     }
 
-    if (0 == len)
+    if (0 == cur.len)
     {
-        return 0;   /* inFile was empty */
+        return 0;   /* input was empty */
     }
 
     /* Look for matching string in sliding window */
-    i = InitializeSearchStructures();
+    ctx->input = in;
+    ctx->inputSize = size;
+    ctx->primeSize = primeSize;
+
+    {
+        TRACE_SCOPE("initialize");
+        i = finder->InitializeSearchStructures(ctx);
+    }
 
     if (0 != i)
     {
         return i;       /* InitializeSearchStructures returned an error */
     }
 
-    matchData = FindMatch(windowHead, uncodedHead);
+    /************************************************************************
+    * Slide the bytes before the input into the window as if they had just
+    * been encoded.  Once windowSize of them are in, windowHead is back at
+    * 0 and the oldest is slidingWindow[0].
+    ************************************************************************/
+    for (i = primeSize; i > 0; i--)
+    {
+        finder->ReplaceChar(ctx, cur.windowHead, *(in - i));
+        cur.windowHead = Wrap((cur.windowHead + 1), windowSize);
+    }
 
-    /* now encoded the rest of the file until an EOF is read */
-    while (len > 0)
+    /* now encoded the rest of the input until it runs out */
+    switch (ctx->config->parse)
     {
-        double t1 = CycleTimer::currentSeconds();
-        
-        if (matchData.length > len)
+        case PARSE_LAZY:
+            ParseLazy(ctx, &cur, bitsOut);
+            break;
+
+        case PARSE_OPTIMAL:
+            ParseOptimal(ctx, &cur, bitsOut);
+            break;
+
+        default:
+            ParseGreedy(ctx, &cur, bitsOut);
+            break;
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : Slide
+*   Description: This function moves an encoder along its input.  Each
+*                byte at the head of the lookahead goes into the sliding
+*                window and the next input byte, if there is one, takes its
+*                place.
+*   Parameters : ctx - the context being encoded with
+*                cur - where the encoder is in its input
+*                count - the number of bytes to move, at most cur->len
+*   Effects    : count bytes are moved from the lookahead into the window.
+*   Returned   : None
+****************************************************************************/
+static inline void Slide(lzss_context_t *ctx, encode_cursor_t *cur,
+    unsigned int count)
+{
+    const match_finder_t *finder = ctx->finder;
+    unsigned char *uncodedLookahead = ctx->uncodedLookahead;
+    const unsigned int maxCoded = ctx->maxCoded;
+
+    while (count > 0)
+    {
+        /* add old byte into sliding window and new into lookahead */
+        finder->ReplaceChar(ctx, cur->windowHead,
+            uncodedLookahead[cur->uncodedHead]);
+
+        if (cur->next < cur->size)
         {
-            /* garbage beyond last data happened to extend match length */
-            matchData.length = len;
+            uncodedLookahead[cur->uncodedHead] = cur->in[cur->next];
+            uncodedLookahead[cur->uncodedHead + maxCoded] =
+                cur->in[cur->next];
+            cur->next++;
         }
+        else
+        {
+            /* hit the end before filling lookahead */
+            cur->len--;
+        }
+
+        cur->windowHead = Wrap((cur->windowHead + 1), ctx->windowSize);
+        cur->uncodedHead = Wrap((cur->uncodedHead + 1), maxCoded);
+        count--;
+    }
+}
+
+/****************************************************************************
+*   Function   : Find
+*   Description: This function finds the longest match for the lookahead
+*                of an encoder, cut to the input that is left.
+*   Parameters : ctx - the context being encoded with
+*                cur - where the encoder is in its input
+*   Effects    : NONE
+*   Returned   : The sliding window index where the match starts and the
+*                length of the match.
+****************************************************************************/
+static inline encoded_string_t Find(lzss_context_t *ctx,
+    const encode_cursor_t *cur)
+{
+    encoded_string_t matchData;
+
+    matchData = ctx->finder->FindMatch(ctx, cur->windowHead,
+        cur->uncodedHead);
+
+    if (matchData.length > cur->len)
+    {
+        /* garbage beyond last data happened to extend match length */
+        matchData.length = cur->len;
+    }
+
+    return matchData;
+}
+
+/****************************************************************************
+*   Function   : PutLiteral
+*   Description: This function writes an uncoded character.
+*   Parameters : ctx - the context being encoded with
+*                bitsOut - the bit stream to write to
+*                c - the character
+*   Effects    : The uncoded flag and c are written to bitsOut.
+*   Returned   : None
+****************************************************************************/
+static inline void PutLiteral(lzss_context_t *ctx, BitWriter &bitsOut,
+    unsigned char c)
+{
+    bitsOut.PutBit(UNCODED);
+    bitsOut.PutChar(c);
+    ctx->stats.tokens++;
+}
+
+/****************************************************************************
+*   Function   : PutString
+*   Description: This function writes an encoded string.
+*   Parameters : ctx - the context being encoded with
+*                bitsOut - the bit stream to write to
+*                matchData - the window index and length of the string,
+*                            which must be longer than MAX_UNCODED
+*   Effects    : The encoded flag, offset and length are written to bitsOut.
+*   Returned   : None
+****************************************************************************/
+static inline void PutString(lzss_context_t *ctx, BitWriter &bitsOut,
+    encoded_string_t matchData)
+{
+    unsigned int adjustedLen;
+
+    /* adjust the length of the match so minimun encoded len is 0*/
+    adjustedLen = matchData.length - (MAX_UNCODED + 1);
+
+    bitsOut.PutBit(ENCODED);
+    bitsOut.PutBitsNum(matchData.offset, ctx->format.offsetBits);
+    bitsOut.PutBitsNum(adjustedLen, ctx->format.lengthBits);
+    ctx->stats.tokens++;
+}
+
+/****************************************************************************
+*   Function   : ParseGreedy
+*   Description: This function encodes the rest of an encoder's input by
+*                coding the longest match at each position, or a single
+*                uncoded character if the match is too short.
+*   Parameters : ctx - the context being encoded with
+*                cur - where the encoder is in its input
+*                bitsOut - the bit stream to write to
+*   Effects    : The rest of the input is encoded and written to bitsOut.
+*                The statistics of ctx are updated.
+*   Returned   : None
+****************************************************************************/
+static void ParseGreedy(lzss_context_t *ctx, encode_cursor_t *cur,
+    BitWriter &bitsOut)
+{
+    lzss_stats_t *stats = &ctx->stats;
+    encoded_string_t matchData;
+
+    while (cur->len > 0)
+    {
+        double t1 = CycleTimer::currentSeconds();
+
+        matchData = Find(ctx, cur);
+
+        double t2 = CycleTimer::currentSeconds();
 
         if (matchData.length <= MAX_UNCODED)
         {
-            /* not long enough match.  write uncoded flag and character */
-            BitFilePutBit(UNCODED, bfpOut);
-            BitFilePutChar(uncodedLookahead[uncodedHead], bfpOut);
-
+            /* not long enough match.  write uncoded character */
+            PutLiteral(ctx, bitsOut, cur->in[CursorPosition(cur)]);
             matchData.length = 1;   /* set to 1 for 1 byte uncoded */
         }
         else
         {
-            unsigned int adjustedLen;
-
-            /* adjust the length of the match so minimun encoded len is 0*/
-            adjustedLen = matchData.length - (MAX_UNCODED + 1);
-
-            /* match length > MAX_UNCODED.  Encode as offset and length. */
-            BitFilePutBit(ENCODED, bfpOut);
-            BitFilePutBitsNum(bfpOut, &matchData.offset, OFFSET_BITS,
-                sizeof(unsigned int));
-            BitFilePutBitsNum(bfpOut, &adjustedLen, LENGTH_BITS,
-                sizeof(unsigned int));
+            PutString(ctx, bitsOut, matchData);
         }
 
-        double t2 = CycleTimer::currentSeconds();
-        
+        double t3 = CycleTimer::currentSeconds();
+
         /********************************************************************
         * Replace the matchData.length worth of bytes we've matched in the
-        * sliding window with new bytes from the input file.
+        * sliding window with new bytes from the input.
         ********************************************************************/
-        i = 0;
-        while ((i < matchData.length) && ((c = file_buf.GetChar()) != EOF))
+        Slide(ctx, cur, matchData.length);
+
+        double t4 = CycleTimer::currentSeconds();
+
+        // Update Statistics
+        stats->findTime += t2 - t1;
+        stats->writeTime += t3 - t2;
+        stats->updateTime += t4 - t3;
+    }
+}
+
+/****************************************************************************
+*   Function   : ParseLazy
+*   Description: This function encodes the rest of an encoder's input like
+*                ParseGreedy, except that before coding a match shorter
+*                than the level's maxLazy it looks for a longer one at the
+*                next position.  If there is one, the current character is
+*                written uncoded and the longer match takes its place.
+*   Parameters : ctx - the context being encoded with
+*                cur - where the encoder is in its input
+*                bitsOut - the bit stream to write to
+*   Effects    : The rest of the input is encoded and written to bitsOut.
+*                The statistics of ctx are updated.
+*   Returned   : None
+*
+*   NOTE: A match stays valid after the window slides past its position,
+*         because it is decoded from the window as it was there.
+****************************************************************************/
+static void ParseLazy(lzss_context_t *ctx, encode_cursor_t *cur,
+    BitWriter &bitsOut)
+{
+    lzss_stats_t *stats = &ctx->stats;
+    const unsigned int maxLazy = ctx->config->maxLazy;
+    encoded_string_t matchData, nextMatch;
+    unsigned char c;
+
+    double t1 = CycleTimer::currentSeconds();
+
+    matchData = Find(ctx, cur);
+
+    stats->findTime += CycleTimer::currentSeconds() - t1;
+
+    while (cur->len > 0)
+    {
+        c = cur->in[CursorPosition(cur)];
+
+        if ((matchData.length > MAX_UNCODED) &&
+            (matchData.length < maxLazy) && (matchData.length < cur->len))
         {
-            /* add old byte into sliding window and new into lookahead */
-            ReplaceChar(windowHead, uncodedLookahead[uncodedHead]);
-            uncodedLookahead[uncodedHead] = c;
-            windowHead = Wrap((windowHead + 1), WINDOW_SIZE);
-            uncodedHead = Wrap((uncodedHead + 1), MAX_CODED);
-            i++;
+            /* try the next position before settling for this match */
+            double t2 = CycleTimer::currentSeconds();
+
+            Slide(ctx, cur, 1);
+
+            double t3 = CycleTimer::currentSeconds();
+
+            nextMatch = Find(ctx, cur);
+
+            double t4 = CycleTimer::currentSeconds();
+
+            if (nextMatch.length > matchData.length)
+            {
+                PutLiteral(ctx, bitsOut, c);
+                matchData = nextMatch;
+            }
+            else
+            {
+                PutString(ctx, bitsOut, matchData);
+                Slide(ctx, cur, matchData.length - 1);
+
+                if (cur->len > 0)
+                {
+                    matchData = Find(ctx, cur);
+                }
+            }
+
+            double t5 = CycleTimer::currentSeconds();
+
+            /* the write and the rest of the slide are counted as update */
+            stats->updateTime += (t3 - t2) + (t5 - t4);
+            stats->findTime += t4 - t3;
+            continue;
         }
 
-        /* handle case where we hit EOF before filling lookahead */
-        while (i < matchData.length)
+        double t2 = CycleTimer::currentSeconds();
+
+        if (matchData.length <= MAX_UNCODED)
         {
-            ReplaceChar(windowHead, uncodedLookahead[uncodedHead]);
-            /* nothing to add to lookahead here */
-            windowHead = Wrap((windowHead + 1), WINDOW_SIZE);
-            uncodedHead = Wrap((uncodedHead + 1), MAX_CODED);
-            len--;
-            i++;
+            PutLiteral(ctx, bitsOut, c);
+            matchData.length = 1;
         }
-        
+        else
+        {
+            PutString(ctx, bitsOut, matchData);
+        }
+
         double t3 = CycleTimer::currentSeconds();
-        
-        /* find match for the remaining characters */
-        matchData = FindMatch(windowHead, uncodedHead);
-        
+
+        Slide(ctx, cur, matchData.length);
+
         double t4 = CycleTimer::currentSeconds();
-        
-        // Update Statistics
-        encoding_times[0] += t4 - t3;
-        encoding_times[1] += t2 - t1;
-        encoding_times[2] += t3 - t2;
+
+        if (cur->len > 0)
+        {
+            matchData = Find(ctx, cur);
+        }
+
+        double t5 = CycleTimer::currentSeconds();
+
+        stats->writeTime += t3 - t2;
+        stats->updateTime += t4 - t3;
+        stats->findTime += t5 - t4;
     }
+}
+
+/****************************************************************************
+*   Function   : ParseOptimal
+*   Description: This function encodes the rest of an encoder's input in
+*                blocks of OPTIMAL_BLOCK bytes.  The longest match at every
+*                position of a block is found first, then the cheapest way
+*                to code the block is worked out from its end: the price of
+*                a position is that of an uncoded character plus the price
+*                of the next position, or the least of an encoded string
+*                plus the price after it, over every length the match
+*                allows.
+*   Parameters : ctx - the context being encoded with
+*                cur - where the encoder is in its input
+*                bitsOut - the bit stream to write to
+*   Effects    : The rest of the input is encoded and written to bitsOut.
+*                The statistics of ctx are updated.
+*   Returned   : None
+*
+*   NOTE: Every encoded string costs the same number of bits, so any
+*         shorter prefix of the longest match is as good as another match
+*         of that length, and the longest matches are all the parse needs.
+****************************************************************************/
+static void ParseOptimal(lzss_context_t *ctx, encode_cursor_t *cur,
+    BitWriter &bitsOut)
+{
+    lzss_stats_t *stats = &ctx->stats;
+    const unsigned int literalBits = 1 + 8;
+    const unsigned int stringBits =
+        1 + ctx->format.offsetBits + ctx->format.lengthBits;
+    size_t blockStart, remaining;
+    unsigned int blockSize;
+    unsigned int i, j, length;
+    encoded_string_t matchData;
+
+    remaining = cur->len + (cur->size - cur->next);
+    blockSize = (unsigned int)std::min(remaining, (size_t)OPTIMAL_BLOCK);
+
+    std::vector<encoded_string_t> matches(blockSize);
+    std::vector<uint32_t> price(blockSize + 1);
+    std::vector<uint16_t> step(blockSize);
+
+    while (cur->len > 0)
+    {
+        double t1 = CycleTimer::currentSeconds();
+
+        blockStart = CursorPosition(cur);
+        remaining = cur->len + (cur->size - cur->next);
+        blockSize = (unsigned int)std::min(remaining, (size_t)OPTIMAL_BLOCK);
+
+        /* the longest match at every position of the block */
+        for (i = 0; i < blockSize; i++)
+        {
+            matches[i] = Find(ctx, cur);
+            Slide(ctx, cur, 1);
+        }
+
+        double t2 = CycleTimer::currentSeconds();
 
-    /* we've encoded everything, free bitfile structure */
-    BitFileToFILE(bfpOut);
+        /* the cheapest price from each position to the end of the block */
+        price[blockSize] = 0;
 
-   return 0;
+        for (i = blockSize; i-- > 0; )
+        {
+            price[i] = price[i + 1] + literalBits;
+            step[i] = 1;
+            length = std::min(matches[i].length, blockSize - i);
+
+            for (j = MAX_UNCODED + 1; j <= length; j++)
+            {
+                if (price[i + j] + stringBits <= price[i])
+                {
+                    /* ties go to the longer string */
+                    price[i] = price[i + j] + stringBits;
+                    step[i] = j;
+                }
+            }
+        }
+
+        /* write the cheapest parse */
+        for (i = 0; i < blockSize; i += step[i])
+        {
+            if (1 == step[i])
+            {
+                PutLiteral(ctx, bitsOut, cur->in[blockStart + i]);
+            }
+            else
+            {
+                matchData.offset = matches[i].offset;
+                matchData.length = step[i];
+                PutString(ctx, bitsOut, matchData);
+            }
+        }
+
+        double t3 = CycleTimer::currentSeconds();
+
+        /* finding and sliding are interleaved, so both count as finding */
+        stats->findTime += t2 - t1;
+        stats->writeTime += t3 - t2;
+    }
 }
 
 /****************************************************************************
 *   Function   : DecodeLZSSByFile
 *   Description: This function will read an LZSS encoded input file and
-*                write an output file.  This algorithm encodes strings as 16
-*                bits (a 12 bit offset + a 4 bit length).
+*                write an output file.  The window size and maximum match
+*                length are read from the stream's header.
 *   Parameters : fpIn - pointer to the open binary file to decode
 *                fpOut - pointer to the open binary file to write decoded
 *                       output
@@ -242,10 +1088,36 @@ int EncodeLZSS(FILE *fpIn, FILE *fpOut)
 ****************************************************************************/
 int DecodeLZSS(FILE *fpIn, FILE *fpOut)
 {
-    bit_file_t *bfpIn;
-    int c;
-    unsigned int i, nextChar;
-    encoded_string_t code;              /* offset/length code for string */
+    lzss_context_t *ctx;
+    int result;
+
+    if (NULL == (ctx = LZSSCreateContext()))
+    {
+        return -1;
+    }
+
+    result = DecodeLZSS(ctx, fpIn, fpOut);
+    LZSSFreeContext(ctx);
+
+    return result;
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSS
+*   Description: This function is the file version of DecodeLZSS using a
+*                context supplied by the caller.
+*   Parameters : ctx - the context to decode with
+*                fpIn - pointer to the open binary file to decode
+*                fpOut - pointer to the open binary file to write decoded
+*                       output
+*   Effects    : fpIn is decoded and written to fpOut.  Neither file is
+*                closed after exit.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int DecodeLZSS(lzss_context_t *ctx, FILE *fpIn, FILE *fpOut)
+{
+    std::vector<uint8_t> out;
 
     /* use stdin if no input file */
     if ((NULL == fpIn) || (NULL == fpOut))
@@ -254,27 +1126,162 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
         return -1;
     }
 
-    /* convert input file to bitfile */
-    bfpIn = MakeBitFile(fpIn, BF_READ);
+    if (NULL == ctx)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    FileMap input(fpIn);
+    return DecodeStream(ctx, input.Data(), input.Size(), out, fpOut);
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSS
+*   Description: This function will decode a buffer in memory that was
+*                encoded by either version of EncodeLZSS.
+*   Parameters : in - the encoded bytes
+*                size - the number of bytes at in
+*                out - vector the decoded bytes are appended to
+*   Effects    : The decoded bytes are appended to out.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int DecodeLZSS(const uint8_t *in, size_t size, std::vector<uint8_t> &out)
+{
+    lzss_context_t *ctx;
+    int result;
+
+    if (NULL == (ctx = LZSSCreateContext()))
+    {
+        return -1;
+    }
+
+    result = DecodeLZSS(ctx, in, size, out);
+    LZSSFreeContext(ctx);
+
+    return result;
+}
 
-    if (NULL == bfpIn)
+/****************************************************************************
+*   Function   : DecodeLZSS
+*   Description: This function is the memory version of DecodeLZSS using a
+*                context supplied by the caller.
+*   Parameters : ctx - the context to decode with
+*                in - the encoded bytes
+*                size - the number of bytes at in
+*                out - vector the decoded bytes are appended to
+*   Effects    : The decoded bytes are appended to out.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int DecodeLZSS(lzss_context_t *ctx, const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out)
+{
+    if ((NULL == ctx) || ((NULL == in) && (size > 0)))
     {
-        perror("Making Input File a BitFile");
+        errno = EINVAL;
         return -1;
     }
 
+    return DecodeStream(ctx, in, size, out, NULL);
+}
+
+/****************************************************************************
+*   Function   : DecodeStream
+*   Description: This function reads the header of an encoded stream and
+*                decodes the bit stream after it.  It is the body of both
+*                versions of DecodeLZSS.
+*   Parameters : ctx - the context to decode with
+*                in - the encoded stream
+*                size - the number of bytes at in
+*                out - vector the decoded bytes are appended to
+*                fpOut - if not NULL, the file out is written to (see
+*                       DecodeBuffer)
+*   Effects    : The stream is decoded into out or fpOut.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.  A stream without a valid header fails
+*                with EILSEQ.
+****************************************************************************/
+static int DecodeStream(lzss_context_t *ctx, const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out, FILE *fpOut)
+{
+    lzss_format_t format;
+
+    if ((size < HEADER_SIZE) ||
+        (memcmp(in, STREAM_MAGIC, STREAM_MAGIC_SIZE) != 0))
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    format.offsetBits = in[STREAM_MAGIC_SIZE];
+    format.lengthBits = in[STREAM_MAGIC_SIZE + 1];
+
+    if (LZSSFormatIndex(format) < 0)
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    if (UseFormat(ctx, format) != 0)
+    {
+        return -1;
+    }
+
+    BitReader bitsIn(in + HEADER_SIZE, size - HEADER_SIZE);
+    return DecodeBuffer(ctx, bitsIn, out, fpOut);
+}
+
+/****************************************************************************
+*   Function   : DecodeBuffer
+*   Description: This function decodes a bit stream into a vector.
+*   Parameters : ctx - the context to decode with, sized for the format of
+*                      the stream
+*                bitsIn - the bit stream to decode
+*                out - vector the decoded bytes are appended to
+*                fpOut - if not NULL, out is written to this file and
+*                       emptied whenever it holds READ_BLOCK_SIZE bytes, and
+*                       at the end
+*   Effects    : bitsIn is decoded into out or fpOut.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+static int DecodeBuffer(lzss_context_t *ctx, BitReader &bitsIn,
+    std::vector<uint8_t> &out, FILE *fpOut)
+{
+    const unsigned int windowSize = ctx->windowSize;
+    unsigned char *slidingWindow = ctx->slidingWindow;
+    unsigned char *uncodedLookahead = ctx->uncodedLookahead;
+    int c;
+    unsigned int i, nextChar;
+    encoded_string_t code;              /* offset/length code for string */
+
+    TRACE_SCOPE("decode");
+    PERF_SCOPE("decode");
+
     /************************************************************************
     * Fill the sliding window buffer with some known vales.  EncodeLZSS must
     * use the same values.  If common characters are used, there's an
     * increased chance of matching to the earlier strings.
     ************************************************************************/
-    memset(slidingWindow, ' ', WINDOW_SIZE * sizeof(unsigned char));
+    memset(slidingWindow, ' ', windowSize * sizeof(unsigned char));
 
     nextChar = 0;
 
     while (1)
     {
-        if ((c = BitFileGetBit(bfpIn)) == EOF)
+        if ((NULL != fpOut) && (out.size() >= READ_BLOCK_SIZE))
+        {
+            if (fwrite(out.data(), 1, out.size(), fpOut) != out.size())
+            {
+                return -1;
+            }
+
+            out.clear();
+        }
+
+        if ((c = bitsIn.GetBit()) == EOF)
         {
             /* we hit the EOF */
             break;
@@ -283,15 +1290,15 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
         if (c == UNCODED)
         {
             /* uncoded character */
-            if ((c = BitFileGetChar(bfpIn)) == EOF)
+            if ((c = bitsIn.GetChar()) == EOF)
             {
                 break;
             }
 
             /* write out byte and put it in sliding window */
-            putc(c, fpOut);
+            out.push_back(c);
             slidingWindow[nextChar] = c;
-            nextChar = Wrap((nextChar + 1), WINDOW_SIZE);
+            nextChar = Wrap((nextChar + 1), windowSize);
         }
         else
         {
@@ -299,14 +1306,12 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
             code.offset = 0;
             code.length = 0;
 
-            if ((BitFileGetBitsNum(bfpIn, &code.offset, OFFSET_BITS,
-                sizeof(unsigned int))) == EOF)
+            if (bitsIn.GetBitsNum(&code.offset, ctx->format.offsetBits) == EOF)
             {
                 break;
             }
 
-            if ((BitFileGetBitsNum(bfpIn, &code.length, LENGTH_BITS,
-                sizeof(unsigned int))) == EOF)
+            if (bitsIn.GetBitsNum(&code.length, ctx->format.lengthBits) == EOF)
             {
                 break;
             }
@@ -314,31 +1319,116 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
             code.length += MAX_UNCODED + 1;
 
             /****************************************************************
-            * Write out decoded string to file and lookahead.  It would be
-            * nice to write to the sliding window instead of the lookahead,
-            * but we could end up overwriting the matching string with the
-            * new string if abs(offset - next char) < match length.
+            * Write out decoded string to the output and lookahead.  It would
+            * be nice to write to the sliding window instead of the
+            * lookahead, but we could end up overwriting the matching string
+            * with the new string if abs(offset - next char) < match length.
             ****************************************************************/
             for (i = 0; i < code.length; i++)
             {
-                c = slidingWindow[Wrap((code.offset + i), WINDOW_SIZE)];
-                putc(c, fpOut);
+                c = slidingWindow[Wrap((code.offset + i), windowSize)];
+                out.push_back(c);
                 uncodedLookahead[i] = c;
             }
 
             /* write out decoded string to sliding window */
             for (i = 0; i < code.length; i++)
             {
-                slidingWindow[Wrap((nextChar + i), WINDOW_SIZE)] =
+                slidingWindow[Wrap((nextChar + i), windowSize)] =
                     uncodedLookahead[i];
             }
 
-            nextChar = Wrap((nextChar + code.length), WINDOW_SIZE);
+            nextChar = Wrap((nextChar + code.length), windowSize);
         }
     }
 
-    /* we've decoded everything, free bitfile structure */
-    BitFileToFILE(bfpIn);
+    if ((NULL != fpOut) &&
+        (fwrite(out.data(), 1, out.size(), fpOut) != out.size()))
+    {
+        return -1;
+    }
 
     return 0;
 }
+
+/****************************************************************************
+*   Function   : LZSSFinderName
+*   Description: This function returns the name of a match finder, as
+*                accepted by LZSSFinderByName.
+*   Parameters : finder - the match finder
+*   Effects    : None
+*   Returned   : The name, or NULL if finder is not a match finder.
+****************************************************************************/
+const char *LZSSFinderName(lzss_finder_t finder)
+{
+    if ((finder < 0) || (finder >= LZSS_NUM_FINDERS))
+    {
+        return NULL;
+    }
+
+    return finders[finder]->name;
+}
+
+/****************************************************************************
+*   Function   : LZSSFinderByName
+*   Description: This function looks up a match finder by its name.
+*   Parameters : name - brute, list, hash, kmp, tree, chain or suffix
+*                finder - set to the match finder if the name is known
+*   Effects    : finder is set if the name is known.
+*   Returned   : 0 for success, -1 if the name is not known.
+****************************************************************************/
+int LZSSFinderByName(const char *name, lzss_finder_t *finder)
+{
+    int i;
+
+    for (i = 0; i < LZSS_NUM_FINDERS; i++)
+    {
+        if (strcmp(name, finders[i]->name) == 0)
+        {
+            *finder = (lzss_finder_t)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/****************************************************************************
+*   Function   : LZSSCheckFormat
+*   Description: This function checks that the library supports a format.
+*   Parameters : format - the window size and maximum match length
+*   Effects    : None
+*   Returned   : 0 if format is supported, -1 if not.  errno will be set
+*                to EINVAL for an unsupported format.
+****************************************************************************/
+int LZSSCheckFormat(lzss_format_t format)
+{
+    if (LZSSFormatIndex(format) < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : LZSSDefaultFinder
+*   Description: This function chooses the match finder for a format when
+*                the caller doesn't.  The tree keeps its nodes sorted by
+*                comparing whole strings, which is cheap for 18 byte
+*                matches but far too slow for 258 byte ones, so those use
+*                hash chains.
+*   Parameters : format - the window size and maximum match length
+*   Effects    : None
+*   Returned   : The match finder for format.
+****************************************************************************/
+lzss_finder_t LZSSDefaultFinder(lzss_format_t format)
+{
+    if (format.lengthBits > 4)
+    {
+        return LZSS_FIND_CHAIN;
+    }
+
+    return LZSS_DEFAULT_FINDER;
+}
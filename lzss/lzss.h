@@ -34,11 +34,101 @@
 #define _LZSS_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+
+/***************************************************************************
+* Methods of searching the sliding window for matches.  Every method is
+* built into the library and is chosen for each call to EncodeLZSS.  The
+* choice doesn't change the format; any stream decodes the same way.
+***************************************************************************/
+typedef enum
+{
+    LZSS_FIND_BRUTE = 0,    /* compare with every window position */
+    LZSS_FIND_LIST,         /* linked list of positions of each character */
+    LZSS_FIND_HASH,         /* hash of the first MAX_UNCODED + 1 characters */
+    LZSS_FIND_KMP,          /* Knuth-Morris-Pratt search of the window */
+    LZSS_FIND_TREE,         /* sorted binary tree of window strings */
+    LZSS_FIND_CHAIN,        /* hash chains searched as far as the level */
+    LZSS_FIND_SUFFIX,       /* suffix arrays of the input, built in parallel */
+    LZSS_NUM_FINDERS
+} lzss_finder_t;
+
+/* for the default format; see LZSSDefaultFinder for the others */
+#define LZSS_DEFAULT_FINDER     LZSS_FIND_TREE
+
+/***************************************************************************
+* The window size and longest match of a stream, given as the number of
+* bits in the offset and the length of an encoded string.  Windows of 4 KB
+* (12 offset bits) to 1 MB (20 offset bits) are supported, with matches of
+* up to 18 bytes (4 length bits) or 258 bytes (8 length bits).  Streams
+* record their format in a header, so decoding needs no parameters.
+***************************************************************************/
+typedef struct lzss_format_t
+{
+    unsigned int offsetBits;    /* window of 1 << offsetBits bytes */
+    unsigned int lengthBits;    /* longest match (1 << lengthBits) + 2 */
+} lzss_format_t;
+
+#define LZSS_MIN_OFFSET_BITS    12
+#define LZSS_MAX_OFFSET_BITS    20
+
+/* 4 KB window and 18 byte matches */
+#define LZSS_DEFAULT_FORMAT     {12, 4}
+
+/***************************************************************************
+* Compression levels, from fastest (1) to smallest output (9).  A level
+* only changes how hard the encoder searches, so it isn't recorded in the
+* stream.  Levels 1 to 3 code the longest match at each position, 4 to 7
+* check the next position for a longer one first (lazy matching) and 8 and
+* 9 work out the cheapest coding of each block (optimal parsing).  The
+* chain and suffix finders also search further at higher levels; the
+* others always search all of their structures.
+***************************************************************************/
+#define LZSS_MIN_LEVEL          1
+#define LZSS_MAX_LEVEL          9
+#define LZSS_DEFAULT_LEVEL      6
+
+/* bytes of input in each block of the parallel format */
+#define LZSS_BLOCK_SIZE         (1 << 20)
+
+/***************************************************************************
+* A context holds the sliding window, the match finder's search structures
+* and the statistics of one encoder or decoder.  A context may only be used
+* by one call at a time, but calls with different contexts may run
+* concurrently.  The calls without a context use one of their own.
+***************************************************************************/
+typedef struct lzss_context_t lzss_context_t;
+
+/***************************************************************************
+* Time spent in each step of encoding, and the number of tokens (coded
+* strings and uncoded characters) written, summed over the encodes done
+* with a context.
+***************************************************************************/
+typedef struct lzss_stats_t
+{
+    double findTime;        /* seconds finding matches */
+    double writeTime;       /* seconds writing tokens */
+    double updateTime;      /* seconds updating the sliding window */
+    unsigned long tokens;
+} lzss_stats_t;
+
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
 
-extern double encoding_times[3];
+/***************************************************************************
+* LZSSCreateContext returns a new context, or NULL with errno set if there
+* isn't memory for one.  LZSSFreeContext frees a context and its search
+* structures.  LZSSGetStats returns the statistics of a context.
+***************************************************************************/
+lzss_context_t *LZSSCreateContext(void);
+void LZSSFreeContext(lzss_context_t *ctx);
+const lzss_stats_t *LZSSGetStats(const lzss_context_t *ctx);
 
 /***************************************************************************
 * LZSS encoding and decoding prototypes for functions with file pointer
@@ -51,7 +141,76 @@ extern double encoding_times[3];
 * These functions return 0 for success and -1 for failure.  errno will be
 * set in the event of a failure. 
 ***************************************************************************/
-int EncodeLZSS(FILE *fpIn, FILE *fpOut);
+int EncodeLZSS(FILE *fpIn, FILE *fpOut,
+    lzss_finder_t finder = LZSS_DEFAULT_FINDER,
+    lzss_format_t format = LZSS_DEFAULT_FORMAT,
+    int level = LZSS_DEFAULT_LEVEL);
 int DecodeLZSS(FILE *fpIn, FILE *fpOut);
+int EncodeLZSS(lzss_context_t *ctx, FILE *fpIn, FILE *fpOut,
+    lzss_finder_t finder = LZSS_DEFAULT_FINDER,
+    lzss_format_t format = LZSS_DEFAULT_FORMAT,
+    int level = LZSS_DEFAULT_LEVEL);
+int DecodeLZSS(lzss_context_t *ctx, FILE *fpIn, FILE *fpOut);
+
+/***************************************************************************
+* LZSS encoding and decoding prototypes for functions with memory buffer
+* parameters.  Provide these functions with the size bytes to be
+* encoded/decoded at in; the result is appended to out.  The encoded format
+* is the same as that of the file versions.
+*
+* These functions return 0 for success and -1 for failure.  errno will be
+* set in the event of a failure.
+***************************************************************************/
+int EncodeLZSS(const uint8_t *in, size_t size, std::vector<uint8_t> &out,
+    lzss_finder_t finder = LZSS_DEFAULT_FINDER,
+    lzss_format_t format = LZSS_DEFAULT_FORMAT,
+    int level = LZSS_DEFAULT_LEVEL);
+int DecodeLZSS(const uint8_t *in, size_t size, std::vector<uint8_t> &out);
+int EncodeLZSS(lzss_context_t *ctx, const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out, lzss_finder_t finder = LZSS_DEFAULT_FINDER,
+    lzss_format_t format = LZSS_DEFAULT_FORMAT,
+    int level = LZSS_DEFAULT_LEVEL);
+int DecodeLZSS(lzss_context_t *ctx, const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out);
+
+/***************************************************************************
+* Block parallel LZSS, with file and memory versions like those above.  The
+* input is split into blocks of blockSize bytes that are encoded, and
+* decoded, on all OpenMP threads.  Each block may refer to the window of
+* data before it, so little is lost to the split.  The stream starts with
+* an index of the blocks and can only be decoded by DecodeLZSSParallel.
+*
+* These functions return 0 for success and -1 for failure.  errno will be
+* set in the event of a failure.
+***************************************************************************/
+int EncodeLZSSParallel(FILE *fpIn, FILE *fpOut,
+    lzss_finder_t finder = LZSS_DEFAULT_FINDER,
+    lzss_format_t format = LZSS_DEFAULT_FORMAT,
+    int level = LZSS_DEFAULT_LEVEL, size_t blockSize = LZSS_BLOCK_SIZE);
+int DecodeLZSSParallel(FILE *fpIn, FILE *fpOut);
+int EncodeLZSSParallel(const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out, lzss_finder_t finder = LZSS_DEFAULT_FINDER,
+    lzss_format_t format = LZSS_DEFAULT_FORMAT,
+    int level = LZSS_DEFAULT_LEVEL, size_t blockSize = LZSS_BLOCK_SIZE);
+int DecodeLZSSParallel(const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out);
+
+/***************************************************************************
+* Match finder names (brute, list, hash, kmp, tree, chain and suffix) for
+* command lines and reports.  LZSSFinderName returns NULL for an unknown
+* finder and LZSSFinderByName returns -1 for an unknown name.
+***************************************************************************/
+const char *LZSSFinderName(lzss_finder_t finder);
+int LZSSFinderByName(const char *name, lzss_finder_t *finder);
+
+/* 0 if the library supports a format, -1 with errno set to EINVAL if not */
+int LZSSCheckFormat(lzss_format_t format);
+
+/***************************************************************************
+* The match finder to use for a format when none is chosen: the tree for
+* 18 byte matches, and hash chains for 258 byte matches, where walking the
+* tree compares up to 258 bytes at every node it passes.
+***************************************************************************/
+lzss_finder_t LZSSDefaultFinder(lzss_format_t format);
 
 #endif      /* ndef _LZSS_H */
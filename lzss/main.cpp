@@ -37,8 +37,12 @@
 #include <string.h>
 #include <string>
 #include <exception>
+#include <omp.h>
 #include "lzss.h"
+#include "CycleTimer.h"
 #include "optlist.h"
+#include "trace.h"
+#include "perf_counters.h"
 
 using std::string;
 using std::exception;
@@ -77,9 +81,20 @@ int main(int argc, char *argv[])
     string infile_name;
     string outfile_name;
     modes_t mode = TEST;
+    const char *traceFile = NULL;  /* Chrome trace output, if any */
+    int counters = 0;               /* report hardware counters */
+    lzss_finder_t finder = LZSS_DEFAULT_FINDER;
+    int finderSet = 0;              /* -m given, else chosen by format */
+    lzss_format_t format = LZSS_DEFAULT_FORMAT;
+    int level = LZSS_DEFAULT_LEVEL;
+    int parallel = 0;               /* block parallel format */
+    int status = 0;                 /* result of encode or decode */
+    double encodeTime, decodeTime;
+    lzss_context_t *ctx;           /* encoder/decoder state and statistics */
+    const lzss_stats_t *stats;
 
     /* parse command line */
-    optList = GetOptList(argc, argv, "cdi:o:h?");
+    optList = GetOptList(argc, argv, "cdi:o:m:w:l:L:pT:Hh?");
     thisOpt = optList;
 
     while (thisOpt != NULL)
@@ -104,6 +119,41 @@ int main(int argc, char *argv[])
                 outfile_name = thisOpt->argument;
                 break;
 
+            case 'm':       /* match finder */
+                if (LZSSFinderByName(thisOpt->argument, &finder) != 0)
+                {
+                    fprintf(stderr, "Unknown match finder %s\n",
+                        thisOpt->argument);
+                    FreeOptList(optList);
+                    return 1;
+                }
+                finderSet = 1;
+                break;
+
+            case 'w':       /* offset bits: window size */
+                format.offsetBits = atoi(thisOpt->argument);
+                break;
+
+            case 'l':       /* length bits: longest match */
+                format.lengthBits = atoi(thisOpt->argument);
+                break;
+
+            case 'L':       /* compression level */
+                level = atoi(thisOpt->argument);
+                break;
+
+            case 'p':       /* block parallel format */
+                parallel = 1;
+                break;
+
+            case 'T':       /* trace file name */
+                traceFile = thisOpt->argument;
+                break;
+
+            case 'H':       /* hardware counters */
+                counters = 1;
+                break;
+
             case 'h':
             case '?':
                 printf("Usage: %s <options>\n\n", FindFileName(argv[0]));
@@ -113,6 +163,26 @@ int main(int argc, char *argv[])
                 printf("  -d : Decode input file to output file.\n");
                 printf("  -i <filename> : Name of input file.\n");
                 printf("  -o <filename> : Name of output file.\n");
+                printf("  -m <finder> : Match finder used to encode: brute, "
+                    "list, hash, kmp, tree, chain\n"
+                    "              or suffix.\n"
+                    "              Default: %s, or %s with -l 8\n",
+                    LZSSFinderName(LZSS_DEFAULT_FINDER),
+                    LZSSFinderName(LZSSDefaultFinder({12, 8})));
+                printf("  -w <bits> : Offset bits, for a window of 2^bits "
+                    "bytes: %d to %d.\n              Default: %d\n",
+                    LZSS_MIN_OFFSET_BITS, LZSS_MAX_OFFSET_BITS,
+                    format.offsetBits);
+                printf("  -l <bits> : Length bits, for matches of up to "
+                    "2^bits + 2 bytes: 4 or 8.\n              Default: %d\n",
+                    format.lengthBits);
+                printf("  -L <level> : Search and parse effort: "
+                    "%d (fast) to %d (small).\n              Default: %d\n",
+                    LZSS_MIN_LEVEL, LZSS_MAX_LEVEL, level);
+                printf("  -p : Encode/decode %d KB blocks on all threads.\n",
+                    LZSS_BLOCK_SIZE >> 10);
+                printf("  -T <filename> : Write a Chrome trace (TRACE=1 build).\n");
+                printf("  -H : Report hardware counters of encode and decode.\n");
                 printf("  -h | ?  : Print out command line options.\n\n");
                 printf("Default: %s -c -i stdin -o stdout\n",
                     FindFileName(argv[0]));
@@ -126,8 +196,47 @@ int main(int argc, char *argv[])
         thisOpt = optList;
     }
 
-    // Initialize the timer
-    memset(encoding_times, 0, 3 * sizeof(double));
+    if (LZSSCheckFormat(format) != 0)
+    {
+        fprintf(stderr, "Unsupported format: %u offset bits, %u length "
+            "bits\n", format.offsetBits, format.lengthBits);
+        return 1;
+    }
+
+    if ((level < LZSS_MIN_LEVEL) || (level > LZSS_MAX_LEVEL))
+    {
+        fprintf(stderr, "Unsupported level: %d\n", level);
+        return 1;
+    }
+
+    if (!finderSet)
+    {
+        finder = LZSSDefaultFinder(format);
+    }
+    else if ((LZSS_FIND_TREE == finder) &&
+        (finder != LZSSDefaultFinder(format)))
+    {
+        fprintf(stderr, "Warning: the tree finder is very slow with %u byte "
+            "matches; try -m %s\n", (1u << format.lengthBits) + 2,
+            LZSSFinderName(LZSSDefaultFinder(format)));
+    }
+
+    if ((ctx = LZSSCreateContext()) == NULL)
+    {
+        perror("Creating LZSS context");
+        return 1;
+    }
+
+    if (traceFile != NULL)
+    {
+        trace_start();
+    }
+
+    if (counters && !perf_start())
+    {
+        fprintf(stderr, "Hardware counters are not available on this "
+            "machine\n");
+    }
   
     /* we have valid parameters encode or decode */
     if (mode == TEST) {
@@ -135,16 +244,40 @@ int main(int argc, char *argv[])
         // Step 1: Compressed the input file
         fpIn = fopen(infile_name.c_str(), "rb");
         fpOut = OpenFile("compressed", "wb");
-        EncodeLZSS(fpIn, fpOut);
+        encodeTime = CycleTimer::currentSeconds();
+        if (parallel)
+            status = EncodeLZSSParallel(fpIn, fpOut, finder, format, level);
+        else
+            status = EncodeLZSS(ctx, fpIn, fpOut, finder, format, level);
+        encodeTime = CycleTimer::currentSeconds() - encodeTime;
         fclose(fpIn);
         fclose(fpOut);
+
+        if (status != 0)
+        {
+            perror("Encoding");
+            LZSSFreeContext(ctx);
+            return 1;
+        }
         
         // Step 2: Decompressed the intermediate file
         fpIn = OpenFile("compressed", "rb");
         fpOut = OpenFile("decompressed", "wb");
-        DecodeLZSS(fpIn, fpOut);
+        decodeTime = CycleTimer::currentSeconds();
+        if (parallel)
+            status = DecodeLZSSParallel(fpIn, fpOut);
+        else
+            status = DecodeLZSS(ctx, fpIn, fpOut);
+        decodeTime = CycleTimer::currentSeconds() - decodeTime;
         fclose(fpIn);
         fclose(fpOut);
+
+        if (status != 0)
+        {
+            perror("Decoding");
+            LZSSFreeContext(ctx);
+            return 1;
+        }
         
         // Step 3: Test the correctness
         string cmd = string("diff decompressed ") + infile_name;
@@ -160,26 +293,81 @@ int main(int argc, char *argv[])
         // length is written to the file. Thirdly, the matching bytes are moved from
         // lookahead buffer to the sliding window. Also, more characters are read
         // from disk to fill the lookahead buffer
+        stats = LZSSGetStats(ctx);
         fprintf(stdout, "********* Encoding Statistics **********\n");
-        fprintf(stdout, "Step 1 (find string match) takes %f seconds\n",
-                encoding_times[0]);
-        fprintf(stdout, "Step 2 (write encoded str to file) takes %f seconds\n",
-                encoding_times[1]);
-        fprintf(stdout, "Step 3 (Update sliding window and read more chars) takes"
-                " %f seconds\n", encoding_times[2]);
+        fprintf(stdout, "Match finder: %s, %u KB window, %u byte matches, "
+                "level %d\n", LZSSFinderName(finder),
+                (1u << format.offsetBits) >> 10,
+                (1u << format.lengthBits) + 2, level);
+        if (parallel) {
+            // The blocks' contexts are internal; only totals are known
+            fprintf(stdout, "Block parallel on %d threads: encode %f seconds, "
+                    "decode %f seconds\n", omp_get_max_threads(), encodeTime,
+                    decodeTime);
+        } else {
+            fprintf(stdout, "Step 1 (find string match) takes %f seconds\n",
+                    stats->findTime);
+            fprintf(stdout, "Step 2 (write encoded str) takes %f seconds, %.1f "
+                    "ns per token for %lu tokens\n", stats->writeTime,
+                    stats->tokens ? stats->writeTime * 1e9 / stats->tokens : 0.0,
+                    stats->tokens);
+            fprintf(stdout, "Step 3 (Update sliding window and read more chars) "
+                    "takes %f seconds\n", stats->updateTime);
+        }
     } else {
         /* use stdin/out if no files are provided */
         fpIn = infile_name.empty() ? stdin : fopen(infile_name.c_str(), "rb");
+        if (NULL == fpIn)
+        {
+            perror(infile_name.c_str());
+            LZSSFreeContext(ctx);
+            return 1;
+        }
+
         fpOut = outfile_name.empty() ? stdout : fopen(outfile_name.c_str(), "wb");
+        if (NULL == fpOut)
+        {
+            perror(outfile_name.c_str());
+            fclose(fpIn);
+            LZSSFreeContext(ctx);
+            return 1;
+        }
         
         if (mode == ENCODE) {
-            EncodeLZSS(fpIn, fpOut);
+            if (parallel)
+                status = EncodeLZSSParallel(fpIn, fpOut, finder, format, level);
+            else
+                status = EncodeLZSS(ctx, fpIn, fpOut, finder, format, level);
         } else if (mode == DECODE) {
-            DecodeLZSS(fpIn, fpOut);
+            if (parallel)
+                status = DecodeLZSSParallel(fpIn, fpOut);
+            else
+                status = DecodeLZSS(ctx, fpIn, fpOut);
         }
         
         fclose(fpIn);
         fclose(fpOut);
+
+        if (status != 0)
+        {
+            perror((mode == ENCODE) ? "Encoding" : "Decoding");
+            LZSSFreeContext(ctx);
+            return 1;
+        }
+    }
+
+    LZSSFreeContext(ctx);
+
+    if (counters)
+    {
+        fprintf(stdout, "********* Hardware Counters **********\n");
+        perf_report(stdout);
+    }
+
+    if ((traceFile != NULL) && !trace_dump(traceFile))
+    {
+        fprintf(stderr, "No trace written to %s (tracing needs a TRACE=1 "
+            "build)\n", traceFile);
     }
 
     return 0;
@@ -0,0 +1,568 @@
+/***************************************************************************
+*          Lempel, Ziv, Storer, and Szymanski Encoding and Decoding
+*
+*   File    : parallel.cpp
+*   Purpose : Block parallel LZSS.  The input is cut into blocks that are
+*             encoded at the same time by OpenMP threads, each with its own
+*             context.  A block starts with the window of bytes before it
+*             in its sliding window, so it can still refer to them.
+*
+*             Stream layout (integers are little endian):
+*               "LZSB"                      magic
+*               uint8 offsetBits            the format of every block
+*               uint8 lengthBits
+*               uint32 blockSize            bytes of input per block
+*               uint32 blocks               number of blocks
+*               blocks x {uint32 encoded,   bytes of the block's bit stream
+*                         uint32 decoded}   bytes the block decodes to;
+*                                           blockSize but for the last
+*               the bit streams of the blocks, each padded to a whole byte
+*
+*             The index lets every block be decoded at once.  Bytes copied
+*             from the block before can't be known until that block is done,
+*             so the decoder notes them and copies them in a short serial
+*             pass at the end.
+*
+***************************************************************************/
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <omp.h>
+#include <algorithm>
+#include "lzss.h"
+#include "lzlocal.h"
+#include "bitstream.h"
+#include "file_buffer.h"
+#include "trace.h"
+
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+#define BLOCK_MAGIC         "LZSB"
+#define BLOCK_MAGIC_SIZE    4
+
+/* magic, format, block size and block count, then two words per block */
+#define HEADER_SIZE         (BLOCK_MAGIC_SIZE + 2 + 4 + 4)
+#define INDEX_ENTRY_SIZE    8
+
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+
+/***************************************************************************
+* A run of bytes a block copies from data that wasn't decoded yet when the
+* block was.  out[dst + i] = out[src + i] once the blocks before are done.
+***************************************************************************/
+typedef struct deferred_copy_t
+{
+    size_t dst;
+    size_t src;
+    size_t length;
+} deferred_copy_t;
+
+/***************************************************************************
+*                               PROTOTYPES
+***************************************************************************/
+static void PutWord(uint8_t *out, uint32_t value);
+static uint32_t GetWord(const uint8_t *in);
+static int DecodeBlock(const uint8_t *in, size_t size, uint8_t *out,
+    size_t blockStart, size_t blockSize, lzss_format_t format,
+    std::vector<deferred_copy_t> &deferred);
+
+/***************************************************************************
+*                                FUNCTIONS
+***************************************************************************/
+
+/****************************************************************************
+*   Function   : EncodeLZSSParallel
+*   Description: This function encodes a buffer in memory as independent
+*                blocks, using every OpenMP thread.
+*   Parameters : in - the bytes to encode
+*                size - the number of bytes at in
+*                out - vector the encoded stream is appended to
+*                finder - method used to search the sliding window
+*                format - window size and maximum match length
+*                level - how hard to search for matches
+*                blockSize - bytes of input per block
+*   Effects    : The block index and the encoded blocks are appended to out.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int EncodeLZSSParallel(const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out, lzss_finder_t finder, lzss_format_t format,
+    int level, size_t blockSize)
+{
+    size_t numBlocks, headerStart, offset;
+    long b;
+    int result;
+
+    if (((NULL == in) && (size > 0)) || (0 == blockSize) ||
+        (blockSize > UINT32_MAX) || (finder < 0) ||
+        (finder >= LZSS_NUM_FINDERS) || (LZSSFormatIndex(format) < 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    TRACE_SCOPE("encode parallel");
+
+    numBlocks = (size + blockSize - 1) / blockSize;
+
+    if (numBlocks > UINT32_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    std::vector<std::vector<uint8_t> > blocks(numBlocks);
+    result = 0;
+
+    #pragma omp parallel
+    {
+        lzss_context_t *ctx = LZSSCreateContext();
+
+        #pragma omp for schedule(dynamic)
+        for (b = 0; b < (long)numBlocks; b++)
+        {
+            size_t start = b * blockSize;
+            size_t length = std::min(blockSize, size - start);
+            size_t prime = std::min((size_t)1 << format.offsetBits, start);
+
+            if ((NULL == ctx) || (EncodePrimedLZSS(ctx, in + start, length,
+                prime, blocks[b], finder, format, level) != 0) ||
+                (blocks[b].size() > UINT32_MAX))
+            {
+                #pragma omp atomic write
+                result = -1;
+            }
+        }
+
+        LZSSFreeContext(ctx);
+    }
+
+    if (result != 0)
+    {
+        return -1;
+    }
+
+    /* the index, then the blocks */
+    headerStart = out.size();
+    offset = headerStart + HEADER_SIZE + numBlocks * INDEX_ENTRY_SIZE;
+    out.resize(offset);
+    memcpy(&out[headerStart], BLOCK_MAGIC, BLOCK_MAGIC_SIZE);
+    out[headerStart + BLOCK_MAGIC_SIZE] = (uint8_t)format.offsetBits;
+    out[headerStart + BLOCK_MAGIC_SIZE + 1] = (uint8_t)format.lengthBits;
+    PutWord(&out[headerStart + BLOCK_MAGIC_SIZE + 2], (uint32_t)blockSize);
+    PutWord(&out[headerStart + BLOCK_MAGIC_SIZE + 6], (uint32_t)numBlocks);
+
+    for (b = 0; b < (long)numBlocks; b++)
+    {
+        uint8_t *entry = &out[headerStart + HEADER_SIZE +
+            b * INDEX_ENTRY_SIZE];
+
+        PutWord(entry, (uint32_t)blocks[b].size());
+        PutWord(entry + 4,
+            (uint32_t)std::min(blockSize, size - b * blockSize));
+        out.insert(out.end(), blocks[b].begin(), blocks[b].end());
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSSParallel
+*   Description: This function decodes a stream written by
+*                EncodeLZSSParallel, decoding its blocks at the same time.
+*   Parameters : in - the encoded stream
+*                size - the number of bytes at in
+*                out - vector the decoded bytes are appended to
+*   Effects    : The decoded bytes are appended to out.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.  A stream that is cut short, has an
+*                unknown format or whose blocks don't match the index fails
+*                with EILSEQ, as does an index claiming more bytes than the
+*                block size or than the block's bits could hold, before
+*                anything is allocated for them.
+****************************************************************************/
+int DecodeLZSSParallel(const uint8_t *in, size_t size,
+    std::vector<uint8_t> &out)
+{
+    lzss_format_t format;
+    size_t numBlocks, blockSize, maxCoded, tokenBits, outStart, total, i;
+    long b;
+    int result;
+
+    if ((NULL == in) && (size > 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((size < HEADER_SIZE) ||
+        (memcmp(in, BLOCK_MAGIC, BLOCK_MAGIC_SIZE) != 0))
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    format.offsetBits = in[BLOCK_MAGIC_SIZE];
+    format.lengthBits = in[BLOCK_MAGIC_SIZE + 1];
+
+    if (LZSSFormatIndex(format) < 0)
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    TRACE_SCOPE("decode parallel");
+
+    blockSize = GetWord(in + BLOCK_MAGIC_SIZE + 2);
+    numBlocks = GetWord(in + BLOCK_MAGIC_SIZE + 6);
+
+    if ((0 == blockSize) ||
+        ((size - HEADER_SIZE) / INDEX_ENTRY_SIZE < numBlocks))
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    /* the most a bit can decode to is a longest match in its token */
+    maxCoded = ((size_t)1 << format.lengthBits) + MAX_UNCODED;
+    tokenBits = 1 + format.offsetBits + format.lengthBits;
+
+    /* where each block's bit stream and output start */
+    std::vector<size_t> inStart(numBlocks + 1);
+    std::vector<size_t> blockStart(numBlocks + 1);
+    inStart[0] = HEADER_SIZE + numBlocks * INDEX_ENTRY_SIZE;
+    blockStart[0] = 0;
+
+    for (i = 0; i < numBlocks; i++)
+    {
+        const uint8_t *entry = in + HEADER_SIZE + i * INDEX_ENTRY_SIZE;
+        size_t encoded = GetWord(entry);
+        size_t decoded = GetWord(entry + 4);
+
+        if ((decoded > blockSize) ||
+            ((decoded != blockSize) && (i + 1 < numBlocks)) ||
+            (decoded > encoded * 8 / tokenBits * maxCoded))
+        {
+            errno = EILSEQ;
+            return -1;
+        }
+
+        inStart[i + 1] = inStart[i] + encoded;
+        blockStart[i + 1] = blockStart[i] + decoded;
+    }
+
+    if (inStart[numBlocks] > size)
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    outStart = out.size();
+    total = blockStart[numBlocks];
+    out.resize(outStart + total);
+
+    std::vector<std::vector<deferred_copy_t> > deferred(numBlocks);
+    result = 0;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (b = 0; b < (long)numBlocks; b++)
+    {
+        if (DecodeBlock(in + inStart[b], inStart[b + 1] - inStart[b],
+            &out[outStart], blockStart[b], blockStart[b + 1] - blockStart[b],
+            format, deferred[b]) != 0)
+        {
+            #pragma omp atomic write
+            result = -1;
+        }
+    }
+
+    if (result != 0)
+    {
+        out.resize(outStart);
+        errno = EILSEQ;
+        return -1;
+    }
+
+    /* in block order, so every copy reads bytes that are already done */
+    for (b = 1; b < (long)numBlocks; b++)
+    {
+        uint8_t *data = &out[outStart];
+
+        for (i = 0; i < deferred[b].size(); i++)
+        {
+            const deferred_copy_t &copy = deferred[b][i];
+            size_t j;
+
+            for (j = 0; j < copy.length; j++)
+            {
+                data[copy.dst + j] = data[copy.src + j];
+            }
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : EncodeLZSSParallel
+*   Description: This function is the file version of EncodeLZSSParallel.
+*   Parameters : fpIn - pointer to the open binary file to encode
+*                fpOut - pointer to the open binary file to write encoded
+*                       output
+*                finder - method used to search the sliding window
+*                format - window size and maximum match length
+*                level - how hard to search for matches
+*                blockSize - bytes of input per block
+*   Effects    : fpIn is encoded and written to fpOut.  Neither file is
+*                closed after exit.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int EncodeLZSSParallel(FILE *fpIn, FILE *fpOut, lzss_finder_t finder,
+    lzss_format_t format, int level, size_t blockSize)
+{
+    std::vector<uint8_t> out;
+    int result;
+
+    if ((NULL == fpIn) || (NULL == fpOut))
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    FileMap input(fpIn);
+    result = EncodeLZSSParallel(input.Data(), input.Size(), out, finder,
+        format, level, blockSize);
+
+    if ((0 == result) && (fwrite(out.data(), 1, out.size(), fpOut) !=
+        out.size()))
+    {
+        return -1;
+    }
+
+    return result;
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSSParallel
+*   Description: This function is the file version of DecodeLZSSParallel.
+*   Parameters : fpIn - pointer to the open binary file to decode
+*                fpOut - pointer to the open binary file to write decoded
+*                       output
+*   Effects    : fpIn is decoded and written to fpOut.  Neither file is
+*                closed after exit.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int DecodeLZSSParallel(FILE *fpIn, FILE *fpOut)
+{
+    std::vector<uint8_t> out;
+    int result;
+
+    if ((NULL == fpIn) || (NULL == fpOut))
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    FileMap input(fpIn);
+    result = DecodeLZSSParallel(input.Data(), input.Size(), out);
+
+    if ((0 == result) && (fwrite(out.data(), 1, out.size(), fpOut) !=
+        out.size()))
+    {
+        return -1;
+    }
+
+    return result;
+}
+
+/****************************************************************************
+*   Function   : DecodeBlock
+*   Description: This function decodes one block into its place in the
+*                output.  The block's sliding window starts with the
+*                window of bytes before it (or spaces, before the first
+*                block), so a window index is a position in the output.
+*                Bytes copied from the block before, or from bytes that
+*                were themselves copied from it, are left for later and
+*                recorded in deferred.
+*   Parameters : in - the block's bit stream
+*                size - the number of bytes at in
+*                out - the whole output
+*                blockStart - position of the block in out
+*                blockSize - number of bytes the block decodes to
+*                format - window size and maximum match length
+*                deferred - copies to finish once the blocks before are
+*                           done, in the order they must be made
+*   Effects    : out[blockStart] to out[blockStart + blockSize - 1] are
+*                decoded, except for the bytes in deferred.
+*   Returned   : 0 for success, -1 if the stream doesn't decode to exactly
+*                blockSize bytes.
+****************************************************************************/
+static int DecodeBlock(const uint8_t *in, size_t size, uint8_t *out,
+    size_t blockStart, size_t blockSize, lzss_format_t format,
+    std::vector<deferred_copy_t> &deferred)
+{
+    const size_t windowSize = (size_t)1 << format.offsetBits;
+    BitReader bitsIn(in, size);
+    size_t prime, pos, end, unknownEnd;
+    encoded_string_t code;
+    int c;
+
+    /* which bytes of this block aren't known yet */
+    std::vector<uint8_t> unknown(blockStart > 0 ? blockSize : 0);
+
+    prime = std::min(windowSize, blockStart);
+    pos = blockStart;
+    end = blockStart + blockSize;
+    unknownEnd = blockStart;        /* no unknown bytes at or after this */
+
+    while (pos < end)
+    {
+        if ((c = bitsIn.GetBit()) == EOF)
+        {
+            return -1;
+        }
+
+        if (c == UNCODED)
+        {
+            if ((c = bitsIn.GetChar()) == EOF)
+            {
+                return -1;
+            }
+
+            out[pos++] = c;
+        }
+        else
+        {
+            size_t virtualPos, written, src, i;
+
+            code.offset = 0;
+            code.length = 0;
+
+            if ((bitsIn.GetBitsNum(&code.offset, format.offsetBits) == EOF) ||
+                (bitsIn.GetBitsNum(&code.length, format.lengthBits) == EOF))
+            {
+                return -1;
+            }
+
+            code.length += MAX_UNCODED + 1;
+
+            if (code.length > end - pos)
+            {
+                return -1;
+            }
+
+            /****************************************************************
+            * The window holds the last windowSize bytes written to it:
+            * windowSize spaces, then the prime bytes before the block,
+            * then the block.  Number those writes; window index n holds
+            * the last write whose number is n modulo windowSize, and write
+            * number windowSize + k is out[blockStart - prime + k].
+            ****************************************************************/
+            written = windowSize + prime + (pos - blockStart);
+            virtualPos = written - 1 -
+                ((written - 1 - code.offset) & (windowSize - 1));
+
+            if ((virtualPos >= windowSize) &&
+                (virtualPos + code.length <= written) &&
+                (virtualPos - windowSize + blockStart - prime >= unknownEnd))
+            {
+                /* the usual case: known bytes all before pos */
+                src = virtualPos - windowSize + blockStart - prime;
+
+                for (i = 0; i < code.length; i++)
+                {
+                    out[pos + i] = out[src + i];
+                }
+
+                pos += code.length;
+                continue;
+            }
+
+            for (i = 0; i < code.length; i++)
+            {
+                size_t v = virtualPos + i;
+
+                /* the window is read before it's written */
+                if (v >= written)
+                {
+                    v -= windowSize;
+                }
+
+                if (v < windowSize)
+                {
+                    out[pos + i] = ' ';
+                    continue;
+                }
+
+                src = v - windowSize + blockStart - prime;
+
+                if ((src < blockStart) ||
+                    ((src < unknownEnd) && unknown[src - blockStart]))
+                {
+                    /* wait for the block before; join the last run */
+                    if (!deferred.empty() &&
+                        (deferred.back().dst + deferred.back().length ==
+                        pos + i) &&
+                        (deferred.back().src + deferred.back().length == src))
+                    {
+                        deferred.back().length++;
+                    }
+                    else
+                    {
+                        deferred_copy_t copy = {pos + i, src, 1};
+                        deferred.push_back(copy);
+                    }
+
+                    unknown[pos + i - blockStart] = 1;
+                    unknownEnd = pos + i + 1;
+                }
+                else
+                {
+                    out[pos + i] = out[src];
+                }
+            }
+
+            pos += code.length;
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : PutWord
+*   Description: This function stores a 32 bit value little endian.
+*   Parameters : out - where to store the value
+*                value - the value to store
+*   Effects    : out[0] to out[3] are written.
+*   Returned   : None
+****************************************************************************/
+static void PutWord(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+/****************************************************************************
+*   Function   : GetWord
+*   Description: This function reads a 32 bit value stored by PutWord.
+*   Parameters : in - where the value is stored
+*   Effects    : None
+*   Returned   : The value.
+****************************************************************************/
+static uint32_t GetWord(const uint8_t *in)
+{
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) |
+        ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
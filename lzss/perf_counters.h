@@ -0,0 +1,234 @@
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+// Hardware counters per phase and per thread through perf_event_open.
+// Counters are opened for each thread on its first scope after
+// perf_start() and summed per phase name:
+//
+//   perf_start();
+//   { PERF_SCOPE("encode"); ... }
+//   perf_report(stdout);
+//
+// Counters the kernel or machine doesn't offer (no PMU in a VM,
+// perf_event_paranoid) are reported as "-".
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum perf_counter {
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_DTLB_MISSES,
+  NUM_PERF_COUNTERS,
+};
+
+struct perf_phase_counts {
+  const char* name;
+  uint64_t calls;
+  uint64_t value[NUM_PERF_COUNTERS];
+};
+
+// Counters and sums of one thread. Only that thread adds to its sums.
+struct perf_thread {
+  int tid;
+  int fd[NUM_PERF_COUNTERS];
+  // Whether the counter could be opened, kept after the thread exits
+  bool available[NUM_PERF_COUNTERS];
+  std::vector<perf_phase_counts> phases;
+
+  perf_phase_counts& phase(const char* name) {
+    for (size_t i = 0; i < phases.size(); i++)
+      if (phases[i].name == name || strcmp(phases[i].name, name) == 0)
+        return phases[i];
+    perf_phase_counts p;
+    memset(&p, 0, sizeof(p));
+    p.name = name;
+    phases.push_back(p);
+    return phases.back();
+  }
+};
+
+struct perf_state {
+  std::mutex lock;
+  std::vector<perf_thread*> threads;
+  std::atomic<bool> enabled;
+};
+
+inline perf_state& perf_global() {
+  static perf_state state;
+  return state;
+}
+
+#ifdef __linux__
+inline int perf_open(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // Count the calling thread on whatever CPU it runs
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+// Closes the counters of a thread when it exits. The sums stay for the
+// report.
+struct perf_thread_guard {
+  perf_thread* thread;
+  perf_thread_guard() : thread(NULL) {}
+  ~perf_thread_guard() {
+    if (!thread)
+      return;
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+#ifdef __linux__
+      if (thread->fd[i] >= 0)
+        close(thread->fd[i]);
+#endif
+      thread->fd[i] = -1;
+    }
+  }
+};
+
+inline perf_thread* perf_this_thread() {
+  static thread_local perf_thread_guard guard;
+  if (!guard.thread) {
+    perf_thread* t = new perf_thread();
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+      t->fd[i] = -1;
+#ifdef __linux__
+    t->fd[PERF_CYCLES] =
+        perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    t->fd[PERF_INSTRUCTIONS] =
+        perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    t->fd[PERF_LLC_MISSES] =
+        perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    t->fd[PERF_BRANCH_MISSES] =
+        perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    t->fd[PERF_DTLB_MISSES] =
+        perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                  PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                  PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+#endif
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+      t->available[i] = t->fd[i] >= 0;
+    perf_state& state = perf_global();
+    std::lock_guard<std::mutex> lock(state.lock);
+    t->tid = (int)state.threads.size();
+    state.threads.push_back(t);
+    guard.thread = t;
+  }
+  return guard.thread;
+}
+
+inline void perf_read(const perf_thread* t, uint64_t* values) {
+  for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+    values[i] = 0;
+#ifdef __linux__
+    if (t->fd[i] >= 0 &&
+        read(t->fd[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+      values[i] = 0;
+#endif
+  }
+}
+
+// Clear the sums and start counting. Returns false if this machine
+// gives no cycle counter, in which case the report is empty.
+inline bool perf_start() {
+  perf_state& state = perf_global();
+  {
+    std::lock_guard<std::mutex> lock(state.lock);
+    for (size_t i = 0; i < state.threads.size(); i++)
+      state.threads[i]->phases.clear();
+  }
+  state.enabled = true;
+  return perf_this_thread()->available[PERF_CYCLES];
+}
+
+inline void perf_stop() {
+  perf_global().enabled = false;
+}
+
+/*
+ * perf_report prints the sums of every phase and thread since perf_start
+ * or the last report as CSV, then clears them. Call it while no counted
+ * scope is running.
+ */
+inline void perf_report(FILE* out) {
+  static const char* unit[NUM_PERF_COUNTERS] = {
+    "Cycles", "Instructions", "LLCMisses", "BranchMisses", "DTLBMisses"
+  };
+  perf_state& state = perf_global();
+  std::lock_guard<std::mutex> lock(state.lock);
+  fprintf(out, "Phase,Thread,Calls");
+  for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    fprintf(out, ",%s", unit[i]);
+  fprintf(out, ",IPC\n");
+  for (size_t t = 0; t < state.threads.size(); t++) {
+    perf_thread* thread = state.threads[t];
+    for (size_t p = 0; p < thread->phases.size(); p++) {
+      const perf_phase_counts& c = thread->phases[p];
+      fprintf(out, "%s,%d,%llu", c.name, thread->tid,
+              (unsigned long long)c.calls);
+      for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+        if (thread->available[i])
+          fprintf(out, ",%llu", (unsigned long long)c.value[i]);
+        else
+          fprintf(out, ",-");
+      }
+      if (c.value[PERF_CYCLES])
+        fprintf(out, ",%.2f\n",
+                (double)c.value[PERF_INSTRUCTIONS] / c.value[PERF_CYCLES]);
+      else
+        fprintf(out, ",-\n");
+    }
+    thread->phases.clear();
+  }
+  fprintf(out, "\n");
+}
+
+// Adds the counts of the lifetime of the scope to a phase of the calling
+// thread. name must be a string that outlives the report.
+class perf_scope {
+ public:
+  perf_scope(const char* name) : thread(NULL), name(name) {
+    if (perf_global().enabled.load(std::memory_order_relaxed)) {
+      thread = perf_this_thread();
+      perf_read(thread, begin);
+    }
+  }
+  ~perf_scope() {
+    if (!thread)
+      return;
+    uint64_t end[NUM_PERF_COUNTERS];
+    perf_read(thread, end);
+    perf_phase_counts& c = thread->phase(name);
+    c.calls++;
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+      c.value[i] += end[i] - begin[i];
+  }
+
+ private:
+  perf_thread* thread;
+  const char* name;
+  uint64_t begin[NUM_PERF_COUNTERS];
+};
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+#define PERF_SCOPE(name) perf_scope PERF_CONCAT(perf_scope_, __LINE__)(name)
+
+#endif // _PERF_COUNTERS_H_
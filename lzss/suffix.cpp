@@ -0,0 +1,692 @@
+/***************************************************************************
+*          Lempel, Ziv, Storer, and Szymanski Encoding and Decoding
+*
+*   File    : suffix.cpp
+*   Purpose : Implement suffix array matching of uncoded strings for the
+*             LZSS algorithm.  Instead of updating a search structure one
+*             character at a time, the input is cut into chunks and a
+*             suffix array and LCP array are built over each chunk and the
+*             window before it.  The longest match of every position of a
+*             chunk is read from its neighbours in the suffix array, and the
+*             chunks are done at the same time on all OpenMP threads.
+*             FindMatch then only looks up the match of the position the
+*             encoder is at.
+*
+*             The suffix arrays are built with SA-IS (Nong, Zhang and Chan,
+*             "Two Efficient Algorithms for Linear Time Suffix Array
+*             Construction") and the LCP arrays with Kasai's algorithm.
+*
+***************************************************************************/
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include <stdlib.h>
+#include <errno.h>
+#include <vector>
+#include <omp.h>
+#include "lzlocal.h"
+
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+/* positions matched by each thread at a time, unless the window is larger */
+#define SUFFIX_BATCH    (1 << 20)
+
+/* a match is packed as length << MATCH_SHIFT | (distance - 1) */
+#define MATCH_SHIFT     20
+
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+
+/***************************************************************************
+* The search structures kept in an encoder's context.  matches holds the
+* packed longest match of each input position from batchStart to batchEnd;
+* they are found a batch of chunks at a time as the encoder reaches them.
+* position is that of the next character written to the window, counted
+* from the start of the input, so it is negative while the window is
+* primed.
+***************************************************************************/
+typedef struct suffix_state_t
+{
+    uint32_t *matches;
+    size_t capacity;            /* entries allocated at matches */
+    size_t batchStart;
+    size_t batchEnd;
+    ptrdiff_t position;
+} suffix_state_t;
+
+/***************************************************************************
+*                                 MACROS
+***************************************************************************/
+/* suffix array search structures of a context */
+#define SuffixState(ctx)    ((suffix_state_t *)((ctx)->finderState))
+
+/***************************************************************************
+*                               PROTOTYPES
+***************************************************************************/
+
+/***************************************************************************
+*                                FUNCTIONS
+***************************************************************************/
+
+/****************************************************************************
+*   Function   : GetBuckets
+*   Description: This function finds the start or end of the bucket of
+*                every character of a string in its suffix array.
+*   Parameters : s - the string
+*                bkt - receives the bucket of each character
+*                n - the length of s
+*                k - the largest character in s
+*                end - true for the end of each bucket, false for its start
+*   Effects    : bkt[c] is the first (or one past the last) suffix array
+*                index of the suffixes starting with c.
+*   Returned   : NONE
+****************************************************************************/
+static void GetBuckets(const int *s, int *bkt, const int n, const int k,
+    const bool end)
+{
+    int i;
+    int sum;
+
+    for (i = 0; i <= k; i++)
+    {
+        bkt[i] = 0;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        bkt[s[i]]++;
+    }
+
+    sum = 0;
+
+    for (i = 0; i <= k; i++)
+    {
+        sum += bkt[i];
+        bkt[i] = end ? sum : sum - bkt[i];
+    }
+}
+
+/****************************************************************************
+*   Function   : InduceSort
+*   Description: This function induces the order of the L-type suffixes
+*                from the sorted LMS suffixes in sa, then the order of the
+*                S-type suffixes from those.
+*   Parameters : s - the string
+*                sa - the suffix array, holding the sorted LMS suffixes at
+*                     the ends of their buckets and -1 elsewhere
+*                sType - sType[i] is true if suffix i is S-type
+*                bkt - room for k + 1 buckets
+*                n - the length of s
+*                k - the largest character in s
+*   Effects    : sa is sorted as far as the order of the LMS suffixes allows.
+*   Returned   : NONE
+****************************************************************************/
+static void InduceSort(const int *s, int *sa, const std::vector<bool> &sType,
+    int *bkt, const int n, const int k)
+{
+    int i;
+    int j;
+
+    GetBuckets(s, bkt, n, k, false);
+
+    for (i = 0; i < n; i++)
+    {
+        j = sa[i] - 1;
+
+        if ((j >= 0) && !sType[j])
+        {
+            sa[bkt[s[j]]++] = j;
+        }
+    }
+
+    GetBuckets(s, bkt, n, k, true);
+
+    for (i = n - 1; i >= 0; i--)
+    {
+        j = sa[i] - 1;
+
+        if ((j >= 0) && sType[j])
+        {
+            sa[--bkt[s[j]]] = j;
+        }
+    }
+}
+
+/****************************************************************************
+*   Function   : SuffixSort
+*   Description: This function builds the suffix array of a string by SA-IS.
+*                The LMS substrings are sorted by induction and named, the
+*                string of their names is sorted recursively if any names
+*                repeat, and the order of its suffixes induces the rest.
+*   Parameters : s - the string.  Its last character must be 0, and the
+*                    only 0 in it.
+*                sa - receives the suffix array, n entries
+*                n - the length of s, at least 2
+*                k - the largest character in s
+*   Effects    : sa[i] is the start of the i-th smallest suffix of s.
+*   Returned   : NONE
+****************************************************************************/
+static void SuffixSort(const int *s, int *sa, const int n, const int k)
+{
+    std::vector<bool> sType(n);
+    std::vector<int> bkt(k + 1);
+    int *s1;
+    int n1;
+    int name;
+    int prev;
+    int i;
+    int j;
+
+    /* the sentinel is S-type and the character before it L-type */
+    sType[n - 1] = true;
+    sType[n - 2] = false;
+
+    for (i = n - 3; i >= 0; i--)
+    {
+        sType[i] = (s[i] < s[i + 1]) || ((s[i] == s[i + 1]) && sType[i + 1]);
+    }
+
+#define IsLMS(i)    (((i) > 0) && sType[(i)] && !sType[(i) - 1])
+
+    /* sort the LMS substrings by putting them at the ends of their buckets */
+    GetBuckets(s, bkt.data(), n, k, true);
+
+    for (i = 0; i < n; i++)
+    {
+        sa[i] = -1;
+    }
+
+    for (i = 1; i < n; i++)
+    {
+        if (IsLMS(i))
+        {
+            sa[--bkt[s[i]]] = i;
+        }
+    }
+
+    InduceSort(s, sa, sType, bkt.data(), n, k);
+
+    /* gather them in order at the front of sa */
+    n1 = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (IsLMS(sa[i]))
+        {
+            sa[n1++] = sa[i];
+        }
+    }
+
+    /* name them; no two LMS substrings start within two characters */
+    for (i = n1; i < n; i++)
+    {
+        sa[i] = -1;
+    }
+
+    name = 0;
+    prev = -1;
+
+    for (i = 0; i < n1; i++)
+    {
+        const int pos = sa[i];
+        bool diff = false;
+        int d;
+
+        for (d = 0; d < n; d++)
+        {
+            if ((-1 == prev) || (s[pos + d] != s[prev + d]) ||
+                (sType[pos + d] != sType[prev + d]))
+            {
+                diff = true;
+                break;
+            }
+            else if ((d > 0) && (IsLMS(pos + d) || IsLMS(prev + d)))
+            {
+                break;
+            }
+        }
+
+        if (diff)
+        {
+            name++;
+            prev = pos;
+        }
+
+        sa[n1 + pos / 2] = name - 1;
+    }
+
+    for (i = n - 1, j = n - 1; i >= n1; i--)
+    {
+        if (sa[i] >= 0)
+        {
+            sa[j--] = sa[i];
+        }
+    }
+
+    /* sort the string of names, recursing only if a name repeats */
+    s1 = sa + n - n1;
+
+    if (name < n1)
+    {
+        SuffixSort(s1, sa, n1, name - 1);
+    }
+    else
+    {
+        for (i = 0; i < n1; i++)
+        {
+            sa[s1[i]] = i;
+        }
+    }
+
+    /* put the sorted LMS suffixes at the ends of their buckets again */
+    GetBuckets(s, bkt.data(), n, k, true);
+
+    for (i = 1, j = 0; i < n; i++)
+    {
+        if (IsLMS(i))
+        {
+            s1[j++] = i;
+        }
+    }
+
+    for (i = 0; i < n1; i++)
+    {
+        sa[i] = s1[sa[i]];
+    }
+
+    for (i = n1; i < n; i++)
+    {
+        sa[i] = -1;
+    }
+
+    for (i = n1 - 1; i >= 0; i--)
+    {
+        j = sa[i];
+        sa[i] = -1;
+        sa[--bkt[s[j]]] = j;
+    }
+
+#undef IsLMS
+
+    InduceSort(s, sa, sType, bkt.data(), n, k);
+}
+
+/****************************************************************************
+*   Function   : MatchChunk
+*   Description: This function finds the longest match of every position
+*                of one chunk of the input.  The chunk, the window before
+*                it and the lookahead after it are suffix sorted, and for
+*                each position the suffixes next to it in the suffix array
+*                are tried, nearest first, until their common prefix is no
+*                longer than the best match.  A match must start in the
+*                window and end before the position it is for, because the
+*                decoder reads a whole string before writing it.
+*   Parameters : ctx - the encoder context
+*                start - the input position of the chunk
+*                end - the input position following the chunk
+*                out - receives the packed match of each position
+*   Effects    : out[i - start] is the match of input position i.
+*   Returned   : NONE
+****************************************************************************/
+template <class F>
+static void MatchChunk(const lzss_context_t *ctx, const size_t start,
+    const size_t end, uint32_t *out)
+{
+    const size_t last = (end + F::MAX_CODED < ctx->inputSize) ?
+        end + F::MAX_CODED : ctx->inputSize;
+    ptrdiff_t first;
+    int head;
+    int n;
+    unsigned int maxSteps;
+    int i;
+    int h;
+
+    /************************************************************************
+    * The text starts with the window as it is before the chunk: primed
+    * bytes and the spaces the window is filled with come before the input.
+    * Any match starting further back in the spaces than MAX_CODED of them
+    * is also found at the first of those, so the rest are left out.
+    ************************************************************************/
+    first = (ptrdiff_t)start - F::WINDOW_SIZE;
+
+    if (first < -(ptrdiff_t)(ctx->primeSize + F::MAX_CODED))
+    {
+        first = -(ptrdiff_t)(ctx->primeSize + F::MAX_CODED);
+    }
+
+    head = (int)((ptrdiff_t)start - first);
+    n = (int)((ptrdiff_t)last - first) + 1;
+
+    /* enough candidates for a run of one character to reach MAX_CODED */
+    maxSteps = ctx->config->maxChain;
+
+    if (maxSteps < (unsigned int)F::MAX_CODED)
+    {
+        maxSteps = F::MAX_CODED;
+    }
+
+    std::vector<int> s(n);
+    std::vector<int> sa(n);
+    std::vector<int> rank(n);
+    std::vector<int> lcp(n);
+
+    /* characters are shifted up by one for the sentinel */
+    for (i = 0; i < n - 1; i++)
+    {
+        const ptrdiff_t p = first + i;
+
+        if (p >= -(ptrdiff_t)ctx->primeSize)
+        {
+            s[i] = ctx->input[p] + 1;
+        }
+        else
+        {
+            s[i] = ' ' + 1;
+        }
+    }
+
+    s[n - 1] = 0;
+    SuffixSort(s.data(), sa.data(), n, UCHAR_MAX + 1);
+
+    /* lcp[r] is the common prefix of suffixes sa[r - 1] and sa[r] */
+    for (i = 0; i < n; i++)
+    {
+        rank[sa[i]] = i;
+    }
+
+    lcp[0] = 0;
+    h = 0;
+
+    for (i = 0; i < n - 1; i++)
+    {
+        const int j = sa[rank[i] - 1];
+
+        while (s[i + h] == s[j + h])
+        {
+            h++;
+        }
+
+        lcp[rank[i]] = h;
+
+        if (h > 0)
+        {
+            h--;
+        }
+    }
+
+    for (i = head; i < head + (int)(end - start); i++)
+    {
+        const int r = rank[i];
+        int best = MAX_UNCODED;
+        int distance = 0;
+        unsigned int steps;
+        int common;
+        int k;
+
+        /* smaller suffixes, then larger ones */
+        common = F::MAX_CODED;
+
+        for (k = r, steps = 0; (k > 0) && (steps < maxSteps); k--, steps++)
+        {
+            const int j = sa[k - 1];
+
+            if (lcp[k] < common)
+            {
+                common = lcp[k];
+            }
+
+            if (common <= best)
+            {
+                break;
+            }
+
+            if ((j < i) && (j >= i - F::WINDOW_SIZE) && (i - j > best))
+            {
+                best = (i - j < common) ? i - j : common;
+                distance = i - j;
+            }
+        }
+
+        common = F::MAX_CODED;
+
+        for (k = r + 1, steps = 0; (k < n) && (steps < maxSteps);
+            k++, steps++)
+        {
+            const int j = sa[k];
+
+            if (lcp[k] < common)
+            {
+                common = lcp[k];
+            }
+
+            if (common <= best)
+            {
+                break;
+            }
+
+            if ((j < i) && (j >= i - F::WINDOW_SIZE) && (i - j > best))
+            {
+                best = (i - j < common) ? i - j : common;
+                distance = i - j;
+            }
+        }
+
+        if (0 == distance)
+        {
+            out[i - head] = 0;
+        }
+        else
+        {
+            out[i - head] =
+                ((uint32_t)best << MATCH_SHIFT) | (uint32_t)(distance - 1);
+        }
+    }
+}
+
+/****************************************************************************
+*   Function   : MatchBatch
+*   Description: This function finds the longest matches of the chunks
+*                starting at an input position, SUFFIX_BATCH positions for
+*                each OpenMP thread.  A chunk is one window long: longer
+*                ones would fill the suffix array around each position with
+*                strings that are too far back to match, and shorter ones
+*                would spend most of their sort on the window.
+*   Parameters : ctx - the encoder context
+*                start - the input position of the first chunk, a multiple
+*                        of the window size
+*   Effects    : The matches of the batch are in the finder state.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+template <class F>
+static int MatchBatch(lzss_context_t *ctx, const size_t start)
+{
+    suffix_state_t *state = SuffixState(ctx);
+    const size_t chunk = F::WINDOW_SIZE;
+    size_t batch;
+    size_t end;
+    ptrdiff_t c;
+
+    /* an encoder already on a thread of its own gets no more */
+    batch = (SUFFIX_BATCH > chunk) ? SUFFIX_BATCH : chunk;
+    batch *= omp_in_parallel() ? 1 : omp_get_max_threads();
+    end = ctx->inputSize;
+
+    if (end - start > batch)
+    {
+        end = start + batch;
+    }
+
+    if (state->capacity < end - start)
+    {
+        uint32_t *matches;
+
+        matches = (uint32_t *)realloc(state->matches,
+            batch * sizeof(uint32_t));
+
+        if (NULL == matches)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        state->matches = matches;
+        state->capacity = batch;
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (c = 0; c < (ptrdiff_t)((end - start + chunk - 1) / chunk); c++)
+    {
+        const size_t from = start + c * chunk;
+        const size_t to = (from + chunk < end) ? from + chunk : end;
+
+        MatchChunk<F>(ctx, from, to, state->matches + (from - start));
+    }
+
+    state->batchStart = start;
+    state->batchEnd = end;
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : InitializeSearchStructures
+*   Description: This function starts the position count over for the
+*                input at ctx->input.  The matches are found once the
+*                encoder asks for them.
+*   Parameters : ctx - the encoder context
+*   Effects    : No matches are held and the next character written is at
+*                the start of the primed bytes.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+*
+*   NOTE: This function assumes that the sliding window is initially filled
+*         with spaces.
+****************************************************************************/
+template <class F>
+static int InitializeSearchStructures(lzss_context_t *ctx)
+{
+    suffix_state_t *state = SuffixState(ctx);
+
+    state->batchStart = 0;
+    state->batchEnd = 0;
+    state->position = -(ptrdiff_t)ctx->primeSize;
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : FindMatch
+*   Description: This function returns the longest match of the uncoded
+*                lookahead, found with the rest of its batch when the
+*                encoder first reaches the batch.
+*   Parameters : ctx - the encoder context
+*                windowHead - not used
+*                uncodedHead - not used
+*   Effects    : The matches of the next batch are found if the encoder
+*                has passed the current one.
+*   Returned   : The sliding window index where the match starts and the
+*                length of the match.  If there is no match, or the matches
+*                couldn't be allocated, a length of zero will be returned.
+****************************************************************************/
+template <class F>
+static encoded_string_t FindMatch(lzss_context_t *ctx,
+    const unsigned int windowHead, const unsigned int uncodedHead)
+{
+    suffix_state_t *state = SuffixState(ctx);
+    const size_t position = (size_t)state->position;
+    encoded_string_t matchData;
+    uint32_t packed;
+
+    (void)windowHead;       /* prevents unused variable warning */
+    (void)uncodedHead;      /* prevents unused variable warning */
+    matchData.length = 0;
+    matchData.offset = 0;
+
+    if ((position >= state->batchEnd) || (position < state->batchStart))
+    {
+        /* batches start on a chunk, so the output is the same however
+         * many threads there are */
+        if (MatchBatch<F>(ctx,
+            position & ~(size_t)(F::WINDOW_SIZE - 1)) != 0)
+        {
+            return matchData;
+        }
+    }
+
+    packed = state->matches[position - state->batchStart];
+
+    if (packed != 0)
+    {
+        /* input position p is at window index (primeSize + p) % WINDOW_SIZE */
+        matchData.length = packed >> MATCH_SHIFT;
+        matchData.offset = (unsigned int)(ctx->primeSize + position -
+            ((packed & ((1u << MATCH_SHIFT) - 1)) + 1)) &
+            (F::WINDOW_SIZE - 1);
+    }
+
+    return matchData;
+}
+
+/****************************************************************************
+*   Function   : ReplaceChar
+*   Description: This function replaces the character stored in
+*                slidingWindow[charIndex] with the one specified by
+*                replacement.  Characters are replaced in window order, so
+*                this moves the position count on by one.
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
+*                            replaced.
+*                replacement - new character
+*   Effects    : slidingWindow[charIndex] is replaced by replacement.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+template <class F>
+static int ReplaceChar(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned char replacement)
+{
+    SetWindowChar<F>(ctx, charIndex, replacement);
+    SuffixState(ctx)->position++;
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : FreeSearchStructures
+*   Description: This function frees the matches held by the finder state.
+*   Parameters : ctx - the context whose finder state is about to be freed
+*   Effects    : The matches are freed.
+*   Returned   : NONE
+****************************************************************************/
+static void FreeSearchStructures(lzss_context_t *ctx)
+{
+    suffix_state_t *state = SuffixState(ctx);
+
+    free(state->matches);
+    state->matches = NULL;
+    state->capacity = 0;
+}
+
+/***************************************************************************
+*                              MATCH FINDER
+***************************************************************************/
+/* the suffix array finder built for one format */
+#define SUFFIX_FINDER(offsetBits, lengthBits) \
+    { \
+        "suffix", \
+        sizeof(suffix_state_t), \
+        InitializeSearchStructures< \
+            format_traits_t<offsetBits, lengthBits> >, \
+        ReplaceChar<format_traits_t<offsetBits, lengthBits> >, \
+        FindMatch<format_traits_t<offsetBits, lengthBits> >, \
+        FreeSearchStructures \
+    },
+
+const match_finder_t suffixFinder[] =
+{
+    LZSS_FORMATS(SUFFIX_FINDER)
+};
@@ -0,0 +1,146 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+// Timeline of the phases each thread runs, written as a Chrome trace
+// (chrome://tracing or ui.perfetto.dev). Build with -DTRACE_EVENTS to
+// record; without it every macro and function below compiles to nothing.
+//
+//   trace_start();
+//   { TRACE_SCOPE("histogram"); ... }   // one event per scope and thread
+//   trace_dump("trace.json");
+
+#ifdef TRACE_EVENTS
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "CycleTimer.h"
+
+// Events kept per thread; older ones are overwritten.
+#define TRACE_RING_SIZE (1 << 16)
+
+struct trace_event {
+  const char* name;
+  CycleTimer::SysClock begin;
+  CycleTimer::SysClock end;
+};
+
+// Written only by its own thread, so recording takes no lock.
+struct trace_ring {
+  int tid;
+  uint64_t count;
+  trace_event events[TRACE_RING_SIZE];
+};
+
+struct trace_state {
+  std::mutex lock;
+  std::vector<trace_ring*> rings;
+  std::atomic<bool> enabled;
+  CycleTimer::SysClock origin;
+};
+
+inline trace_state& trace_global() {
+  static trace_state state;
+  return state;
+}
+
+// Ring of the calling thread, registered on its first event.
+inline trace_ring* trace_thread_ring() {
+  static thread_local trace_ring* ring = NULL;
+  if (!ring) {
+    trace_state& state = trace_global();
+    ring = new trace_ring();
+    std::lock_guard<std::mutex> guard(state.lock);
+    ring->tid = (int)state.rings.size();
+    ring->count = 0;
+    state.rings.push_back(ring);
+  }
+  return ring;
+}
+
+// Drop any recorded events and start recording.
+inline void trace_start() {
+  trace_state& state = trace_global();
+  std::lock_guard<std::mutex> guard(state.lock);
+  for (size_t i = 0; i < state.rings.size(); i++)
+    state.rings[i]->count = 0;
+  state.origin = CycleTimer::currentTicks();
+  state.enabled = true;
+}
+
+// Stop recording and write the events to path. Call it while no traced
+// scope is running. Returns false if the file can't be written.
+inline bool trace_dump(const char* path) {
+  trace_state& state = trace_global();
+  state.enabled = false;
+  FILE* out = fopen(path, "w");
+  if (!out)
+    return false;
+
+  double us_per_tick = CycleTimer::secondsPerTick() * 1e6;
+  std::lock_guard<std::mutex> guard(state.lock);
+  fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  bool first = true;
+  for (size_t r = 0; r < state.rings.size(); r++) {
+    const trace_ring* ring = state.rings[r];
+    fprintf(out, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+            "\"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+            first ? "" : ",", ring->tid, ring->tid);
+    first = false;
+    uint64_t start = ring->count > TRACE_RING_SIZE ?
+                     ring->count - TRACE_RING_SIZE : 0;
+    for (uint64_t i = start; i < ring->count; i++) {
+      const trace_event& e = ring->events[i % TRACE_RING_SIZE];
+      fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, "
+              "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+              e.name, ring->tid, (e.begin - state.origin) * us_per_tick,
+              (e.end - e.begin) * us_per_tick);
+    }
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  return true;
+}
+
+// Records the lifetime of the scope as one event of the calling thread.
+// name must outlive the dump, which string literals do.
+class trace_scope {
+ public:
+  trace_scope(const char* name) : ring(NULL), name(name) {
+    if (trace_global().enabled.load(std::memory_order_relaxed)) {
+      ring = trace_thread_ring();
+      begin = CycleTimer::currentTicks();
+    }
+  }
+  ~trace_scope() {
+    if (!ring)
+      return;
+    trace_event& e = ring->events[ring->count % TRACE_RING_SIZE];
+    e.name = name;
+    e.begin = begin;
+    e.end = CycleTimer::currentTicks();
+    ring->count++;
+  }
+
+ private:
+  trace_ring* ring;
+  const char* name;
+  CycleTimer::SysClock begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+
+inline void trace_start() {}
+inline bool trace_dump(const char*) { return false; }
+
+#endif // TRACE_EVENTS
+
+#endif // _TRACE_H_
@@ -41,7 +41,8 @@
 /***************************************************************************
 *                                CONSTANTS
 ***************************************************************************/
-#define ROOT_INDEX      (WINDOW_SIZE + 1)
+/* of the format F the function using them is built for */
+#define ROOT_INDEX      (F::WINDOW_SIZE + 1)
 #define NULL_INDEX      (ROOT_INDEX + 1)
 
 /***************************************************************************
@@ -62,31 +63,41 @@ typedef struct tree_node_t
 } tree_node_t;
 
 /***************************************************************************
-*                                 MACROS
+* The search structures kept in an encoder's context.  tree[n] is the node
+* for slidingWindow[n]; the nodes at ROOT_INDEX and NULL_INDEX absorb the
+* parent and child updates RemoveString makes through the sentinels.
 ***************************************************************************/
+template <class F>
+struct tree_state_t
+{
+    tree_node_t tree[NULL_INDEX + 1];
+    unsigned int treeRoot;              /* index of the root of the tree */
+};
 
 /***************************************************************************
-*                            GLOBAL VARIABLES
+*                                 MACROS
 ***************************************************************************/
-/* cyclic buffer sliding window of already read characters */
-extern unsigned char slidingWindow[];
-extern unsigned char uncodedLookahead[];
-
-tree_node_t tree[WINDOW_SIZE];      /* tree[n] is node for slidingWindow[n] */
-unsigned int treeRoot;              /* index of the root of the tree */
+/* tree search structures of a context */
+#define TreeState(ctx)      ((tree_state_t<F> *)((ctx)->finderState))
 
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
-static void ClearNode(const unsigned int index);
+template <class F>
+static void ClearNode(lzss_context_t *ctx, const unsigned int index);
 
 /* add/remove strings starting at slidingWindow[charIndex] too/from tree */
-static void AddString(const unsigned int charIndex);
-static void RemoveString(const unsigned int charIndex);
+template <class F>
+static void AddString(lzss_context_t *ctx, const unsigned int charIndex);
+template <class F>
+static void RemoveString(lzss_context_t *ctx, const unsigned int charIndex);
 
 /* debugging functions not used by algorithm */
-static void PrintLen(const unsigned int charIndex, const unsigned int len);
-static void DumpTree(const unsigned int root);
+template <class F>
+static void PrintLen(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned int len);
+template <class F>
+static void DumpTree(lzss_context_t *ctx, const unsigned int root);
 
 /***************************************************************************
 *                                FUNCTIONS
@@ -101,7 +112,7 @@ static void DumpTree(const unsigned int root);
 *                made the root of the tree, and have no children.  This only
 *                works if the sliding window is filled with identical
 *                symbols.
-*   Parameters : None
+*   Parameters : ctx - the encoder context
 *   Effects    : A tree consisting of just a root node is created.
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
@@ -109,14 +120,16 @@ static void DumpTree(const unsigned int root);
 *   NOTE: This function assumes that the sliding window is initially filled
 *         with all identical characters.
 ****************************************************************************/
-int InitializeSearchStructures(void)
+template <class F>
+static int InitializeSearchStructures(lzss_context_t *ctx)
 {
+    tree_state_t<F> *state = TreeState(ctx);
     unsigned int i;
 
     /* clear out all tree node pointers */
-    for (i = 0; i < WINDOW_SIZE; i++)
+    for (i = 0; i <= NULL_INDEX; i++)
     {
-        ClearNode(i);
+        ClearNode<F>(ctx, i);
     }
 
     /************************************************************************
@@ -124,13 +137,13 @@ int InitializeSearchStructures(void)
     * character, there are only possible MAX_CODED length strings in the
     * tree.  Use the newest of those strings at the tree root.
     ************************************************************************/
-    treeRoot = (WINDOW_SIZE - MAX_CODED) - 1;
-    tree[treeRoot].parent = ROOT_INDEX;
+    state->treeRoot = (F::WINDOW_SIZE - F::MAX_CODED) - 1;
+    state->tree[state->treeRoot].parent = ROOT_INDEX;
 
     if (0)
     {
         /* get rid of unused warning for DumpTree */
-        DumpTree(NULL_INDEX);
+        DumpTree<F>(ctx, NULL_INDEX);
     }
 
     return 0;
@@ -141,16 +154,21 @@ int InitializeSearchStructures(void)
 *   Description: This function will search through the slidingWindow
 *                dictionary for the longest sequence matching the MAX_CODED
 *                long string stored in uncodedLookahead.
-*   Parameters : windowHead - not used
+*   Parameters : ctx - the encoder context
+*                windowHead - not used
 *                uncodedHead - head of uncoded lookahead buffer
 *   Effects    : NONE
 *   Returned   : The sliding window index where the match starts and the
 *                length of the match.  If there is no match a length of
 *                zero will be returned.
 ****************************************************************************/
-encoded_string_t FindMatch(const unsigned int windowHead,
-    const unsigned int uncodedHead)
+template <class F>
+static encoded_string_t FindMatch(lzss_context_t *ctx,
+    const unsigned int windowHead, const unsigned int uncodedHead)
 {
+    const tree_node_t *tree = TreeState(ctx)->tree;
+    const unsigned char *slidingWindow = ctx->slidingWindow;
+    const unsigned char *uncoded = ctx->uncodedLookahead + uncodedHead;
     encoded_string_t matchData;
     unsigned int i;
     unsigned int j;
@@ -160,26 +178,22 @@ encoded_string_t FindMatch(const unsigned int windowHead,
     matchData.length = 0;
     matchData.offset = 0;
 
-    i = treeRoot;       /* start at root */
+    i = TreeState(ctx)->treeRoot;       /* start at root */
     j = 0;
 
     while (i != NULL_INDEX)
     {
-        compare = slidingWindow[i] - uncodedLookahead[uncodedHead];
+        compare = slidingWindow[i] - uncoded[0];
 
         if (0 == compare)
         {
             /* we matched the first symbol, how many more match? */
-            j = 1;
+            j = 1 + MatchLength(slidingWindow + i + 1, uncoded + 1,
+                F::MAX_CODED - 1);
 
-            while((compare = slidingWindow[Wrap((i + j), WINDOW_SIZE)] -
-                uncodedLookahead[Wrap((uncodedHead + j), MAX_CODED)]) == 0)
+            if (j < (unsigned int)F::MAX_CODED)
             {
-                if (j >= MAX_CODED)
-                {
-                    break;
-                }
-                j++;
+                compare = slidingWindow[i + j] - uncoded[j];
             }
 
             if (j > matchData.length)
@@ -189,10 +203,10 @@ encoded_string_t FindMatch(const unsigned int windowHead,
             }
         }
 
-        if (j >= MAX_CODED)
+        if (j >= F::MAX_CODED)
         {
             /* we found the largest allowed match */
-            matchData.length = MAX_CODED;
+            matchData.length = F::MAX_CODED;
             break;
         }
 
@@ -215,43 +229,48 @@ encoded_string_t FindMatch(const unsigned int windowHead,
 *   Function   : CompareString
 *   Description: This function will compare two MAX_CODED long strings in
 *                the slidingWindow dictionary.
-*   Parameters : index1 - slidingWindow index where the first string starts
+*   Parameters : ctx - the encoder context
+*                index1 - slidingWindow index where the first string starts
 *                index2 - slidingWindow index where the second string starts
 *   Effects    : NONE
 *   Returned   : 0 if first string equals second string.
 *                < 0 if first string is less than second string.
 *                > 0 if first string is greater than second string.
 ****************************************************************************/
-static int CompareString(const unsigned int index1, const unsigned int index2)
+template <class F>
+static int CompareString(lzss_context_t *ctx, const unsigned int index1,
+    const unsigned int index2)
 {
+    const unsigned char *slidingWindow = ctx->slidingWindow;
     unsigned int offset;
-    int result = 0;
 
-    for (offset = 0; offset < MAX_CODED; offset++)
-    {
-        result = slidingWindow[Wrap((index1 + offset), WINDOW_SIZE)] -
-            slidingWindow[Wrap((index2 + offset), WINDOW_SIZE)];
+    offset = MatchLength(slidingWindow + index1, slidingWindow + index2,
+        F::MAX_CODED);
 
-        if (result != 0)
-        {
-            break;      /* we have a mismatch */
-        }
+    if (offset == (unsigned int)F::MAX_CODED)
+    {
+        return 0;
     }
 
-    return result;
+    /* we have a mismatch */
+    return slidingWindow[index1 + offset] - slidingWindow[index2 + offset];
 }
 
 /****************************************************************************
 *   Function   : FixChildren
 *   Description: This function reattaches the children to a parent node
 *                after it has been inserted.
-*   Parameters : index - sliding window index of the parent node.
+*   Parameters : ctx - the encoder context
+*                index - sliding window index of the parent node.
 *   Effects    : The .parent fields for the children of a newly attached
 *                node are made to point to the newly attached node.
 *   Returned   : NONE
 ****************************************************************************/
-static void FixChildren(const unsigned int index)
+template <class F>
+static void FixChildren(lzss_context_t *ctx, const unsigned int index)
 {
+    tree_node_t *tree = TreeState(ctx)->tree;
+
     if (tree[index].leftChild != NULL_INDEX)
     {
         tree[tree[index].leftChild].parent = index;
@@ -267,35 +286,39 @@ static void FixChildren(const unsigned int index)
 *   Function   : AddString
 *   Description: This function adds the MAX_UNCODED long string starting at
 *                slidingWindow[charIndex] to the binary tree.
-*   Parameters : charIndex - sliding window index of the string to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the string to be
 *                            added to the binary tree list.
 *   Effects    : The string starting at slidingWindow[charIndex] is inserted
 *                into the sorted binary tree.
 *   Returned   : NONE
 ****************************************************************************/
-static void AddString(const unsigned int charIndex)
+template <class F>
+static void AddString(lzss_context_t *ctx, const unsigned int charIndex)
 {
+    tree_state_t<F> *state = TreeState(ctx);
+    tree_node_t *tree = state->tree;
     int compare;
     unsigned int here;
 
-    compare = CompareString(charIndex, treeRoot);
+    compare = CompareString<F>(ctx, charIndex, state->treeRoot);
 
     if (0 == compare)
     {
         /* make start the new root, because it's newer identical */
-        tree[charIndex].leftChild = tree[treeRoot].leftChild;
-        tree[charIndex].rightChild = tree[treeRoot].rightChild;
+        tree[charIndex].leftChild = tree[state->treeRoot].leftChild;
+        tree[charIndex].rightChild = tree[state->treeRoot].rightChild;
         tree[charIndex].parent = ROOT_INDEX;
-        FixChildren(charIndex);
+        FixChildren<F>(ctx, charIndex);
 
         /* remove old root from the tree */
-        ClearNode(treeRoot);
+        ClearNode<F>(ctx, state->treeRoot);
 
-        treeRoot = charIndex;
+        state->treeRoot = charIndex;
         return;
     }
 
-    here = treeRoot;
+    here = state->treeRoot;
 
     while(1)
     {
@@ -313,7 +336,7 @@ static void AddString(const unsigned int charIndex)
                 tree[charIndex].leftChild = NULL_INDEX;
                 tree[charIndex].rightChild = NULL_INDEX;
                 tree[charIndex].parent = here;
-                FixChildren(charIndex);
+                FixChildren<F>(ctx, charIndex);
                 return;
             }
         }
@@ -331,7 +354,7 @@ static void AddString(const unsigned int charIndex)
                 tree[charIndex].leftChild = NULL_INDEX;
                 tree[charIndex].rightChild = NULL_INDEX;
                 tree[charIndex].parent = here;
-                FixChildren(charIndex);
+                FixChildren<F>(ctx, charIndex);
                 return;
             }
         }
@@ -341,7 +364,7 @@ static void AddString(const unsigned int charIndex)
             tree[charIndex].leftChild = tree[here].leftChild;
             tree[charIndex].rightChild = tree[here].rightChild;
             tree[charIndex].parent = tree[here].parent;
-            FixChildren(charIndex);
+            FixChildren<F>(ctx, charIndex);
 
             if (tree[tree[here].parent].leftChild == here)
             {
@@ -353,11 +376,11 @@ static void AddString(const unsigned int charIndex)
             }
 
             /* remove old node from the tree */
-            ClearNode(here);
+            ClearNode<F>(ctx, here);
             return;
         }
 
-        compare = CompareString(charIndex, here);
+        compare = CompareString<F>(ctx, charIndex, here);
     }
 }
 
@@ -365,14 +388,18 @@ static void AddString(const unsigned int charIndex)
 *   Function   : RemoveString
 *   Description: This function removes the MAX_UNCODED long string starting
 *                at slidingWindow[charIndex] from the binary tree.
-*   Parameters : charIndex - sliding window index of the string to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the string to be
 *                            removed from the binary tree list.
 *   Effects    : The string starting at slidingWindow[charIndex] is removed
 *                from the sorted binary tree.
 *   Returned   : NONE
 ****************************************************************************/
-static void RemoveString(const unsigned int charIndex)
+template <class F>
+static void RemoveString(lzss_context_t *ctx, const unsigned int charIndex)
 {
+    tree_state_t<F> *state = TreeState(ctx);
+    tree_node_t *tree = state->tree;
     unsigned int here;
 
     if (NULL_INDEX == tree[charIndex].parent)
@@ -424,13 +451,13 @@ static void RemoveString(const unsigned int charIndex)
 
     tree[here].parent = tree[charIndex].parent;
 
-    if (treeRoot == charIndex)
+    if (state->treeRoot == charIndex)
     {
-        treeRoot = here;
+        state->treeRoot = here;
     }
 
     /* clear all pointers in deleted node. */
-    ClearNode(charIndex);
+    ClearNode<F>(ctx, charIndex);
 }
 
 /****************************************************************************
@@ -439,8 +466,10 @@ static void RemoveString(const unsigned int charIndex)
 *                slidingWindow[charIndex] with the one specified by
 *                replacement.  The binary tree entries effected by the
 *                replacement are also corrected.
-*   Parameters : charIndex - sliding window index of the character to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the character to be
 *                            removed from the linked list.
+*                replacement - new character
 *   Effects    : slidingWindow[charIndex] is replaced by replacement.  Old
 *                binary tree nodes for strings containing
 *                slidingWindow[charIndex] are removed and new ones are
@@ -448,31 +477,33 @@ static void RemoveString(const unsigned int charIndex)
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
-int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
+template <class F>
+static int ReplaceChar(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned char replacement)
 {
     unsigned int firstIndex, i;
 
-    if (charIndex < MAX_CODED)
+    if (charIndex < F::MAX_CODED)
     {
-        firstIndex = (WINDOW_SIZE + charIndex) - MAX_CODED;
+        firstIndex = (F::WINDOW_SIZE + charIndex) - F::MAX_CODED;
     }
     else
     {
-        firstIndex = charIndex - MAX_CODED;
+        firstIndex = charIndex - F::MAX_CODED;
     }
 
     /* remove all tree entries containing character at char index */
-    for (i = 0; i <= MAX_CODED; i++)
+    for (i = 0; i <= F::MAX_CODED; i++)
     {
-        RemoveString(Wrap((firstIndex + i), WINDOW_SIZE));
+        RemoveString<F>(ctx, Wrap((firstIndex + i), F::WINDOW_SIZE));
     }
 
-    slidingWindow[charIndex] = replacement;
+    SetWindowChar<F>(ctx, charIndex, replacement);
 
     /* add all hash entries containing character at char index */
-    for (i = 0; i <= MAX_CODED; i++)
+    for (i = 0; i <= F::MAX_CODED; i++)
     {
-        AddString(Wrap((firstIndex + i), WINDOW_SIZE));
+        AddString<F>(ctx, Wrap((firstIndex + i), F::WINDOW_SIZE));
     }
 
     return 0;
@@ -482,41 +513,48 @@ int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
 *   Function   : ClearNode
 *   Description: This function sets the children and parent of a node in
 *                the binary tree to NULL_INDEX.
-*   Parameters : index - index of the tree node to be cleared.
+*   Parameters : ctx - the encoder context
+*                index - index of the tree node to be cleared.
 *   Effects    : tree[index] is set to {NULL_INDEX, NULL_INDEX, NULL_INDEX}.
 *   Returned   : None
 ****************************************************************************/
-static void ClearNode(const unsigned int index)
+template <class F>
+static void ClearNode(lzss_context_t *ctx, const unsigned int index)
 {
     const tree_node_t nullNode = {NULL_INDEX, NULL_INDEX, NULL_INDEX};
 
-    tree[index] = nullNode;
+    TreeState(ctx)->tree[index] = nullNode;
 }
 
 /****************************************************************************
 *   Function   : PrintLen
 *   Description: This function prints the string of length len that starts at
 *                slidingWindow[charIndex].
-*   Parameters : charIndex - sliding window index of the string to be
+*   Parameters : ctx - the encoder context
+*                charIndex - sliding window index of the string to be
 *                            printed.
 *                len - length of the string to be printed.
 *   Effects    : The string of length len starting at
 *                slidingWindow[charIndex] is printed to stdout.
 *   Returned   : NONE
 ****************************************************************************/
-static void PrintLen(const unsigned int charIndex, const unsigned int len)
+template <class F>
+static void PrintLen(lzss_context_t *ctx, const unsigned int charIndex,
+    const unsigned int len)
 {
+    const unsigned char *slidingWindow = ctx->slidingWindow;
     unsigned int i;
 
     for (i = 0; i < len; i++)
     {
-        if (isprint(slidingWindow[Wrap((i + charIndex), WINDOW_SIZE)]))
+        if (isprint(slidingWindow[Wrap((i + charIndex), F::WINDOW_SIZE)]))
         {
-            putchar(slidingWindow[Wrap((i + charIndex), WINDOW_SIZE)]);
+            putchar(slidingWindow[Wrap((i + charIndex), F::WINDOW_SIZE)]);
         }
         else
         {
-            printf("<%02X>", slidingWindow[Wrap((i + charIndex), WINDOW_SIZE)]);
+            printf("<%02X>",
+                slidingWindow[Wrap((i + charIndex), F::WINDOW_SIZE)]);
         }
     }
 }
@@ -525,13 +563,17 @@ static void PrintLen(const unsigned int charIndex, const unsigned int len)
 *   Function   : DumpTree
 *   Description: This function dumps the contents of the (sub)tree starting
 *                at node 'root' to stdout.
-*   Parameters : root - root node for subtree to be dumped
+*   Parameters : ctx - the encoder context
+*                root - root node for subtree to be dumped
 *   Effects    : The nodes contents of the (sub)tree rooted at node 'root' 
 *                are printed to stdout.
 *   Returned   : NONE
 ****************************************************************************/
-static void DumpTree(const unsigned int root)
+template <class F>
+static void DumpTree(lzss_context_t *ctx, const unsigned int root)
 {
+    const tree_node_t *tree = TreeState(ctx)->tree;
+
     if (NULL_INDEX == root)
     {
         /* empty tree */
@@ -540,15 +582,35 @@ static void DumpTree(const unsigned int root)
 
     if (tree[root].leftChild != NULL_INDEX)
     {
-        DumpTree(tree[root].leftChild);
+        DumpTree<F>(ctx, tree[root].leftChild);
     }
 
     printf("%03d: ", root);
-    PrintLen(root, MAX_CODED);
+    PrintLen<F>(ctx, root, F::MAX_CODED);
     printf("\n");
 
     if (tree[root].rightChild != NULL_INDEX)
     {
-        DumpTree(tree[root].rightChild);
+        DumpTree<F>(ctx, tree[root].rightChild);
     }
 }
+
+/***************************************************************************
+*                              MATCH FINDER
+***************************************************************************/
+/* the tree finder built for one format */
+#define TREE_FINDER(offsetBits, lengthBits) \
+    { \
+        "tree", \
+        sizeof(tree_state_t<format_traits_t<offsetBits, lengthBits> >), \
+        InitializeSearchStructures< \
+            format_traits_t<offsetBits, lengthBits> >, \
+        ReplaceChar<format_traits_t<offsetBits, lengthBits> >, \
+        FindMatch<format_traits_t<offsetBits, lengthBits> >, \
+        NULL                    /* nothing to free */ \
+    },
+
+const match_finder_t treeFinder[] =
+{
+    LZSS_FORMATS(TREE_FINDER)
+};